@@ -27,6 +27,7 @@
 #endif
 
 #include <cstring>
+#include <algorithm>
 #include <esp_log.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
@@ -108,7 +109,7 @@ void Application::CheckNewVersion() {
     while (true) {
         SetDeviceState(kDeviceStateActivating);
         auto display = Board::GetInstance().GetDisplay();
-        display->SetStatus(Lang::Strings::CHECKING_NEW_VERSION);
+        display->PostStatus(Lang::Strings::CHECKING_NEW_VERSION);
 
         if (!ota_.CheckVersion()) {
             retry_count++;
@@ -141,9 +142,9 @@ void Application::CheckNewVersion() {
 
             SetDeviceState(kDeviceStateUpgrading);
             
-            display->SetIcon(FONT_AWESOME_DOWNLOAD);
+            display->PostIcon(FONT_AWESOME_DOWNLOAD);
             std::string message = std::string(Lang::Strings::NEW_VERSION) + ota_.GetFirmwareVersion();
-            display->SetChatMessage("system", message.c_str());
+            display->PostChatMessage("system", message.c_str());
 
             auto& board = Board::GetInstance();
             board.SetPowerSaveMode(false);
@@ -164,11 +165,11 @@ void Application::CheckNewVersion() {
             ota_.StartUpgrade([display](int progress, size_t speed) {
                 char buffer[64];
                 snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress, speed / 1024);
-                display->SetChatMessage("system", buffer);
+                display->PostChatMessage("system", buffer);
             });
 
             // If upgrade success, the device will reboot and never reach here
-            display->SetStatus(Lang::Strings::UPGRADE_FAILED);
+            display->PostStatus(Lang::Strings::UPGRADE_FAILED);
             ESP_LOGI(TAG, "Firmware upgrade failed...");
             vTaskDelay(pdMS_TO_TICKS(3000));
             Reboot();
@@ -183,7 +184,7 @@ void Application::CheckNewVersion() {
             break;
         }
 
-        display->SetStatus(Lang::Strings::ACTIVATION);
+        display->PostStatus(Lang::Strings::ACTIVATION);
         // Activation code is shown to the user and waiting for the user to input
         if (ota_.HasActivationCode()) {
             ShowActivationCode();
@@ -244,9 +245,9 @@ void Application::ShowActivationCode() {
 void Application::Alert(const char* status, const char* message, const char* emotion, const std::string_view& sound) {
     ESP_LOGW(TAG, "Alert %s: %s [%s]", status, message, emotion);
     auto display = Board::GetInstance().GetDisplay();
-    display->SetStatus(status);
-    display->SetEmotion(emotion);
-    display->SetChatMessage("system", message);
+    display->PostStatus(status);
+    display->PostEmotion(emotion);
+    display->PostChatMessage("system", message);
     if (!sound.empty()) {
         ResetDecoder();
         PlaySound(sound);
@@ -256,9 +257,9 @@ void Application::Alert(const char* status, const char* message, const char* emo
 void Application::DismissAlert() {
     if (device_state_ == kDeviceStateIdle) {
         auto display = Board::GetInstance().GetDisplay();
-        display->SetStatus(Lang::Strings::STANDBY);
-        display->SetEmotion("neutral");
-        display->SetChatMessage("system", "");
+        display->PostStatus(Lang::Strings::STANDBY);
+        display->PostEmotion("neutral");
+        display->PostChatMessage("system", "");
     }
 }
 
@@ -288,7 +289,10 @@ void Application::PlaySound(const std::string_view& sound) {
 
         std::lock_guard<std::mutex> lock(mutex_);
         audio_decode_queue_.emplace_back(std::move(packet));
+        // PlayAudio counts every packet it plays, sounds included
+        received_audio_packets_++;
     }
+    audio_decode_cv_.notify_all();
 }
 
 void Application::EnterAudioTestingMode() {
@@ -429,6 +433,9 @@ void Application::Start() {
         reference_resampler_.Configure(codec->input_sample_rate(), 16000);
     }
     codec->Start();
+#if CONFIG_USE_PLAYOUT_TIME_STRETCH
+    time_stretcher_.Configure(codec->output_sample_rate());
+#endif
 
 #if CONFIG_USE_AUDIO_PROCESSOR
     xTaskCreatePinnedToCore([](void* arg) {
@@ -436,6 +443,13 @@ void Application::Start() {
         app->AudioLoop();
         vTaskDelete(NULL);
     }, "audio_loop", 4096 * 2, this, 8, &audio_loop_task_handle_, 1);
+    // Full duplex: playback decodes and writes on its own task, so a blocking I2S write
+    // never holds up capture or encoding
+    xTaskCreatePinnedToCore([](void* arg) {
+        Application* app = (Application*)arg;
+        app->AudioOutputLoop();
+        vTaskDelete(NULL);
+    }, "audio_output", 4096 * 4, this, 8, &audio_output_task_handle_, 0);
 #else
     xTaskCreate([](void* arg) {
         Application* app = (Application*)arg;
@@ -457,7 +471,7 @@ void Application::Start() {
     CheckNewVersion();
 
     // Initialize the protocol
-    display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
+    display->PostStatus(Lang::Strings::LOADING_PROTOCOL);
 
     // Add MCP common tools before initializing the protocol
 #if CONFIG_IOT_PROTOCOL_MCP
@@ -481,6 +495,8 @@ void Application::Start() {
         std::lock_guard<std::mutex> lock(mutex_);
         if (device_state_ == kDeviceStateSpeaking && audio_decode_queue_.size() < MAX_AUDIO_PACKETS_IN_QUEUE) {
             audio_decode_queue_.emplace_back(std::move(packet));
+            received_audio_packets_++;
+            audio_decode_cv_.notify_all();
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
@@ -503,23 +519,23 @@ void Application::Start() {
         board.SetPowerSaveMode(true);
         Schedule([this]() {
             auto display = Board::GetInstance().GetDisplay();
-            display->SetChatMessage("system", "");
+            display->PostChatMessage("system", "");
             SetDeviceState(kDeviceStateIdle);
         });
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
+    protocol_->OnIncomingJson([this, display](const JsonObject& root) {
+        // Read the few fields each message needs straight from the text
+        auto type = root["type"];
+        if (type.Equals("tts")) {
+            auto state = root["state"];
+            if (state.Equals("start")) {
                 Schedule([this]() {
                     aborted_ = false;
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
                         SetDeviceState(kDeviceStateSpeaking);
                     }
                 });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
+            } else if (state.Equals("stop")) {
                 Schedule([this]() {
                     background_task_->WaitForCompletion();
                     if (device_state_ == kDeviceStateSpeaking) {
@@ -530,72 +546,74 @@ void Application::Start() {
                         }
                     }
                 });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
+            } else if (state.Equals("sentence_start")) {
+                std::string text;
+                if (root["text"].GetString(text)) {
+                    ESP_LOGI(TAG, "<< %s", text.c_str());
+                    // The sentence is shown when playback reaches the audio received after it
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    std::lock_guard<std::mutex> decoder_lock(decoder_mutex_);
+                    pending_sentences_.push_back({received_audio_packets_, std::move(text)});
                 }
             }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
+        } else if (type.Equals("stt")) {
+            std::string text;
+            if (root["text"].GetString(text)) {
+                ESP_LOGI(TAG, ">> %s", text.c_str());
+                Schedule([this, display, message = std::move(text)]() {
+                    display->PostChatMessage("user", message.c_str());
                 });
             }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(emotion)) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
+        } else if (type.Equals("llm")) {
+            std::string emotion;
+            if (root["emotion"].GetString(emotion)) {
+                Schedule([this, display, emotion_str = std::move(emotion)]() {
+                    display->PostEmotion(emotion_str.c_str());
                 });
             }
 #if CONFIG_IOT_PROTOCOL_MCP
-        } else if (strcmp(type->valuestring, "mcp") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
-                McpServer::GetInstance().ParseMessage(payload);
+        } else if (type.Equals("mcp")) {
+            auto payload = root["payload"];
+            if (payload.IsObject()) {
+                McpServer::GetInstance().ParseMessage(payload.AsObject());
             }
 #endif
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
-        } else if (strcmp(type->valuestring, "iot") == 0) {
-            auto commands = cJSON_GetObjectItem(root, "commands");
-            if (cJSON_IsArray(commands)) {
+        } else if (type.Equals("iot")) {
+            // Commands are handed to the things as cJSON, parse just that part
+            auto commands_text = root["commands"];
+            if (commands_text.IsArray()) {
+                cJSON* commands = cJSON_ParseWithLength(commands_text.raw().data(), commands_text.raw().size());
                 auto& thing_manager = iot::ThingManager::GetInstance();
                 for (int i = 0; i < cJSON_GetArraySize(commands); ++i) {
                     auto command = cJSON_GetArrayItem(commands, i);
                     thing_manager.Invoke(command);
                 }
+                cJSON_Delete(commands);
             }
 #endif
-        } else if (strcmp(type->valuestring, "system") == 0) {
-            auto command = cJSON_GetObjectItem(root, "command");
-            if (cJSON_IsString(command)) {
-                ESP_LOGI(TAG, "System command: %s", command->valuestring);
-                if (strcmp(command->valuestring, "reboot") == 0) {
+        } else if (type.Equals("system")) {
+            std::string command;
+            if (root["command"].GetString(command)) {
+                ESP_LOGI(TAG, "System command: %s", command.c_str());
+                if (command == "reboot") {
                     // Do a reboot if user requests a OTA update
                     Schedule([this]() {
                         Reboot();
                     });
                 } else {
-                    ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
+                    ESP_LOGW(TAG, "Unknown system command: %s", command.c_str());
                 }
             }
-        } else if (strcmp(type->valuestring, "alert") == 0) {
-            auto status = cJSON_GetObjectItem(root, "status");
-            auto message = cJSON_GetObjectItem(root, "message");
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
-                Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::P3_VIBRATION);
+        } else if (type.Equals("alert")) {
+            std::string status, message, emotion;
+            if (root["status"].GetString(status) && root["message"].GetString(message) && root["emotion"].GetString(emotion)) {
+                Alert(status.c_str(), message.c_str(), emotion.c_str(), Lang::Sounds::P3_VIBRATION);
             } else {
                 ESP_LOGW(TAG, "Alert command requires status, message and emotion");
             }
         } else {
-            ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
+            ESP_LOGW(TAG, "Unknown message type: %.*s", (int)type.raw().size(), type.raw().data());
         }
     });
     bool protocol_started = protocol_->Start();
@@ -615,20 +633,8 @@ void Application::Start() {
                 AudioStreamPacket packet;
                 packet.payload = std::move(opus);
 #ifdef CONFIG_USE_SERVER_AEC
-                {
-                    std::lock_guard<std::mutex> lock(timestamp_mutex_);
-                    if (!timestamp_queue_.empty()) {
-                        packet.timestamp = timestamp_queue_.front();
-                        timestamp_queue_.pop_front();
-                    } else {
-                        packet.timestamp = 0;
-                    }
-
-                    if (timestamp_queue_.size() > 3) { // 限制队列长度3
-                        timestamp_queue_.pop_front(); // 该包发送前先出队保持队列长度
-                        return;
-                    }
-                }
+                packet.timestamp = aec_timeline_.GetTimestamp(encoded_samples_);
+                encoded_samples_ += 16000 * OPUS_FRAME_DURATION_MS / 1000;
 #endif
                 std::lock_guard<std::mutex> lock(mutex_);
                 if (audio_send_queue_.size() >= MAX_AUDIO_PACKETS_IN_QUEUE) {
@@ -668,6 +674,7 @@ void Application::Start() {
                     SetDeviceState(kDeviceStateConnecting);
                     if (!protocol_->OpenAudioChannel()) {
                         wake_word_->StartDetection();
+                        xTaskNotifyGive(audio_loop_task_handle_);
                         return;
                     }
                 }
@@ -704,8 +711,8 @@ void Application::Start() {
 
     if (protocol_started) {
         std::string message = std::string(Lang::Strings::VERSION) + ota_.GetCurrentVersion();
-        display->ShowNotification(message.c_str());
-        display->SetChatMessage("system", "");
+        display->PostNotification(message.c_str());
+        display->PostChatMessage("system", "");
         // Play the success sound to indicate the device is ready
         ResetDecoder();
         PlaySound(Lang::Sounds::P3_SUCCESS);
@@ -738,7 +745,7 @@ void Application::OnClockTimer() {
                     time_t now = time(NULL);
                     char time_str[64];
                     strftime(time_str, sizeof(time_str), "%H:%M  ", localtime(&now));
-                    Board::GetInstance().GetDisplay()->SetStatus(time_str);
+                    Board::GetInstance().GetDisplay()->PostStatus(time_str);
                 });
             }
         }
@@ -788,6 +795,11 @@ void Application::MainEventLoop() {
 
 // The Audio Loop is used to input and output audio data
 void Application::AudioLoop() {
+#if CONFIG_USE_AUDIO_PROCESSOR
+    while (true) {
+        OnAudioInput();
+    }
+#else
     auto codec = Board::GetInstance().GetAudioCodec();
     while (true) {
         OnAudioInput();
@@ -795,6 +807,19 @@ void Application::AudioLoop() {
             OnAudioOutput();
         }
     }
+#endif
+}
+
+// The Audio Output Loop plays audio on the output clock, independent of the input
+void Application::AudioOutputLoop() {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    while (true) {
+        if (!codec->output_enabled()) {
+            vTaskDelay(pdMS_TO_TICKS(OPUS_FRAME_DURATION_MS));
+            continue;
+        }
+        OnAudioOutput();
+    }
 }
 
 void Application::OnAudioOutput() {
@@ -802,14 +827,46 @@ void Application::OnAudioOutput() {
         return;
     }
 
-    auto now = std::chrono::steady_clock::now();
     auto codec = Board::GetInstance().GetAudioCodec();
     const int max_silence_seconds = 10;
 
     std::unique_lock<std::mutex> lock(mutex_);
-    if (audio_decode_queue_.empty()) {
+#if CONFIG_USE_AUDIO_PROCESSOR
+    // Keep up to AUDIO_OUTPUT_PREFETCH_FRAMES decoded ahead, so the next block is ready
+    // the moment the DMA accepts it and a slow decode never lets the speaker starve
+    audio_decode_cv_.wait_for(lock, std::chrono::milliseconds(OPUS_FRAME_DURATION_MS), [this]() {
+        return !audio_decode_queue_.empty() || !audio_prefetch_queue_.empty();
+    });
+    while (!audio_decode_queue_.empty() && audio_prefetch_queue_.size() < AUDIO_OUTPUT_PREFETCH_FRAMES) {
+        auto packet = std::move(audio_decode_queue_.front());
+        audio_decode_queue_.pop_front();
+        lock.unlock();
+        audio_decode_cv_.notify_all();
+
+        SetDecodeSampleRate(packet.sample_rate, packet.frame_duration);
+        {
+            std::lock_guard<std::mutex> decoder_lock(decoder_mutex_);
+            DecodedAudio decoded;
+            decoded.timestamp = packet.timestamp;
+            if (DecodeAudio(std::move(packet), decoded.pcm)) {
+                audio_prefetch_queue_.push_back(std::move(decoded));
+            }
+        }
+        lock.lock();
+    }
+    bool idle = audio_prefetch_queue_.empty();
+#else
+    bool idle = audio_decode_queue_.empty();
+#endif
+    if (idle) {
+#if CONFIG_USE_AUDIO_PROCESSOR
+        lock.unlock();
+        DrainTimeStretcher();
+        lock.lock();
+#endif
         // Disable the output if there is no audio data for a long time
         if (device_state_ == kDeviceStateIdle) {
+            auto now = std::chrono::steady_clock::now();
             auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
             if (duration > max_silence_seconds) {
                 codec->EnableOutput(false);
@@ -818,6 +875,21 @@ void Application::OnAudioOutput() {
         return;
     }
 
+#if CONFIG_USE_AUDIO_PROCESSOR
+    size_t queued_packets = audio_decode_queue_.size() + audio_prefetch_queue_.size();
+    lock.unlock();
+    DecodedAudio decoded;
+    {
+        std::lock_guard<std::mutex> decoder_lock(decoder_mutex_);
+        if (audio_prefetch_queue_.empty()) {
+            return;
+        }
+        decoded = std::move(audio_prefetch_queue_.front());
+        audio_prefetch_queue_.pop_front();
+        UpdatePlayoutSpeed(queued_packets);
+    }
+    PlayAudio(decoded.pcm, decoded.timestamp);
+#else
     auto packet = std::move(audio_decode_queue_.front());
     audio_decode_queue_.pop_front();
     lock.unlock();
@@ -827,30 +899,195 @@ void Application::OnAudioOutput() {
     SetDecodeSampleRate(packet.sample_rate, packet.frame_duration);
 
     busy_decoding_audio_ = true;
-    background_task_->Schedule([this, codec, packet = std::move(packet)]() mutable {
+    background_task_->Schedule([this, packet = std::move(packet)]() mutable {
         busy_decoding_audio_ = false;
-        if (aborted_) {
-            return;
-        }
-
+        uint32_t timestamp = packet.timestamp;
         std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(packet.payload), pcm)) {
-            return;
+        {
+            std::lock_guard<std::mutex> decoder_lock(decoder_mutex_);
+            if (!DecodeAudio(std::move(packet), pcm)) {
+                return;
+            }
         }
-        // Resample if the sample rate is different
-        if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-            int target_size = output_resampler_.GetOutputSamples(pcm.size());
-            std::vector<int16_t> resampled(target_size);
-            output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
-            pcm = std::move(resampled);
+        PlayAudio(pcm, timestamp);
+    });
+#endif
+}
+
+// The caller must hold decoder_mutex_
+bool Application::DecodeAudio(AudioStreamPacket&& packet, std::vector<int16_t>& pcm) {
+    if (aborted_) {
+        return false;
+    }
+
+    auto codec = Board::GetInstance().GetAudioCodec();
+    int64_t start_time = esp_timer_get_time();
+    if (!opus_decoder_->Decode(std::move(packet.payload), pcm)) {
+        return false;
+    }
+    // Resample if the sample rate is different
+    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
+        int target_size = output_resampler_.GetOutputSamples(pcm.size());
+        std::vector<int16_t> resampled(target_size);
+        output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
+        pcm = std::move(resampled);
+    }
+    int decode_us = esp_timer_get_time() - start_time;
+    if (decode_us > playback_stats_.max_decode_us) {
+        playback_stats_.max_decode_us = decode_us;
+    }
+    return true;
+}
+
+void Application::PlayAudio(std::vector<int16_t>& pcm, uint32_t timestamp) {
+    if (aborted_) {
+        return;
+    }
+
+    auto codec = Board::GetInstance().GetAudioCodec();
+#if CONFIG_USE_PLAYOUT_TIME_STRETCH
+    {
+        std::lock_guard<std::mutex> lock(decoder_mutex_);
+        if (playout_speed_percent_ != 100 || time_stretcher_.active()) {
+            int64_t start_time = esp_timer_get_time();
+            time_stretcher_.Process(pcm, playout_speed_percent_);
+            int stretch_us = esp_timer_get_time() - start_time;
+            playback_stats_.stretched_blocks++;
+            playback_stats_.max_stretch_us = std::max(playback_stats_.max_stretch_us, stretch_us);
         }
+    }
+    last_played_timestamp_ = timestamp;
+#endif
+    // The time stretcher may hold back a short block until it has a whole sequence
+    if (!pcm.empty()) {
         codec->OutputData(pcm);
 #ifdef CONFIG_USE_SERVER_AEC
-        std::lock_guard<std::mutex> lock(timestamp_mutex_);
-        timestamp_queue_.push_back(packet.timestamp);
+        aec_timeline_.OnPlayback(pcm, codec->output_sample_rate(), codec->output_start_frame(), timestamp);
+#endif
+    }
+    last_output_time_ = std::chrono::steady_clock::now();
+
+    // Start each sentence with its first packet and reveal the text as the audio plays.
+    // The display is posted to after decoder_mutex_ is released.
+    std::list<PendingSentence> started;
+    int progress_ms = -1;
+    {
+        // The first block of a session always follows silence, later gaps mean the output starved
+        std::lock_guard<std::mutex> lock(decoder_mutex_);
+        if (playback_stats_.blocks > 0 && codec->output_gap_frames() > 0) {
+            playback_stats_.gaps++;
+            playback_stats_.silence_ms += codec->output_gap_frames() * 1000 / codec->output_sample_rate();
+        }
+        playback_stats_.blocks++;
+
+        played_audio_packets_++;
+        while (!pending_sentences_.empty() && (int32_t)(played_audio_packets_ - pending_sentences_.front().first_packet) > 0) {
+            started.splice(started.end(), pending_sentences_, pending_sentences_.begin());
+            sentence_played_ms_ = 0;
+            sentence_visible_ = 0;
+        }
+        if (!started.empty()) {
+            sentence_text_ = started.back().text;
+        }
+        sentence_played_ms_ += pcm.size() * 1000 / codec->output_sample_rate();
+        // Most blocks reveal no new character, only those that do are posted
+        size_t visible = Display::GetSpokenLength(sentence_text_, sentence_played_ms_);
+        if (visible != sentence_visible_) {
+            sentence_visible_ = visible;
+            progress_ms = sentence_played_ms_;
+        }
+    }
+
+    auto display = Board::GetInstance().GetDisplay();
+    for (auto& sentence : started) {
+        display->PostStreamingMessage("assistant", sentence.text.c_str());
+    }
+    if (progress_ms >= 0) {
+        display->PostStreamingProgress(progress_ms);
+    }
+}
+
+// Plays the end of the stream the time stretcher still holds back once the queue runs dry
+void Application::DrainTimeStretcher() {
+#if CONFIG_USE_PLAYOUT_TIME_STRETCH
+    std::vector<int16_t> pcm;
+    {
+        std::lock_guard<std::mutex> lock(decoder_mutex_);
+        if (!time_stretcher_.active()) {
+            return;
+        }
+        time_stretcher_.Drain(pcm);
+        playout_speed_percent_ = 100;
+    }
+    if (aborted_ || pcm.empty()) {
+        return;
+    }
+
+    auto codec = Board::GetInstance().GetAudioCodec();
+    codec->OutputData(pcm);
+#ifdef CONFIG_USE_SERVER_AEC
+    aec_timeline_.OnPlayback(pcm, codec->output_sample_rate(), codec->output_start_frame(), last_played_timestamp_);
+#endif
+    last_output_time_ = std::chrono::steady_clock::now();
 #endif
-        last_output_time_ = std::chrono::steady_clock::now();
-    });
+}
+
+// The caller must hold decoder_mutex_
+void Application::UpdatePlayoutSpeed(size_t queued_packets) {
+#if CONFIG_USE_PLAYOUT_TIME_STRETCH
+    // Up to 10% faster to drain a backlog, 5% slower to stretch the last packets before
+    // the output runs dry, with hysteresis so the speed does not flap
+    int speed = playout_speed_percent_;
+    if (queued_packets >= PLAYOUT_FASTER_PACKETS) {
+        speed = 110;
+    } else if (queued_packets >= PLAYOUT_FAST_PACKETS) {
+        speed = std::max(speed, 105);
+    } else if (speed > 100 && queued_packets <= PLAYOUT_TARGET_PACKETS) {
+        speed = 100;
+    } else if (speed <= 100 && queued_packets <= PLAYOUT_STARVING_PACKETS) {
+        speed = 95;
+    } else if (speed < 100 && queued_packets > PLAYOUT_STARVING_PACKETS + 1) {
+        speed = 100;
+    }
+    if (speed != playout_speed_percent_) {
+        ESP_LOGD(TAG, "Playout speed %d%%, %u packets queued", speed, (unsigned)queued_packets);
+        playout_speed_percent_ = speed;
+    }
+#endif
+}
+
+void Application::ResetPlaybackStats() {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    std::lock_guard<std::mutex> lock(decoder_mutex_);
+    playback_stats_ = PlaybackStats();
+    playback_stats_.dma_underruns_at_start = codec->GetDmaStats().output_underruns;
+}
+
+void Application::FlushSentences() {
+    // Playback has ended, show whatever text is left in full
+    std::list<PendingSentence> remaining;
+    {
+        std::lock_guard<std::mutex> lock(decoder_mutex_);
+        remaining.swap(pending_sentences_);
+        sentence_text_.clear();
+        sentence_visible_ = 0;
+    }
+    auto display = Board::GetInstance().GetDisplay();
+    display->PostStreamingProgress(-1);
+    for (auto& sentence : remaining) {
+        display->PostChatMessage("assistant", sentence.text.c_str());
+    }
+}
+
+void Application::LogPlaybackStats() {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    auto dma_stats = codec->GetDmaStats();
+    std::lock_guard<std::mutex> lock(decoder_mutex_);
+    ESP_LOGI(TAG, "Playback: %lu blocks, %lu gaps, %lu ms silence inserted, %lu DMA underruns, max decode %d us, "
+        "%lu blocks time stretched, max stretch %d us",
+        playback_stats_.blocks, playback_stats_.gaps, playback_stats_.silence_ms,
+        dma_stats.output_underruns - playback_stats_.dma_underruns_at_start, playback_stats_.max_decode_us,
+        playback_stats_.stretched_blocks, playback_stats_.max_stretch_us);
 }
 
 void Application::OnAudioInput() {
@@ -892,13 +1129,24 @@ void Application::OnAudioInput() {
         int samples = audio_processor_->GetFeedSize();
         if (samples > 0) {
             if (ReadAudio(data, 16000, samples)) {
+#ifdef CONFIG_USE_SERVER_AEC
+                auto codec = Board::GetInstance().GetAudioCodec();
+                uint32_t play_frame = codec->GetOutputFrameAt(codec->input_time_us());
+                aec_timeline_.OnCapture(data, codec->input_channels(), 16000, play_frame);
+#endif
                 audio_processor_->Feed(data);
                 return;
             }
         }
     }
 
-    vTaskDelay(pdMS_TO_TICKS(OPUS_FRAME_DURATION_MS / 2));
+    // Nothing consumes the input, sleep until the device state changes
+#if CONFIG_USE_AUDIO_PROCESSOR
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+#else
+    // Without an output task the loop still has to poll the decode queue
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(OPUS_FRAME_DURATION_MS / 2));
+#endif
 }
 
 bool Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples) {
@@ -907,6 +1155,10 @@ bool Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int sam
         return false;
     }
 
+    // Sleep until the DMA holds the whole chunk instead of waking for every buffer
+    int frames = samples / codec->input_channels() * codec->input_sample_rate() / sample_rate;
+    codec->WaitForInput(frames, OPUS_FRAME_DURATION_MS * 2);
+
     if (codec->input_sample_rate() != sample_rate) {
         data.resize(samples * codec->input_sample_rate() / sample_rate);
         if (!codec->InputData(data)) {
@@ -970,6 +1222,10 @@ void Application::SetDeviceState(DeviceState state) {
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
     // The state is changed, wait for all background tasks to finish
     background_task_->WaitForCompletion();
+    if (previous_state == kDeviceStateSpeaking) {
+        LogPlaybackStats();
+        FlushSentences();
+    }
 
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
@@ -978,20 +1234,19 @@ void Application::SetDeviceState(DeviceState state) {
     switch (state) {
         case kDeviceStateUnknown:
         case kDeviceStateIdle:
-            display->SetStatus(Lang::Strings::STANDBY);
-            display->SetEmotion("neutral");
+            display->PostStatus(Lang::Strings::STANDBY);
+            display->PostEmotion("neutral");
             audio_processor_->Stop();
             wake_word_->StartDetection();
             break;
         case kDeviceStateConnecting:
-            display->SetStatus(Lang::Strings::CONNECTING);
-            display->SetEmotion("neutral");
-            display->SetChatMessage("system", "");
-            timestamp_queue_.clear();
+            display->PostStatus(Lang::Strings::CONNECTING);
+            display->PostEmotion("neutral");
+            display->PostChatMessage("system", "");
             break;
         case kDeviceStateListening:
-            display->SetStatus(Lang::Strings::LISTENING);
-            display->SetEmotion("neutral");
+            display->PostStatus(Lang::Strings::LISTENING);
+            display->PostEmotion("neutral");
             // Update the IoT states before sending the start listening command
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
             UpdateIotStates();
@@ -1008,12 +1263,19 @@ void Application::SetDeviceState(DeviceState state) {
                     vTaskDelay(pdMS_TO_TICKS(120));
                 }
                 opus_encoder_->ResetState();
+#ifdef CONFIG_USE_SERVER_AEC
+                aec_timeline_.Reset();
+                // The counter belongs to the encoding task, restart it behind the frames already queued
+                background_task_->Schedule([this]() {
+                    encoded_samples_ = 0;
+                });
+#endif
                 audio_processor_->Start();
                 wake_word_->StopDetection();
             }
             break;
         case kDeviceStateSpeaking:
-            display->SetStatus(Lang::Strings::SPEAKING);
+            display->PostStatus(Lang::Strings::SPEAKING);
 
             if (listening_mode_ != kListeningModeRealtime) {
                 audio_processor_->Stop();
@@ -1025,16 +1287,35 @@ void Application::SetDeviceState(DeviceState state) {
 #endif
             }
             ResetDecoder();
+            ResetPlaybackStats();
             break;
         default:
             // Do nothing
             break;
     }
+    // The input consumers may have changed, wake the audio loop if it is idle
+    WakeAudioLoop();
+}
+
+void Application::WakeAudioLoop() {
+    if (audio_loop_task_handle_ != nullptr) {
+        xTaskNotifyGive(audio_loop_task_handle_);
+    }
 }
 
 void Application::ResetDecoder() {
     std::lock_guard<std::mutex> lock(mutex_);
-    opus_decoder_->ResetState();
+    {
+        std::lock_guard<std::mutex> decoder_lock(decoder_mutex_);
+        opus_decoder_->ResetState();
+        audio_prefetch_queue_.clear();
+        // Dropped packets will never play, sentences waiting on them start with the next one
+        played_audio_packets_ = received_audio_packets_;
+#if CONFIG_USE_PLAYOUT_TIME_STRETCH
+        time_stretcher_.Reset();
+        playout_speed_percent_ = 100;
+#endif
+    }
     audio_decode_queue_.clear();
     audio_decode_cv_.notify_all();
     last_output_time_ = std::chrono::steady_clock::now();
@@ -1047,6 +1328,7 @@ void Application::SetDecodeSampleRate(int sample_rate, int frame_duration) {
         return;
     }
 
+    std::lock_guard<std::mutex> lock(decoder_mutex_);
     opus_decoder_.reset();
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
 
@@ -1122,15 +1404,15 @@ void Application::SetAecMode(AecMode mode) {
         switch (aec_mode_) {
         case kAecOff:
             audio_processor_->EnableDeviceAec(false);
-            display->ShowNotification(Lang::Strings::RTC_MODE_OFF);
+            display->PostNotification(Lang::Strings::RTC_MODE_OFF);
             break;
         case kAecOnServerSide:
             audio_processor_->EnableDeviceAec(false);
-            display->ShowNotification(Lang::Strings::RTC_MODE_ON);
+            display->PostNotification(Lang::Strings::RTC_MODE_ON);
             break;
         case kAecOnDeviceSide:
             audio_processor_->EnableDeviceAec(true);
-            display->ShowNotification(Lang::Strings::RTC_MODE_ON);
+            display->PostNotification(Lang::Strings::RTC_MODE_ON);
             break;
         }
 
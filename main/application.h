@@ -23,6 +23,8 @@
 #include "audio_processor.h"
 #include "wake_word.h"
 #include "audio_debugger.h"
+#include "aec_timeline.h"
+#include "time_stretcher.h"
 
 #define SCHEDULE_EVENT (1 << 0)
 #define SEND_AUDIO_EVENT (1 << 1)
@@ -51,6 +53,35 @@ enum DeviceState {
 #define OPUS_FRAME_DURATION_MS 60
 #define MAX_AUDIO_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
+#define AUDIO_OUTPUT_PREFETCH_FRAMES 2
+// Playback speeds up while more packets than this wait, until the backlog is back down
+// to the target, and slows down when it is about to run dry
+#define PLAYOUT_FAST_PACKETS 8
+#define PLAYOUT_FASTER_PACKETS 16
+#define PLAYOUT_TARGET_PACKETS 4
+#define PLAYOUT_STARVING_PACKETS 1
+
+// Playback statistics of one speaking session
+struct PlaybackStats {
+    uint32_t blocks = 0;
+    uint32_t gaps = 0;          // Blocks that started after the output had drained
+    uint32_t silence_ms = 0;    // Silence played in those gaps
+    uint32_t dma_underruns_at_start = 0;
+    int max_decode_us = 0;
+    uint32_t stretched_blocks = 0;  // Blocks played faster or slower than real time
+    int max_stretch_us = 0;
+};
+
+struct DecodedAudio {
+    std::vector<int16_t> pcm;
+    uint32_t timestamp = 0;
+};
+
+// A TTS sentence waiting for its audio to start playing
+struct PendingSentence {
+    uint32_t first_packet;
+    std::string text;
+};
 
 class Application {
 public:
@@ -67,6 +98,8 @@ public:
     bool IsVoiceDetected() const { return voice_detected_; }
     void Schedule(std::function<void()> callback);
     void SetDeviceState(DeviceState state);
+    // Wakes the audio loop when it sleeps because nothing consumes the input
+    void WakeAudioLoop();
     void Alert(const char* status, const char* message, const char* emotion = "", const std::string_view& sound = "");
     void DismissAlert();
     void AbortSpeaking(AbortReason reason);
@@ -108,17 +141,35 @@ private:
 
     // Audio encode / decode
     TaskHandle_t audio_loop_task_handle_ = nullptr;
+    TaskHandle_t audio_output_task_handle_ = nullptr;
     BackgroundTask* background_task_ = nullptr;
     std::chrono::steady_clock::time_point last_output_time_;
     std::list<AudioStreamPacket> audio_send_queue_;
     std::list<AudioStreamPacket> audio_decode_queue_;
+    uint32_t received_audio_packets_ = 0;  // Every packet queued for decoding, sounds included
     std::condition_variable audio_decode_cv_;
     std::list<AudioStreamPacket> audio_testing_queue_;
 
-    // 新增：用于维护音频包的timestamp队列
-    std::list<uint32_t> timestamp_queue_;
-    std::mutex timestamp_mutex_;
-
+#if CONFIG_USE_SERVER_AEC
+    // Maps uplink audio to the timestamp of the downlink audio it contains as echo
+    AecTimeline aec_timeline_;
+    uint32_t encoded_samples_ = 0;     // Only used on the background task
+#endif
+
+    // Guards the decoder, the prefetch queue, the playback statistics and the sentences
+    std::mutex decoder_mutex_;
+    std::list<DecodedAudio> audio_prefetch_queue_;
+    PlaybackStats playback_stats_;
+    uint32_t played_audio_packets_ = 0;
+    std::list<PendingSentence> pending_sentences_;
+    int sentence_played_ms_ = 0;
+    std::string sentence_text_;         // The sentence being revealed
+    size_t sentence_visible_ = 0;       // Bytes of it revealed so far
+#if CONFIG_USE_PLAYOUT_TIME_STRETCH
+    TimeStretcher time_stretcher_;
+    int playout_speed_percent_ = 100;
+    uint32_t last_played_timestamp_ = 0;   // Only used on the audio output task
+#endif
     std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
 
@@ -129,6 +180,13 @@ private:
     void MainEventLoop();
     void OnAudioInput();
     void OnAudioOutput();
+    bool DecodeAudio(AudioStreamPacket&& packet, std::vector<int16_t>& pcm);
+    void PlayAudio(std::vector<int16_t>& pcm, uint32_t timestamp);
+    void ResetPlaybackStats();
+    void UpdatePlayoutSpeed(size_t queued_packets);
+    void DrainTimeStretcher();
+    void FlushSentences();
+    void LogPlaybackStats();
     bool ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
@@ -137,6 +195,7 @@ private:
     void OnClockTimer();
     void SetListeningMode(ListeningMode mode);
     void AudioLoop();
+    void AudioOutputLoop();
     void EnterAudioTestingMode();
     void ExitAudioTestingMode();
 };
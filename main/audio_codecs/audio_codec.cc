@@ -1,31 +1,177 @@
 #include "audio_codec.h"
 #include "board.h"
 #include "settings.h"
+#include "application.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <cstring>
+#include <algorithm>
 #include <driver/i2s_common.h>
 
 #define TAG "AudioCodec"
 
 AudioCodec::AudioCodec() {
+    input_ready_ = xSemaphoreCreateBinary();
 }
 
 AudioCodec::~AudioCodec() {
+    vSemaphoreDelete(input_ready_);
 }
 
 void AudioCodec::OutputData(std::vector<int16_t>& data) {
+    // Data written now is queued behind the DMA ring, so it starts playing right after
+    // the previous block, or a full ring later if the output has drained in between
+    auto clock = GetOutputClock();
+    uint32_t earliest = clock.frames + (AUDIO_CODEC_DMA_DESC_NUM - 1) * AUDIO_CODEC_DMA_FRAME_NUM;
+    output_gap_frames_ = 0;
+    if ((int32_t)(output_cursor_ - earliest) < 0) {
+        output_gap_frames_ = earliest - output_cursor_;
+        output_cursor_ = earliest;
+    }
+    output_start_frame_ = output_cursor_;
+    output_cursor_ += data.size();
+    if (post_processor_) {
+        post_processor_->Process(data);
+    }
     Write(data.data(), data.size());
 }
 
 bool AudioCodec::InputData(std::vector<int16_t>& data) {
     int samples = Read(data.data(), data.size());
     if (samples > 0) {
+        // The read returns as soon as the last DMA buffer arrives, so the block ends at the input clock
+        auto clock = GetInputClock();
+        int64_t end_us = clock.time_us != 0 ? clock.time_us : esp_timer_get_time();
+        int frames = samples / input_channels_;
+        input_read_frames_ += frames;
+        input_time_us_ = end_us - (int64_t)frames * 1000000 / input_sample_rate_;
+        if (reference_aligner_) {
+            reference_aligner_->Process(data.data(), frames);
+        }
         return true;
     }
     return false;
 }
 
+bool IRAM_ATTR AudioCodec::OnDmaSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = (AudioCodec*)user_ctx;
+    portENTER_CRITICAL_ISR(&codec->clock_lock_);
+    codec->output_clock_.frames += AUDIO_CODEC_DMA_FRAME_NUM;
+    codec->output_clock_.time_us = esp_timer_get_time();
+    portEXIT_CRITICAL_ISR(&codec->clock_lock_);
+    return false;
+}
+
+bool IRAM_ATTR AudioCodec::OnDmaReceived(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = (AudioCodec*)user_ctx;
+    portENTER_CRITICAL_ISR(&codec->clock_lock_);
+    codec->input_clock_.frames += AUDIO_CODEC_DMA_FRAME_NUM;
+    codec->input_clock_.time_us = esp_timer_get_time();
+    bool ready = codec->input_waiting_ && (int32_t)(codec->input_clock_.frames - codec->input_wait_frames_) >= 0;
+    if (ready) {
+        codec->input_waiting_ = false;
+    }
+    portEXIT_CRITICAL_ISR(&codec->clock_lock_);
+
+    BaseType_t woken = pdFALSE;
+    if (ready) {
+        xSemaphoreGiveFromISR(codec->input_ready_, &woken);
+    }
+    return woken == pdTRUE;
+}
+
+bool IRAM_ATTR AudioCodec::OnDmaSendOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = (AudioCodec*)user_ctx;
+    portENTER_CRITICAL_ISR(&codec->clock_lock_);
+    codec->dma_stats_.output_underruns++;
+    portEXIT_CRITICAL_ISR(&codec->clock_lock_);
+    return false;
+}
+
+bool IRAM_ATTR AudioCodec::OnDmaReceiveOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = (AudioCodec*)user_ctx;
+    portENTER_CRITICAL_ISR(&codec->clock_lock_);
+    codec->dma_stats_.input_overruns++;
+    portEXIT_CRITICAL_ISR(&codec->clock_lock_);
+    return false;
+}
+
+bool AudioCodec::WaitForInput(int frames, int timeout_ms) {
+    // The DMA ring only holds this many frames, older ones have been dropped
+    const uint32_t ring_frames = AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM;
+    // Drop a wakeup left over from an earlier wait that timed out
+    xSemaphoreTake(input_ready_, 0);
+    portENTER_CRITICAL(&clock_lock_);
+    if (input_clock_.time_us == 0) {
+        // The clock is not running, the read has to block on its own
+        portEXIT_CRITICAL(&clock_lock_);
+        return false;
+    }
+    if (input_clock_.frames - input_read_frames_ > ring_frames) {
+        input_read_frames_ = input_clock_.frames - ring_frames;
+    }
+    input_wait_frames_ = input_read_frames_ + std::min<uint32_t>(frames, ring_frames - AUDIO_CODEC_DMA_FRAME_NUM);
+    bool ready = (int32_t)(input_clock_.frames - input_wait_frames_) >= 0;
+    input_waiting_ = !ready;
+    portEXIT_CRITICAL(&clock_lock_);
+    if (ready) {
+        return true;
+    }
+
+    ready = xSemaphoreTake(input_ready_, pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+    if (!ready) {
+        portENTER_CRITICAL(&clock_lock_);
+        input_waiting_ = false;
+        portEXIT_CRITICAL(&clock_lock_);
+    }
+    return ready;
+}
+
+void AudioCodec::RegisterDmaCallbacks() {
+    if (tx_handle_ != nullptr) {
+        i2s_event_callbacks_t callbacks = {};
+        callbacks.on_sent = OnDmaSent;
+        callbacks.on_send_q_ovf = OnDmaSendOverflow;
+        ESP_ERROR_CHECK(i2s_channel_register_event_callback(tx_handle_, &callbacks, this));
+    }
+    if (rx_handle_ != nullptr) {
+        i2s_event_callbacks_t callbacks = {};
+        callbacks.on_recv = OnDmaReceived;
+        callbacks.on_recv_q_ovf = OnDmaReceiveOverflow;
+        ESP_ERROR_CHECK(i2s_channel_register_event_callback(rx_handle_, &callbacks, this));
+    }
+}
+
+AudioClock AudioCodec::GetOutputClock() {
+    portENTER_CRITICAL(&clock_lock_);
+    AudioClock clock = output_clock_;
+    portEXIT_CRITICAL(&clock_lock_);
+    return clock;
+}
+
+AudioClock AudioCodec::GetInputClock() {
+    portENTER_CRITICAL(&clock_lock_);
+    AudioClock clock = input_clock_;
+    portEXIT_CRITICAL(&clock_lock_);
+    return clock;
+}
+
+AudioDmaStats AudioCodec::GetDmaStats() {
+    portENTER_CRITICAL(&clock_lock_);
+    AudioDmaStats stats = dma_stats_;
+    portEXIT_CRITICAL(&clock_lock_);
+    return stats;
+}
+
+uint32_t AudioCodec::GetOutputFrameAt(int64_t time_us) {
+    auto clock = GetOutputClock();
+    if (clock.time_us == 0) {
+        return 0;
+    }
+    return clock.frames + (int32_t)((time_us - clock.time_us) * output_sample_rate_ / 1000000);
+}
+
 void AudioCodec::Start() {
     Settings settings("audio", false);
     output_volume_ = settings.GetInt("output_volume", output_volume_);
@@ -34,6 +180,20 @@ void AudioCodec::Start() {
         output_volume_ = 10;
     }
 
+#if !CONFIG_AUDIO_OUTPUT_PRESET_NONE
+    auto config = AudioPostProcessor::GetPreset();
+    config.bass_db = settings.GetInt("eq_bass", config.bass_db);
+    config.treble_db = settings.GetInt("eq_treble", config.treble_db);
+    config.loudness_db = settings.GetInt("eq_loudness", config.loudness_db);
+    post_processor_ = std::make_unique<AudioPostProcessor>(output_sample_rate_);
+    post_processor_->Configure(config);
+#endif
+
+    if (input_reference_) {
+        reference_aligner_ = std::make_unique<ReferenceAligner>(input_sample_rate_, input_channels_);
+    }
+
+    RegisterDmaCallbacks();
     ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
     ESP_ERROR_CHECK(i2s_channel_enable(rx_handle_));
 
@@ -50,12 +210,28 @@ void AudioCodec::SetOutputVolume(int volume) {
     settings.SetInt("output_volume", output_volume_);
 }
 
+void AudioCodec::SetPostProcessorConfig(const AudioPostProcessorConfig& config) {
+    if (!post_processor_) {
+        return;
+    }
+    post_processor_->Configure(config);
+
+    Settings settings("audio", true);
+    settings.SetInt("eq_bass", config.bass_db);
+    settings.SetInt("eq_treble", config.treble_db);
+    settings.SetInt("eq_loudness", config.loudness_db);
+}
+
 void AudioCodec::EnableInput(bool enable) {
     if (enable == input_enabled_) {
         return;
     }
     input_enabled_ = enable;
     ESP_LOGI(TAG, "Set input enable to %s", enable ? "true" : "false");
+    if (enable) {
+        // The audio loop sleeps while the input is off, e.g. after a board power save callback
+        Application::GetInstance().WakeAudioLoop();
+    }
 }
 
 void AudioCodec::EnableOutput(bool enable) {
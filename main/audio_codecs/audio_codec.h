@@ -3,18 +3,34 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <freertos/semphr.h>
 #include <driver/i2s_std.h>
 
 #include <vector>
 #include <string>
 #include <functional>
+#include <memory>
 
 #include "board.h"
+#include "reference_aligner.h"
+#include "audio_post_processor.h"
 
 #define AUDIO_CODEC_DMA_DESC_NUM 6
 #define AUDIO_CODEC_DMA_FRAME_NUM 240
 #define AUDIO_CODEC_DEFAULT_MIC_GAIN 30.0
 
+// Position of an I2S DMA stream, updated from the DMA interrupt
+struct AudioClock {
+    uint32_t frames = 0;    // Frames transferred since the channel was enabled
+    int64_t time_us = 0;    // esp_timer time of the last transfer, 0 if the clock is not running
+};
+
+// Counters of the I2S DMA queues, updated from the DMA interrupt
+struct AudioDmaStats {
+    uint32_t output_underruns = 0;  // TX buffers sent again because no data was written in time
+    uint32_t input_overruns = 0;    // RX buffers dropped because no one read them in time
+};
+
 class AudioCodec {
 public:
     AudioCodec();
@@ -28,6 +44,14 @@ public:
     virtual bool InputData(std::vector<int16_t>& data);
     virtual void Start();
 
+    AudioClock GetOutputClock();
+    AudioClock GetInputClock();
+    // DMA frame at which the given time is (or was) played by the output channel
+    uint32_t GetOutputFrameAt(int64_t time_us);
+    // Blocks until the input DMA has received the given number of frames since the last
+    // InputData call, so the read that follows returns without waiting
+    bool WaitForInput(int frames, int timeout_ms);
+
     inline bool duplex() const { return duplex_; }
     inline bool input_reference() const { return input_reference_; }
     inline int input_sample_rate() const { return input_sample_rate_; }
@@ -37,6 +61,19 @@ public:
     inline int output_volume() const { return output_volume_; }
     inline bool input_enabled() const { return input_enabled_; }
     inline bool output_enabled() const { return output_enabled_; }
+    AudioDmaStats GetDmaStats();
+
+    // DMA frame at which the data of the last OutputData call starts to play
+    inline uint32_t output_start_frame() const { return output_start_frame_; }
+    // Silence played between the previous and the last OutputData call because the output drained
+    inline uint32_t output_gap_frames() const { return output_gap_frames_; }
+    // Capture time of the first frame of the last InputData call
+    inline int64_t input_time_us() const { return input_time_us_; }
+    // Speaker EQ and limiter, null if no output post-processing preset is configured
+    inline AudioPostProcessor* post_processor() const { return post_processor_.get(); }
+    void SetPostProcessorConfig(const AudioPostProcessorConfig& config);
+    // Aligns the loopback reference channel, null if the codec has no reference input
+    inline const ReferenceAligner* reference_aligner() const { return reference_aligner_.get(); }
 
 protected:
     i2s_chan_handle_t tx_handle_ = nullptr;
@@ -54,6 +91,30 @@ protected:
 
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
+
+    // Must be called before the channels are enabled
+    void RegisterDmaCallbacks();
+
+private:
+    portMUX_TYPE clock_lock_ = portMUX_INITIALIZER_UNLOCKED;
+    AudioClock output_clock_;
+    AudioClock input_clock_;
+    uint32_t output_cursor_ = 0;
+    uint32_t output_start_frame_ = 0;
+    uint32_t output_gap_frames_ = 0;
+    AudioDmaStats dma_stats_;
+    int64_t input_time_us_ = 0;
+    uint32_t input_read_frames_ = 0;
+    uint32_t input_wait_frames_ = 0;
+    bool input_waiting_ = false;
+    SemaphoreHandle_t input_ready_ = nullptr;
+    std::unique_ptr<ReferenceAligner> reference_aligner_;
+    std::unique_ptr<AudioPostProcessor> post_processor_;
+
+    static bool OnDmaSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
+    static bool OnDmaReceived(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
+    static bool OnDmaSendOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
+    static bool OnDmaReceiveOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
 };
 
 #endif // _AUDIO_CODEC_H
@@ -0,0 +1,124 @@
+#include "aec_timeline.h"
+
+#include <esp_log.h>
+#include <cstdlib>
+#include <algorithm>
+
+#define TAG "AecTimeline"
+
+#define MAX_SEGMENTS 64
+#define MAX_CAPTURE_MARKS 64
+// Run the delay estimator about twice a second
+#define ESTIMATE_INTERVAL_TICKS 500
+
+AecTimeline::AecTimeline(int history_ms) : played_envelope_(history_ms) {
+}
+
+void AecTimeline::Reset() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capture_marks_.clear();
+        capture_frames_ = 0;
+    }
+    // The delay itself is a property of the hardware, keep the last estimate
+    std::lock_guard<std::mutex> lock(estimator_mutex_);
+    ticks_since_estimate_ = 0;
+    delay_estimator_.Reset();
+}
+
+void AecTimeline::OnPlayback(const std::vector<int16_t>& pcm, int sample_rate, uint32_t start_frame, uint32_t timestamp) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    output_sample_rate_ = sample_rate;
+    segments_.push_back(Segment{start_frame, (uint32_t)pcm.size(), timestamp});
+    if (segments_.size() > MAX_SEGMENTS) {
+        segments_.pop_front();
+    }
+
+    // Keep the envelope of what is played, one tick per millisecond of output frames
+    int frames_per_tick = sample_rate / 1000;
+    uint32_t size = played_envelope_.size();
+    uint32_t tick = start_frame / frames_per_tick;
+    if ((int32_t)(tick - played_tick_end_) > 0) {
+        // Clear the ticks the output was idle for
+        uint32_t gap = std::min(tick - played_tick_end_, size);
+        for (uint32_t i = 0; i < gap; i++) {
+            played_envelope_[(tick - gap + i) % size] = 0;
+        }
+    }
+    playback_envelope_.resize(pcm.size() / frames_per_tick);
+    size_t ticks = DelayEstimator::ComputeEnvelope(pcm.data(), pcm.size(), 1, frames_per_tick, playback_envelope_.data());
+    for (size_t i = 0; i < ticks; i++) {
+        played_envelope_[(tick + i) % size] = playback_envelope_[i];
+    }
+    played_tick_end_ = tick + ticks;
+}
+
+void AecTimeline::OnCapture(const std::vector<int16_t>& data, int channels, int sample_rate, uint32_t play_frame) {
+    // The estimator has its own lock, so the playback path never waits for an estimate
+    std::lock_guard<std::mutex> estimator_lock(estimator_mutex_);
+    uint32_t frames = data.size() / channels;
+    int frames_per_tick = sample_rate / 1000;
+    capture_envelope_.resize(frames / frames_per_tick);
+    reference_envelope_.resize(capture_envelope_.size());
+    size_t ticks = DelayEstimator::ComputeEnvelope(data.data(), frames, channels, frames_per_tick, capture_envelope_.data());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capture_sample_rate_ = sample_rate;
+        capture_marks_.push_back(CaptureMark{capture_frames_, play_frame});
+        if (capture_marks_.size() > MAX_CAPTURE_MARKS) {
+            capture_marks_.pop_front();
+        }
+        capture_frames_ += frames;
+        if (output_sample_rate_ == 0) {
+            return;
+        }
+
+        // Pair the captured envelope with the envelope that was playing at the same time
+        uint32_t size = played_envelope_.size();
+        uint32_t tick = play_frame / (output_sample_rate_ / 1000);
+        for (size_t i = 0; i < ticks; i++) {
+            uint32_t age = played_tick_end_ - (tick + i);
+            bool available = (int32_t)age > 0 && age <= size;
+            reference_envelope_[i] = available ? played_envelope_[(tick + i) % size] : 0;
+        }
+    }
+    delay_estimator_.Push(capture_envelope_.data(), reference_envelope_.data(), ticks);
+
+    ticks_since_estimate_ += ticks;
+    if (ticks_since_estimate_ >= ESTIMATE_INTERVAL_TICKS) {
+        ticks_since_estimate_ = 0;
+        if (delay_estimator_.Estimate()) {
+            int delay_ms = delay_estimator_.delay();
+            if (std::abs(delay_ms - delay_ms_) > 2) {
+                ESP_LOGI(TAG, "Echo delay %d ms (confidence %.2f)", delay_ms, delay_estimator_.confidence());
+            }
+            delay_ms_ = delay_ms;
+        }
+    }
+}
+
+uint32_t AecTimeline::GetTimestamp(uint32_t capture_index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (output_sample_rate_ == 0 || capture_sample_rate_ == 0) {
+        return 0;
+    }
+
+    for (auto mark = capture_marks_.rbegin(); mark != capture_marks_.rend(); ++mark) {
+        int32_t offset = capture_index - mark->capture_index;
+        if (offset < 0) {
+            continue;
+        }
+        // The microphone hears what was played delay_ms_ earlier
+        uint32_t play_frame = mark->play_frame + (int64_t)offset * output_sample_rate_ / capture_sample_rate_
+            - delay_ms_ * output_sample_rate_ / 1000;
+        for (auto segment = segments_.rbegin(); segment != segments_.rend(); ++segment) {
+            uint32_t position = play_frame - segment->start_frame;
+            if ((int32_t)position >= 0 && position < segment->frames) {
+                return segment->timestamp + (uint64_t)position * 1000 / output_sample_rate_;
+            }
+        }
+        return 0;
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef AEC_TIMELINE_H
+#define AEC_TIMELINE_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "delay_estimator.h"
+
+// Maps captured microphone samples to the server timestamp of the audio that was
+// playing when they were recorded, so the server can align its echo canceller.
+//
+// Playback is tracked on the output DMA clock: every decoded packet is recorded at
+// the DMA frame where it starts to play. Capture blocks are recorded with the output
+// frame that was playing at their capture time. The residual acoustic delay between
+// the two is measured by correlating the played and captured envelopes.
+class AecTimeline {
+public:
+    AecTimeline(int history_ms = 2000);
+
+    // Starts a new capture session, capture indexes restart from zero
+    void Reset();
+    void OnPlayback(const std::vector<int16_t>& pcm, int sample_rate, uint32_t start_frame, uint32_t timestamp);
+    // data is interleaved with the microphone on channel 0, play_frame is the output frame
+    // playing when the first frame was captured
+    void OnCapture(const std::vector<int16_t>& data, int channels, int sample_rate, uint32_t play_frame);
+    // Returns the server timestamp for the capture frame at the given index, 0 during silence
+    uint32_t GetTimestamp(uint32_t capture_index);
+
+    inline int delay_ms() const { return delay_ms_; }
+
+private:
+    struct Segment {
+        uint32_t start_frame;
+        uint32_t frames;
+        uint32_t timestamp;
+    };
+    struct CaptureMark {
+        uint32_t capture_index;
+        uint32_t play_frame;
+    };
+
+    // Guards the playback timeline and the capture marks
+    std::mutex mutex_;
+    std::deque<Segment> segments_;
+    std::deque<CaptureMark> capture_marks_;
+    std::vector<uint16_t> played_envelope_;
+    std::vector<uint16_t> playback_envelope_;
+    uint32_t played_tick_end_ = 0;
+    int output_sample_rate_ = 0;
+    int capture_sample_rate_ = 0;
+    uint32_t capture_frames_ = 0;
+    std::atomic<int> delay_ms_ = 0;
+
+    // Guards the delay estimator and its envelope buffers, only the capture path runs it
+    std::mutex estimator_mutex_;
+    uint32_t ticks_since_estimate_ = 0;
+    DelayEstimator delay_estimator_;
+    std::vector<uint16_t> capture_envelope_;
+    std::vector<uint16_t> reference_envelope_;
+};
+
+#endif
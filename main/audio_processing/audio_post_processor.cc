@@ -0,0 +1,199 @@
+#include "audio_post_processor.h"
+
+#include <esp_log.h>
+#include <sdkconfig.h>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#define TAG "AudioPostProcessor"
+
+#define COEFFICIENT_SHIFT 28
+#define BASS_SHELF_HZ 250
+#define TREBLE_SHELF_HZ 4000
+#define LOOKAHEAD_MS 2
+// Limit peaks to -1 dBFS
+#define LIMITER_THRESHOLD 29204
+// Release time constant of about 2^10 samples, 40 ms at 24 kHz
+#define LIMITER_RELEASE_SHIFT 10
+// The soft clipper is linear below -2.5 dBFS and approaches full scale above it
+#define SOFT_CLIP_KNEE 24576
+
+AudioPostProcessor::AudioPostProcessor(int sample_rate) : sample_rate_(sample_rate) {
+    lookahead_.resize(std::max(1, sample_rate_ * LOOKAHEAD_MS / 1000), 0);
+}
+
+AudioPostProcessorConfig AudioPostProcessor::GetPreset() {
+    AudioPostProcessorConfig config;
+#if CONFIG_AUDIO_OUTPUT_PRESET_LOUDNESS
+    config.loudness_db = 6;
+    config.limiter = true;
+#elif CONFIG_AUDIO_OUTPUT_PRESET_SMALL_SPEAKER
+    // Small speakers cannot move the air below ~150 Hz, spend the headroom on the mids instead
+    config.low_cut_hz = 150;
+    config.bass_db = 3;
+    config.treble_db = 2;
+    config.loudness_db = 6;
+    config.limiter = true;
+#endif
+    return config;
+}
+
+AudioPostProcessorConfig AudioPostProcessor::config() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return config_;
+}
+
+void AudioPostProcessor::Configure(const AudioPostProcessorConfig& config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Stages that stay enabled keep their state, so changing a gain does not click
+    bool limiter_enabled = config.limiter && !config_.limiter;
+    auto previous = std::move(biquads_);
+    config_ = config;
+    biquads_.clear();
+
+    // RBJ audio EQ cookbook designs, Q = 0.707 and shelf slope 1
+    const float pi = 3.14159265f;
+    if (config.low_cut_hz > 0) {
+        float w0 = 2 * pi * config.low_cut_hz / sample_rate_;
+        float alpha = sinf(w0) / (2 * 0.7071f);
+        float cosw = cosf(w0);
+        AddBiquad(kLowCut, (1 + cosw) / 2, -(1 + cosw), (1 + cosw) / 2, 1 + alpha, -2 * cosw, 1 - alpha);
+    }
+    if (config.bass_db != 0) {
+        float a = powf(10, config.bass_db / 40.0f);
+        float w0 = 2 * pi * BASS_SHELF_HZ / sample_rate_;
+        float alpha = sinf(w0) / 2 * sqrtf(2);
+        float cosw = cosf(w0);
+        float sqa = 2 * sqrtf(a) * alpha;
+        AddBiquad(kBassShelf, a * ((a + 1) - (a - 1) * cosw + sqa), 2 * a * ((a - 1) - (a + 1) * cosw), a * ((a + 1) - (a - 1) * cosw - sqa),
+            (a + 1) + (a - 1) * cosw + sqa, -2 * ((a - 1) + (a + 1) * cosw), (a + 1) + (a - 1) * cosw - sqa);
+    }
+    int treble_hz = std::min(TREBLE_SHELF_HZ, sample_rate_ * 2 / 5);
+    if (config.treble_db != 0) {
+        float a = powf(10, config.treble_db / 40.0f);
+        float w0 = 2 * pi * treble_hz / sample_rate_;
+        float alpha = sinf(w0) / 2 * sqrtf(2);
+        float cosw = cosf(w0);
+        float sqa = 2 * sqrtf(a) * alpha;
+        AddBiquad(kTrebleShelf, a * ((a + 1) + (a - 1) * cosw + sqa), -2 * a * ((a - 1) + (a + 1) * cosw), a * ((a + 1) + (a - 1) * cosw - sqa),
+            (a + 1) - (a - 1) * cosw + sqa, 2 * ((a - 1) - (a + 1) * cosw), (a + 1) - (a - 1) * cosw - sqa);
+    }
+
+    for (auto& biquad : biquads_) {
+        for (auto& old : previous) {
+            if (old.stage == biquad.stage) {
+                biquad.x1 = old.x1;
+                biquad.x2 = old.x2;
+                biquad.y1 = old.y1;
+                biquad.y2 = old.y2;
+            }
+        }
+    }
+
+    gain_q12_ = lroundf(powf(10, config.loudness_db / 20.0f) * 4096);
+    if (limiter_enabled) {
+        std::fill(lookahead_.begin(), lookahead_.end(), 0);
+        lookahead_pos_ = 0;
+        limiter_gain_ = 32768;
+        hold_target_ = 32768;
+        hold_count_ = 0;
+    }
+    ESP_LOGI(TAG, "Low cut %d Hz, bass %d dB, treble %d dB, loudness %d dB, limiter %s",
+        config.low_cut_hz, config.bass_db, config.treble_db, config.loudness_db, config.limiter ? "on" : "off");
+}
+
+void AudioPostProcessor::AddBiquad(BiquadStage stage, float b0, float b1, float b2, float a0, float a1, float a2) {
+    const float scale = (float)(1 << COEFFICIENT_SHIFT) / a0;
+    Biquad biquad;
+    biquad.stage = stage;
+    biquad.b0 = lroundf(b0 * scale);
+    biquad.b1 = lroundf(b1 * scale);
+    biquad.b2 = lroundf(b2 * scale);
+    biquad.a1 = lroundf(-a1 * scale);
+    biquad.a2 = lroundf(-a2 * scale);
+    biquads_.push_back(biquad);
+}
+
+void AudioPostProcessor::Process(std::vector<int16_t>& data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (biquads_.empty() && gain_q12_ == 4096 && !config_.limiter) {
+        return;
+    }
+
+    // Reused across blocks, it only grows when a longer block arrives
+    samples_.assign(data.begin(), data.end());
+    ProcessBiquads(samples_.data(), samples_.size());
+    if (gain_q12_ != 4096) {
+        for (auto& sample : samples_) {
+            sample = ((int64_t)sample * gain_q12_) >> 12;
+        }
+    }
+    if (config_.limiter) {
+        ProcessLimiter(samples_.data(), samples_.size());
+    }
+    for (size_t i = 0; i < samples_.size(); i++) {
+        data[i] = SoftClip(samples_[i]);
+    }
+}
+
+void AudioPostProcessor::ProcessBiquads(int32_t* samples, size_t count) {
+    // One stage at a time over the whole block keeps the coefficients and state in registers
+    for (auto& biquad : biquads_) {
+        const int32_t b0 = biquad.b0, b1 = biquad.b1, b2 = biquad.b2, a1 = biquad.a1, a2 = biquad.a2;
+        int32_t x1 = biquad.x1, x2 = biquad.x2, y1 = biquad.y1, y2 = biquad.y2;
+        for (size_t i = 0; i < count; i++) {
+            int32_t x = samples[i];
+            int64_t acc = (int64_t)b0 * x + (int64_t)b1 * x1 + (int64_t)b2 * x2 + (int64_t)a1 * y1 + (int64_t)a2 * y2;
+            int32_t y = acc >> COEFFICIENT_SHIFT;
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            samples[i] = y;
+        }
+        biquad.x1 = x1;
+        biquad.x2 = x2;
+        biquad.y1 = y1;
+        biquad.y2 = y2;
+    }
+}
+
+void AudioPostProcessor::ProcessLimiter(int32_t* samples, size_t count) {
+    // Each sample is delayed by the look-ahead, so the gain has ramped down by the time a peak leaves
+    const int lookahead = lookahead_.size();
+    for (size_t i = 0; i < count; i++) {
+        int32_t input = samples[i];
+        int32_t peak = std::abs(input);
+        int32_t target = peak > LIMITER_THRESHOLD ? (int32_t)(((int64_t)LIMITER_THRESHOLD << 15) / peak) : 32768;
+        if (target <= hold_target_ || hold_count_ == 0) {
+            hold_target_ = target;
+            hold_count_ = lookahead;
+        } else {
+            hold_count_--;
+        }
+
+        if (hold_target_ < limiter_gain_) {
+            limiter_gain_ -= (limiter_gain_ - hold_target_ + hold_count_) / (hold_count_ + 1);
+        } else {
+            limiter_gain_ += (32768 - limiter_gain_) >> LIMITER_RELEASE_SHIFT;
+        }
+
+        int32_t delayed = lookahead_[lookahead_pos_];
+        lookahead_[lookahead_pos_] = input;
+        lookahead_pos_ = (lookahead_pos_ + 1) % lookahead;
+        samples[i] = ((int64_t)delayed * limiter_gain_) >> 15;
+    }
+}
+
+int16_t AudioPostProcessor::SoftClip(int32_t sample) {
+    int32_t magnitude = std::abs(sample);
+    if (magnitude <= SOFT_CLIP_KNEE) {
+        return sample;
+    }
+    // y = knee + range * d / (range + d), slope 1 at the knee and approaching full scale
+    const int32_t range = 32767 - SOFT_CLIP_KNEE;
+    int64_t over = magnitude - SOFT_CLIP_KNEE;
+    int32_t clipped = SOFT_CLIP_KNEE + (int32_t)(range * over / (range + over));
+    return sample < 0 ? -clipped : clipped;
+}
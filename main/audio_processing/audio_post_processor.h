@@ -0,0 +1,62 @@
+#ifndef AUDIO_POST_PROCESSOR_H
+#define AUDIO_POST_PROCESSOR_H
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+
+struct AudioPostProcessorConfig {
+    int low_cut_hz = 0;     // High-pass cutoff, 0 disables it
+    int bass_db = 0;        // Low shelf gain below 250 Hz
+    int treble_db = 0;      // High shelf gain above 4 kHz
+    int loudness_db = 0;    // Gain in front of the limiter
+    bool limiter = false;
+};
+
+// Speaker output chain: cascaded biquad EQ, gain, look-ahead peak limiter and soft clipper.
+// Runs in fixed point on mono 16-bit PCM, intermediate samples keep 32 bits of headroom
+// so boosts never wrap before the limiter.
+class AudioPostProcessor {
+public:
+    AudioPostProcessor(int sample_rate);
+
+    void Configure(const AudioPostProcessorConfig& config);
+    AudioPostProcessorConfig config();
+    void Process(std::vector<int16_t>& data);
+
+    // Default configuration selected by CONFIG_AUDIO_OUTPUT_PRESET_*
+    static AudioPostProcessorConfig GetPreset();
+
+private:
+    enum BiquadStage {
+        kLowCut,
+        kBassShelf,
+        kTrebleShelf,
+    };
+    // Direct form I, coefficients in Q28 with a1/a2 negated
+    struct Biquad {
+        BiquadStage stage;
+        int32_t b0, b1, b2, a1, a2;
+        int32_t x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+    };
+
+    std::mutex mutex_;
+    int sample_rate_;
+    AudioPostProcessorConfig config_;
+    std::vector<Biquad> biquads_;
+    int32_t gain_q12_ = 4096;
+    std::vector<int32_t> samples_;
+
+    std::vector<int32_t> lookahead_;
+    size_t lookahead_pos_ = 0;
+    int32_t limiter_gain_ = 32768;  // Q15
+    int32_t hold_target_ = 32768;
+    int hold_count_ = 0;
+
+    void AddBiquad(BiquadStage stage, float b0, float b1, float b2, float a0, float a1, float a2);
+    void ProcessBiquads(int32_t* samples, size_t count);
+    void ProcessLimiter(int32_t* samples, size_t count);
+    static int16_t SoftClip(int32_t sample);
+};
+
+#endif
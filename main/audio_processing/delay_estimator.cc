@@ -0,0 +1,113 @@
+#include "delay_estimator.h"
+
+#include <cmath>
+#include <cstdlib>
+
+// A correlation peak below this is treated as noise
+#define MIN_CONFIDENCE 0.35f
+// The reference must carry some signal (envelope variance) to be worth correlating
+#define MIN_REFERENCE_VARIANCE 100.0f
+
+DelayEstimator::DelayEstimator(int max_delay_ticks, int window_ticks)
+    : max_delay_(max_delay_ticks), window_(window_ticks) {
+    capture_.resize(window_ + max_delay_);
+    reference_.resize(window_ + max_delay_);
+    capture_window_.resize(window_);
+    reference_linear_.resize(window_ + max_delay_);
+    reference_sum_.resize(window_ + max_delay_ + 1);
+    reference_square_sum_.resize(window_ + max_delay_ + 1);
+}
+
+void DelayEstimator::Reset() {
+    write_pos_ = 0;
+    filled_ = 0;
+}
+
+void DelayEstimator::Push(const uint16_t* capture, const uint16_t* reference, size_t count) {
+    size_t size = capture_.size();
+    for (size_t i = 0; i < count; i++) {
+        capture_[write_pos_] = capture[i];
+        reference_[write_pos_] = reference[i];
+        write_pos_ = (write_pos_ + 1) % size;
+    }
+    filled_ += count;
+    if (filled_ > size) {
+        filled_ = size;
+    }
+}
+
+size_t DelayEstimator::ComputeEnvelope(const int16_t* pcm, size_t frames, int stride, int frames_per_tick, uint16_t* out) {
+    size_t ticks = frames / frames_per_tick;
+    for (size_t t = 0; t < ticks; t++) {
+        uint32_t sum = 0;
+        const int16_t* p = pcm + t * frames_per_tick * stride;
+        for (int i = 0; i < frames_per_tick; i++) {
+            sum += std::abs(p[i * stride]);
+        }
+        out[t] = sum / frames_per_tick;
+    }
+    return ticks;
+}
+
+bool DelayEstimator::Estimate() {
+    size_t size = capture_.size();
+    if (filled_ < size) {
+        return false;
+    }
+
+    // Unroll the rings oldest first. The capture window is the newest window_ ticks,
+    // the reference keeps prefix sums so every lag gets its mean and energy in O(1).
+    float capture_mean = 0;
+    for (int i = 0; i < window_; i++) {
+        capture_window_[i] = capture_[(write_pos_ + max_delay_ + i) % size];
+        capture_mean += capture_window_[i];
+    }
+    capture_mean /= window_;
+    float capture_energy = 0;
+    for (int i = 0; i < window_; i++) {
+        capture_window_[i] -= capture_mean;
+        capture_energy += capture_window_[i] * capture_window_[i];
+    }
+    if (capture_energy <= 0) {
+        return false;
+    }
+
+    reference_sum_[0] = 0;
+    reference_square_sum_[0] = 0;
+    for (size_t i = 0; i < size; i++) {
+        float value = reference_[(write_pos_ + i) % size];
+        reference_linear_[i] = value;
+        reference_sum_[i + 1] = reference_sum_[i] + value;
+        reference_square_sum_[i + 1] = reference_square_sum_[i] + value * value;
+    }
+
+    int best_delay = -1;
+    float best_score = 0;
+    for (int delay = 0; delay <= max_delay_; delay++) {
+        int start = max_delay_ - delay;
+        double sum = reference_sum_[start + window_] - reference_sum_[start];
+        float variance = (reference_square_sum_[start + window_] - reference_square_sum_[start]) - sum * sum / window_;
+        if (variance < MIN_REFERENCE_VARIANCE * window_) {
+            continue;
+        }
+        // The capture window is zero mean, so the reference mean drops out of the dot product
+        const float* reference = &reference_linear_[start];
+        float dot = 0;
+        for (int i = 0; i < window_; i++) {
+            dot += capture_window_[i] * reference[i];
+        }
+        float score = dot / sqrtf(capture_energy * variance);
+        if (score > best_score) {
+            best_score = score;
+            best_delay = delay;
+        }
+    }
+
+    if (best_delay < 0 || best_score < MIN_CONFIDENCE) {
+        return false;
+    }
+    delay_ = best_delay;
+    confidence_ = best_score;
+    valid_ = true;
+    return true;
+}
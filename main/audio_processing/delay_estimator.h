@@ -0,0 +1,45 @@
+#ifndef DELAY_ESTIMATOR_H
+#define DELAY_ESTIMATOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Estimates how far the capture signal lags behind a reference signal by
+// cross-correlating their envelopes. Both signals are pushed in lockstep as
+// envelopes of one value per tick (about 1 ms), so a full estimate only costs
+// window * max_delay multiply-adds and can run at a low duty cycle.
+class DelayEstimator {
+public:
+    DelayEstimator(int max_delay_ticks = 250, int window_ticks = 1000);
+
+    void Reset();
+    void Push(const uint16_t* capture, const uint16_t* reference, size_t count);
+    // Returns true if a confident estimate was made, call it every few hundred ticks
+    bool Estimate();
+
+    inline int delay() const { return delay_; }
+    inline float confidence() const { return confidence_; }
+    inline bool valid() const { return valid_; }
+
+    // Reduces interleaved PCM to one mean absolute value per frames_per_tick frames.
+    // Returns the number of ticks written, a trailing partial tick is ignored.
+    static size_t ComputeEnvelope(const int16_t* pcm, size_t frames, int stride, int frames_per_tick, uint16_t* out);
+
+private:
+    int max_delay_;
+    int window_;
+    std::vector<uint16_t> capture_;
+    std::vector<uint16_t> reference_;
+    std::vector<float> capture_window_;
+    std::vector<float> reference_linear_;
+    std::vector<double> reference_sum_;
+    std::vector<double> reference_square_sum_;
+    size_t write_pos_ = 0;
+    size_t filled_ = 0;
+    int delay_ = 0;
+    float confidence_ = 0.0f;
+    bool valid_ = false;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "reference_aligner.h"
+
+#include <esp_log.h>
+#include <cstdlib>
+#include <algorithm>
+
+#define TAG "ReferenceAligner"
+
+// The capture envelope is held back so a reference arriving up to this late is still found
+#define MAX_REFERENCE_LAG_MS 50
+#define MAX_ECHO_LAG_MS 200
+// Lag of the echo behind the reference the AEC is given after compensation
+#define TARGET_ECHO_LAG_MS 4
+// Compensation is only changed for larger moves, every change disturbs the AEC filter
+#define COMPENSATION_HYSTERESIS_MS 3
+#define MAX_COMPENSATION_MS 200
+// Estimate once a second until the delay is known, then back off to once every 16 seconds
+#define MIN_ESTIMATE_INTERVAL_TICKS 1000
+#define MAX_ESTIMATE_INTERVAL_TICKS 16000
+
+ReferenceAligner::ReferenceAligner(int sample_rate, int channels)
+    : sample_rate_(sample_rate), channels_(channels), frames_per_tick_(sample_rate / 1000),
+      delay_estimator_(MAX_REFERENCE_LAG_MS + MAX_ECHO_LAG_MS, 1000),
+      capture_lead_(MAX_REFERENCE_LAG_MS, 0),
+      estimate_interval_(MIN_ESTIMATE_INTERVAL_TICKS) {
+    history_frames_ = MAX_COMPENSATION_MS * sample_rate_ / 1000 + 1;
+    history_.resize(history_frames_ * channels_, 0);
+}
+
+void ReferenceAligner::Process(int16_t* data, size_t frames) {
+    // Measure on the raw input so the estimate does not depend on the current compensation
+    size_t max_ticks = frames / frames_per_tick_;
+    capture_envelope_.resize(max_ticks);
+    reference_envelope_.resize(max_ticks);
+    size_t ticks = DelayEstimator::ComputeEnvelope(data, frames, channels_, frames_per_tick_, capture_envelope_.data());
+    DelayEstimator::ComputeEnvelope(data + channels_ - 1, frames, channels_, frames_per_tick_, reference_envelope_.data());
+    for (size_t i = 0; i < ticks; i++) {
+        std::swap(capture_envelope_[i], capture_lead_[capture_lead_pos_]);
+        capture_lead_pos_ = (capture_lead_pos_ + 1) % capture_lead_.size();
+    }
+    delay_estimator_.Push(capture_envelope_.data(), reference_envelope_.data(), ticks);
+
+    ticks_since_estimate_ += ticks;
+    if (ticks_since_estimate_ >= estimate_interval_) {
+        ticks_since_estimate_ = 0;
+        if (delay_estimator_.Estimate()) {
+            int delay_ms = delay_estimator_.delay() - MAX_REFERENCE_LAG_MS;
+            if (!delay_valid_ || std::abs(delay_ms - delay_ms_) > 2) {
+                ESP_LOGI(TAG, "Reference delay %d ms (confidence %.2f)", delay_ms, delay_estimator_.confidence());
+                estimate_interval_ = MIN_ESTIMATE_INTERVAL_TICKS;
+            } else {
+                estimate_interval_ = std::min(estimate_interval_ * 2, MAX_ESTIMATE_INTERVAL_TICKS);
+            }
+            delay_ms_ = delay_ms;
+            delay_valid_ = true;
+            UpdateCompensation(delay_ms);
+        }
+    }
+
+    // Pass every frame through the history ring, reading each channel back at its own delay.
+    // The ring is kept current without compensation too, so enabling a delay never reads stale audio.
+    bool compensating = mic_delay_frames_ != 0 || reference_delay_frames_ != 0;
+    for (size_t f = 0; f < frames; f++) {
+        int16_t* frame = data + f * channels_;
+        std::copy(frame, frame + channels_, &history_[history_pos_ * channels_]);
+        if (!compensating) {
+            history_pos_ = (history_pos_ + 1) % history_frames_;
+            continue;
+        }
+        size_t mic_pos = (history_pos_ + history_frames_ - mic_delay_frames_) % history_frames_;
+        size_t reference_pos = (history_pos_ + history_frames_ - reference_delay_frames_) % history_frames_;
+        for (int c = 0; c < channels_ - 1; c++) {
+            frame[c] = history_[mic_pos * channels_ + c];
+        }
+        frame[channels_ - 1] = history_[reference_pos * channels_ + channels_ - 1];
+        history_pos_ = (history_pos_ + 1) % history_frames_;
+    }
+}
+
+void ReferenceAligner::UpdateCompensation(int delay_ms) {
+    // Positive: the reference is delayed, negative: the microphones are delayed
+    int current_ms = (reference_delay_frames_ - mic_delay_frames_) * 1000 / sample_rate_;
+    int wanted_ms = std::clamp(delay_ms - TARGET_ECHO_LAG_MS, -MAX_COMPENSATION_MS, MAX_COMPENSATION_MS);
+    if (std::abs(wanted_ms - current_ms) < COMPENSATION_HYSTERESIS_MS) {
+        return;
+    }
+    int frames = std::abs(wanted_ms) * sample_rate_ / 1000;
+    reference_delay_frames_ = wanted_ms > 0 ? frames : 0;
+    mic_delay_frames_ = wanted_ms < 0 ? frames : 0;
+    ESP_LOGI(TAG, "Delaying %s by %d ms", wanted_ms > 0 ? "reference" : "microphones", std::abs(wanted_ms));
+}
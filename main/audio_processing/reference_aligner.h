@@ -0,0 +1,51 @@
+#ifndef REFERENCE_ALIGNER_H
+#define REFERENCE_ALIGNER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "delay_estimator.h"
+
+// Aligns the hardware loopback reference with the echo in the microphone channels.
+//
+// The input is interleaved with the reference as the last channel, the layout fed to
+// the AFE ("MR", "MMR", ...). The AEC can only cancel echo that arrives after its
+// reference, so the lag of the echo behind the reference is measured by envelope
+// correlation at a low duty cycle and either the reference or the microphones are
+// delayed to keep that lag at a small positive target.
+class ReferenceAligner {
+public:
+    ReferenceAligner(int sample_rate, int channels);
+
+    // Processes interleaved frames in place
+    void Process(int16_t* data, size_t frames);
+
+    // Measured lag of the microphone echo behind the raw reference, negative if the reference is late
+    inline int delay_ms() const { return delay_ms_; }
+    inline bool delay_valid() const { return delay_valid_; }
+
+private:
+    int sample_rate_;
+    int channels_;
+    int frames_per_tick_;
+    DelayEstimator delay_estimator_;
+    std::vector<uint16_t> capture_envelope_;
+    std::vector<uint16_t> reference_envelope_;
+    std::vector<uint16_t> capture_lead_;
+    size_t capture_lead_pos_ = 0;
+    int ticks_since_estimate_ = 0;
+    int estimate_interval_ = 0;
+
+    std::vector<int16_t> history_;
+    size_t history_frames_;
+    size_t history_pos_ = 0;
+    int mic_delay_frames_ = 0;
+    int reference_delay_frames_ = 0;
+    int delay_ms_ = 0;
+    bool delay_valid_ = false;
+
+    void UpdateCompensation(int delay_ms);
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "time_stretcher.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Sequence, overlap and seek window lengths, tuned for speech
+#define SEQUENCE_MS 40
+#define OVERLAP_MS 10
+#define SEEK_MS 12
+// The seek tries every COARSE_SEEK_STEP offset first, then refines around the best one
+#define COARSE_SEEK_STEP 4
+
+void TimeStretcher::Configure(int sample_rate) {
+    sequence_samples_ = sample_rate * SEQUENCE_MS / 1000;
+    overlap_samples_ = sample_rate * OVERLAP_MS / 1000;
+    seek_samples_ = sample_rate * SEEK_MS / 1000;
+    Reset();
+}
+
+void TimeStretcher::Reset() {
+    active_ = false;
+    input_.clear();
+    overlap_.clear();
+    skip_fraction_ = 0;
+}
+
+void TimeStretcher::Process(std::vector<int16_t>& pcm, int speed_percent) {
+    if (sequence_samples_ == 0 || (!active_ && speed_percent == 100)) {
+        return;
+    }
+    speed_percent = std::clamp(speed_percent, 80, 120);
+
+    if (!active_) {
+        // Play this block as it is and stretch from the next one. Its last samples are
+        // the tail the first sequence fades from, and where the input continues.
+        if ((int)pcm.size() < overlap_samples_) {
+            return;
+        }
+        active_ = true;
+        skip_fraction_ = 0;
+        overlap_.assign(pcm.end() - overlap_samples_, pcm.end());
+        input_ = overlap_;
+        pcm.resize(pcm.size() - overlap_samples_);
+        return;
+    }
+    input_.insert(input_.end(), pcm.begin(), pcm.end());
+
+    std::vector<int16_t> output;
+    output.reserve(pcm.size() * 100 / speed_percent + sequence_samples_);
+    if (speed_percent == 100) {
+        // Splice back into the stream once, then pass through again
+        Splice(output);
+        Reset();
+        pcm = std::move(output);
+        return;
+    }
+
+    // Every sequence outputs sequence - overlap samples and advances the input by that
+    // times the speed
+    const uint32_t step_q16 = (uint64_t)(sequence_samples_ - overlap_samples_) * speed_percent * 65536 / 100;
+    size_t position = 0;
+    while (input_.size() - position >= (size_t)(sequence_samples_ + seek_samples_)) {
+        const int16_t* sequence = input_.data() + position;
+        int offset = Seek(sequence, seek_samples_);
+        sequence += offset;
+        CrossFade(sequence, output);
+        output.insert(output.end(), sequence + overlap_samples_, sequence + sequence_samples_ - overlap_samples_);
+        overlap_.assign(sequence + sequence_samples_ - overlap_samples_, sequence + sequence_samples_);
+
+        skip_fraction_ += step_q16;
+        position += skip_fraction_ >> 16;
+        skip_fraction_ &= 0xFFFF;
+    }
+    input_.erase(input_.begin(), input_.begin() + std::min(position, input_.size()));
+    pcm = std::move(output);
+}
+
+void TimeStretcher::Drain(std::vector<int16_t>& pcm) {
+    pcm.clear();
+    if (active_) {
+        Splice(pcm);
+    }
+    Reset();
+}
+
+// Fades the overlap tail into the best matching point of the held input and appends
+// the rest of it
+void TimeStretcher::Splice(std::vector<int16_t>& output) const {
+    int candidates = std::min<int>(seek_samples_, (int)input_.size() - overlap_samples_ + 1);
+    if (candidates > 0) {
+        int offset = Seek(input_.data(), candidates);
+        CrossFade(input_.data() + offset, output);
+        output.insert(output.end(), input_.begin() + offset + overlap_samples_, input_.end());
+    } else {
+        output.insert(output.end(), overlap_.begin(), overlap_.end());
+    }
+}
+
+// Finds the offset where the input continues the overlap tail best
+int TimeStretcher::Seek(const int16_t* input, int candidates) const {
+    int best_offset = 0;
+    float best_score = Score(input);
+    for (int offset = COARSE_SEEK_STEP; offset < candidates; offset += COARSE_SEEK_STEP) {
+        float score = Score(input + offset);
+        if (score > best_score) {
+            best_score = score;
+            best_offset = offset;
+        }
+    }
+    int first = std::max(0, best_offset - COARSE_SEEK_STEP + 1);
+    int last = std::min(candidates - 1, best_offset + COARSE_SEEK_STEP - 1);
+    int coarse_offset = best_offset;
+    for (int offset = first; offset <= last; offset++) {
+        if (offset == coarse_offset) {
+            continue;
+        }
+        float score = Score(input + offset);
+        if (score > best_score) {
+            best_score = score;
+            best_offset = offset;
+        }
+    }
+    return best_offset;
+}
+
+// Normalised cross-correlation with the overlap tail, keeping its sign. The sums are
+// integer with independent accumulators so the multiply-accumulates can pipeline.
+float TimeStretcher::Score(const int16_t* input) const {
+    const int16_t* tail = overlap_.data();
+    int64_t correlation0 = 0, correlation1 = 0, energy0 = 0, energy1 = 0;
+    int i = 0;
+    for (; i + 2 <= overlap_samples_; i += 2) {
+        correlation0 += tail[i] * input[i];
+        correlation1 += tail[i + 1] * input[i + 1];
+        energy0 += input[i] * input[i];
+        energy1 += input[i + 1] * input[i + 1];
+    }
+    if (i < overlap_samples_) {
+        correlation0 += tail[i] * input[i];
+        energy0 += input[i] * input[i];
+    }
+    float correlation = (float)(correlation0 + correlation1);
+    return correlation * std::fabs(correlation) / (float)(energy0 + energy1 + 1);
+}
+
+// Linear cross-fade from the overlap tail into the input, Q15 weights
+void TimeStretcher::CrossFade(const int16_t* input, std::vector<int16_t>& output) const {
+    const int16_t* tail = overlap_.data();
+    const int32_t step = 32768 / overlap_samples_;
+    int32_t weight = 0;
+    for (int i = 0; i < overlap_samples_; i++) {
+        output.push_back((int16_t)((tail[i] * (32768 - weight) + input[i] * weight) >> 15));
+        weight += step;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef TIME_STRETCHER_H
+#define TIME_STRETCHER_H
+
+#include <cstdint>
+#include <vector>
+
+// WSOLA time-scale modification for the speaker output. Plays mono 16-bit PCM slightly
+// faster or slower without changing its pitch: the input is cut into overlapping
+// sequences, each one is placed where it best matches the end of the previous one
+// (normalised cross-correlation over a short seek window) and the two are cross-faded.
+// At 100% it passes audio through untouched, and leaving a speed change splices back
+// into the stream once so nothing is lost or repeated. The block that starts a speed
+// change plays as it is, only its last overlap is held back to fade from.
+class TimeStretcher {
+public:
+    void Configure(int sample_rate);
+    void Reset();
+
+    // speed_percent is clamped to 80..120. The block may come back shorter or longer,
+    // and up to one sequence of audio is held back while stretching.
+    void Process(std::vector<int16_t>& pcm, int speed_percent);
+    // Returns the audio held back and goes back to passing through, for the end of a stream
+    void Drain(std::vector<int16_t>& pcm);
+    inline bool active() const { return active_; }
+
+private:
+    int sequence_samples_ = 0;
+    int overlap_samples_ = 0;
+    int seek_samples_ = 0;
+
+    bool active_ = false;
+    std::vector<int16_t> input_;
+    std::vector<int16_t> overlap_;  // Tail of the last sequence, faded into the next one
+    uint32_t skip_fraction_ = 0;    // Q16 remainder of the input advance
+
+    void Splice(std::vector<int16_t>& output) const;
+    int Seek(const int16_t* input, int candidates) const;
+    float Score(const int16_t* input) const;
+    void CrossFade(const int16_t* input, std::vector<int16_t>& output) const;
+};
+
+#endif // TIME_STRETCHER_H
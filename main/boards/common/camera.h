@@ -2,6 +2,11 @@
 #define CAMERA_H
 
 #include <string>
+#include <functional>
+#include <mutex>
+
+// 流式解释时收到的部分回答，参数是目前为止的完整文本
+using ExplainCallback = std::function<void(const std::string& text)>;
 
 class Camera {
 public:
@@ -9,7 +14,17 @@ public:
     virtual bool Capture() = 0;
     virtual bool SetHMirror(bool enabled) = 0;
     virtual bool SetVFlip(bool enabled) = 0;
-    virtual std::string Explain(const std::string& question) = 0;
+    // on_partial 不为空时请求流式响应，回答的每一段到达时都会回调
+    virtual std::string Explain(const std::string& question, ExplainCallback on_partial = nullptr) = 0;
+    // 连续取帧作为取景器预览，不支持时返回 false
+    virtual bool StartStreaming(int fps) { return false; }
+    virtual void StopStreaming() {}
+
+    // 在 Capture 和 Explain 之间持有，避免取景器在中途拿走照片
+    std::unique_lock<std::recursive_mutex> Lock() { return std::unique_lock<std::recursive_mutex>(mutex_); }
+
+protected:
+    std::recursive_mutex mutex_;
 };
 
 #endif // CAMERA_H
@@ -0,0 +1,190 @@
+#include "camera_preview.h"
+#include "display.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "CameraPreview"
+
+#define PREVIEW_IDLE_EVENT (1 << 0)
+
+// Swaps the bytes of the two RGB565 pixels in a word at once
+static inline uint32_t SwapPixelPair(uint32_t value) {
+    return ((value & 0x00FF00FF) << 8) | ((value >> 8) & 0x00FF00FF);
+}
+
+CameraPreview::CameraPreview() {
+    event_group_ = xEventGroupCreate();
+    xEventGroupSetBits(event_group_, PREVIEW_IDLE_EVENT);
+    // Keep the conversion off the core that runs the main loop and the network
+    xTaskCreatePinnedToCore([](void* arg) {
+        static_cast<CameraPreview*>(arg)->Run();
+    }, "camera_preview", 3072, this, 2, &task_, portNUM_PROCESSORS - 1);
+}
+
+CameraPreview::~CameraPreview() {
+    WaitIdle();
+    if (task_ != nullptr) {
+        vTaskDelete(task_);
+    }
+    vEventGroupDelete(event_group_);
+    for (auto& image : images_) {
+        heap_caps_free((void*)image.data);
+    }
+}
+
+void CameraPreview::SetRotation(int degrees) {
+    WaitIdle();
+    rotation_ = ((degrees / 90) % 4 + 4) % 4 * 90;
+}
+
+void CameraPreview::WaitIdle() {
+    xEventGroupWaitBits(event_group_, PREVIEW_IDLE_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
+}
+
+bool CameraPreview::IsIdle() {
+    return (xEventGroupGetBits(event_group_) & PREVIEW_IDLE_EVENT) != 0;
+}
+
+CameraPreviewStats CameraPreview::GetStats() {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+void CameraPreview::ResetStats() {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_ = CameraPreviewStats();
+}
+
+void CameraPreview::Submit(const uint8_t* frame, int width, int height, Display* display, int64_t captured_us) {
+    WaitIdle();
+    job_ = {frame, width, height, display, captured_us};
+    xEventGroupClearBits(event_group_, PREVIEW_IDLE_EVENT);
+    xTaskNotifyGive(task_);
+}
+
+void CameraPreview::Run() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t start_time = esp_timer_get_time();
+        auto image = Convert(job_.frame, job_.width, job_.height, job_.display->width(), job_.display->height());
+        if (image != nullptr) {
+            ESP_LOGD(TAG, "Converted %dx%d to %dx%d in %lld us", job_.width, job_.height,
+                (int)image->header.w, (int)image->header.h, esp_timer_get_time() - start_time);
+            job_.display->SetPreviewImage(image);
+            if (job_.captured_us > 0) {
+                uint32_t latency_ms = (esp_timer_get_time() - job_.captured_us) / 1000;
+                std::lock_guard<std::mutex> lock(stats_mutex_);
+                stats_.frames++;
+                stats_.total_latency_ms += latency_ms;
+                stats_.max_latency_ms = std::max(stats_.max_latency_ms, latency_ms);
+            }
+        }
+        xEventGroupSetBits(event_group_, PREVIEW_IDLE_EVENT);
+    }
+}
+
+const lv_img_dsc_t* CameraPreview::Convert(const uint8_t* frame, int width, int height, int max_width, int max_height) {
+    if (frame == nullptr || width < 2 || height < 1 || max_width < 2 || max_height < 1) {
+        return nullptr;
+    }
+
+    // Work in frame orientation, a quarter turn swaps the box
+    bool quarter_turn = rotation_ == 90 || rotation_ == 270;
+    int box_width = quarter_turn ? max_height : max_width;
+    int box_height = quarter_turn ? max_width : max_height;
+
+    // Center crop to the aspect ratio of the box, then shrink to fit. Never upscale,
+    // the display can zoom the image if it wants to.
+    int crop_width = width, crop_height = height;
+    if ((int64_t)crop_width * box_height > (int64_t)crop_height * box_width) {
+        crop_width = std::max(1, crop_height * box_width / box_height);
+    } else {
+        crop_height = std::max(1, crop_width * box_height / box_width);
+    }
+    int crop_x = (width - crop_width) / 2;
+    int crop_y = (height - crop_height) / 2;
+    int scaled_width = std::min(crop_width, box_width);
+    int scaled_height = std::min(crop_height, box_height);
+
+    // Pixels are written in pairs, keep the output width even
+    int out_width = quarter_turn ? scaled_height : scaled_width;
+    int out_height = quarter_turn ? scaled_width : scaled_height;
+    out_width &= ~1;
+    if (out_width == 0) {
+        return nullptr;
+    }
+    if (quarter_turn) {
+        scaled_height = out_width;
+    } else {
+        scaled_width = out_width;
+    }
+
+    auto source_x = [&](int x) { return crop_x + (int)((int64_t)x * crop_width / scaled_width); };
+    auto source_y = [&](int y) { return crop_y + (int)((int64_t)y * crop_height / scaled_height); };
+
+    int layout_key[5] = {width, height, max_width, max_height, rotation_};
+    if (memcmp(layout_key, layout_key_, sizeof(layout_key)) != 0) {
+        memcpy(layout_key_, layout_key, sizeof(layout_key));
+        column_offsets_.resize(out_width);
+        for (int x = 0; x < out_width; x++) {
+            switch (rotation_) {
+                case 0: column_offsets_[x] = source_x(x); break;
+                case 90: column_offsets_[x] = source_y(scaled_height - 1 - x) * width; break;
+                case 180: column_offsets_[x] = source_x(scaled_width - 1 - x); break;
+                default: column_offsets_[x] = source_y(x) * width; break;
+            }
+        }
+    }
+
+    auto& image = images_[next_image_];
+    size_t data_size = out_width * out_height * 2;
+    if (image.data == nullptr || image.data_size != data_size) {
+        heap_caps_free((void*)image.data);
+        memset(&image, 0, sizeof(image));
+        image.data = (uint8_t*)heap_caps_malloc(data_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (image.data == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %dx%d preview", out_width, out_height);
+            return nullptr;
+        }
+        image.header.magic = LV_IMAGE_HEADER_MAGIC;
+        image.header.cf = LV_COLOR_FORMAT_RGB565;
+        image.header.flags = LV_IMAGE_FLAGS_ALLOCATED | LV_IMAGE_FLAGS_MODIFIABLE;
+        image.header.w = out_width;
+        image.header.h = out_height;
+        image.header.stride = out_width * 2;
+        image.data_size = data_size;
+    }
+    next_image_ ^= 1;
+
+    auto src = (const uint16_t*)frame;
+    auto out = (uint32_t*)image.data;
+    // Same size, no rotation and word aligned rows: swap whole words straight through
+    bool straight = rotation_ == 0 && scaled_width == crop_width && scaled_height == crop_height
+        && (crop_x % 2) == 0 && (width % 2) == 0;
+    for (int y = 0; y < out_height; y++) {
+        int32_t row_offset;
+        switch (rotation_) {
+            case 0: row_offset = source_y(y) * width; break;
+            case 90: row_offset = source_x(y); break;
+            case 180: row_offset = source_y(scaled_height - 1 - y) * width; break;
+            default: row_offset = source_x(scaled_width - 1 - y); break;
+        }
+        const uint16_t* row = src + row_offset;
+        if (straight) {
+            auto words = (const uint32_t*)(row + crop_x);
+            for (int x = 0; x < out_width / 2; x++) {
+                *out++ = SwapPixelPair(words[x]);
+            }
+            continue;
+        }
+        const int32_t* offsets = column_offsets_.data();
+        for (int x = 0; x < out_width; x += 2) {
+            *out++ = SwapPixelPair(row[offsets[x]] | ((uint32_t)row[offsets[x + 1]] << 16));
+        }
+    }
+    return &image;
+}
@@ -0,0 +1,68 @@
+#ifndef CAMERA_PREVIEW_H
+#define CAMERA_PREVIEW_H
+
+#include <lvgl.h>
+#include <vector>
+#include <mutex>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+class Display;
+
+struct CameraPreviewStats {
+    uint32_t frames = 0;
+    uint32_t max_latency_ms = 0;    // From frame capture to the preview being shown
+    uint64_t total_latency_ms = 0;
+};
+
+// Turns big endian RGB565 camera frames into preview images for the display. Byte swap,
+// center crop to the display aspect ratio, downscale and rotation happen in one pass over
+// the output pixels, so frames of any size can be previewed and only the pixels that get
+// shown are read. Conversion runs on its own task on the last core.
+class CameraPreview {
+public:
+    CameraPreview();
+    ~CameraPreview();
+
+    // Clockwise, 0, 90, 180 or 270
+    void SetRotation(int degrees);
+    // Converts the frame on the preview task and shows it on the display. The frame must
+    // stay valid until WaitIdle returns. Pass the capture time to count the latency.
+    void Submit(const uint8_t* frame, int width, int height, Display* display, int64_t captured_us = 0);
+    void WaitIdle();
+    bool IsIdle();
+    CameraPreviewStats GetStats();
+    void ResetStats();
+
+    // Converts on the calling task, the result is valid until the next call after the next one
+    const lv_img_dsc_t* Convert(const uint8_t* frame, int width, int height, int max_width, int max_height);
+
+private:
+    struct Job {
+        const uint8_t* frame;
+        int width;
+        int height;
+        Display* display;
+        int64_t captured_us;
+    };
+
+    TaskHandle_t task_ = nullptr;
+    EventGroupHandle_t event_group_ = nullptr;
+    Job job_ = {};
+    int rotation_ = 0;
+    std::mutex stats_mutex_;
+    CameraPreviewStats stats_;
+
+    // Two images so the one being shown is never written to
+    lv_img_dsc_t images_[2] = {};
+    int next_image_ = 0;
+    // Source pixel offset of every output column, rebuilt when the geometry changes
+    std::vector<int32_t> column_offsets_;
+    int layout_key_[5] = {};
+
+    void Run();
+};
+
+#endif // CAMERA_PREVIEW_H
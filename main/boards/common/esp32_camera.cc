@@ -3,15 +3,94 @@
 #include "display.h"
 #include "board.h"
 #include "system_info.h"
+#include "explain_response.h"
 
 #include <esp_log.h>
 #include <esp_heap_caps.h>
 #include <img_converters.h>
+#include <esp_timer.h>
 #include <cstring>
+#include <algorithm>
+#include <vector>
 
 #define TAG "Esp32Camera"
 
+#define STREAM_STOPPED_EVENT (1 << 0)
+#define MAX_STREAM_FPS 30
+
+// The photo is sized so its upload takes about this long on the measured uplink
+#define EXPLAIN_UPLOAD_TARGET_MS 2000
+#define EXPLAIN_DEFAULT_UPLINK_BYTES_PER_SECOND (32 * 1024)
+#define EXPLAIN_MIN_JPEG_BYTES (8 * 1024)
+#define EXPLAIN_MAX_JPEG_BYTES (160 * 1024)
+// Uploads shorter than this say little about the uplink
+#define EXPLAIN_MIN_MEASURED_BYTES (4 * 1024)
+#define EXPLAIN_MIN_WIDTH 160
+#define JPEG_RING_SIZE (16 * 1024)
+#define DEFAULT_JPEG_BYTES_PER_PIXEL 0.2f
+
+// JPEG size relative to quality 80, roughly the same for most camera scenes
+struct JpegQualityLevel {
+    int quality;
+    float relative_size;
+};
+static const JpegQualityLevel kJpegQualityLevels[] = {
+    {80, 1.0f},
+    {65, 0.72f},
+    {50, 0.58f},
+    {35, 0.45f},
+};
+
+static float RelativeJpegSize(int quality) {
+    for (auto& level : kJpegQualityLevels) {
+        if (level.quality == quality) {
+            return level.relative_size;
+        }
+    }
+    return 1.0f;
+}
+
+// Averages every scale x scale block of a big endian RGB565 frame into a new frame
+static uint8_t* DownscaleFrame(const camera_fb_t* src, int scale, camera_fb_t& dst) {
+    int width = src->width / scale;
+    int height = src->height / scale;
+    auto pixels = (uint16_t*)heap_caps_malloc(width * height * 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (pixels == nullptr) {
+        return nullptr;
+    }
+    auto in = (const uint16_t*)src->buf;
+    int count = scale * scale;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint32_t r = 0, g = 0, b = 0;
+            for (int dy = 0; dy < scale; dy++) {
+                const uint16_t* row = in + (y * scale + dy) * src->width + x * scale;
+                for (int dx = 0; dx < scale; dx++) {
+                    uint16_t pixel = __builtin_bswap16(row[dx]);
+                    r += pixel >> 11;
+                    g += (pixel >> 5) & 0x3F;
+                    b += pixel & 0x1F;
+                }
+            }
+            uint16_t pixel = ((r / count) << 11) | ((g / count) << 5) | (b / count);
+            pixels[y * width + x] = __builtin_bswap16(pixel);
+        }
+    }
+    dst = *src;
+    dst.buf = (uint8_t*)pixels;
+    dst.len = width * height * 2;
+    dst.width = width;
+    dst.height = height;
+    return dst.buf;
+}
+
 Esp32Camera::Esp32Camera(const camera_config_t& config) {
+    jpeg_bytes_per_pixel_ = DEFAULT_JPEG_BYTES_PER_PIXEL;
+    stream_event_group_ = xEventGroupCreate();
+    xEventGroupSetBits(stream_event_group_, STREAM_STOPPED_EVENT);
+    // 驱动只有一个帧缓冲时，取下一帧前必须先归还上一帧
+    max_frames_in_flight_ = std::clamp((int)config.fb_count, 1, 2);
+
     // camera init
     esp_err_t err = esp_camera_init(&config); // 配置上面定义的参数
     if (err != ESP_OK) {
@@ -23,59 +102,19 @@ Esp32Camera::Esp32Camera(const camera_config_t& config) {
     if (s->id.PID == GC0308_PID) {
         s->set_hmirror(s, 0);  // 这里控制摄像头镜像 写1镜像 写0不镜像
     }
-
-    // 初始化预览图片的内存
-    memset(&preview_image_, 0, sizeof(preview_image_));
-    preview_image_.header.magic = LV_IMAGE_HEADER_MAGIC;
-    preview_image_.header.cf = LV_COLOR_FORMAT_RGB565;
-    preview_image_.header.flags = LV_IMAGE_FLAGS_ALLOCATED | LV_IMAGE_FLAGS_MODIFIABLE;
-
-    switch (config.frame_size) {
-        case FRAMESIZE_SVGA:
-            preview_image_.header.w = 800;
-            preview_image_.header.h = 600;
-            break;
-        case FRAMESIZE_VGA:
-            preview_image_.header.w = 640;
-            preview_image_.header.h = 480;
-            break;
-        case FRAMESIZE_QVGA:
-            preview_image_.header.w = 320;
-            preview_image_.header.h = 240;
-            break;
-        case FRAMESIZE_128X128:
-            preview_image_.header.w = 128;
-            preview_image_.header.h = 128;
-            break;
-        case FRAMESIZE_240X240:
-            preview_image_.header.w = 240;
-            preview_image_.header.h = 240;
-            break;
-        default:
-            ESP_LOGE(TAG, "Unsupported frame size: %d, image preview will not be shown", config.frame_size);
-            preview_image_.data_size = 0;
-            preview_image_.data = nullptr;
-            return;
-    }
-
-    preview_image_.header.stride = preview_image_.header.w * 2;
-    preview_image_.data_size = preview_image_.header.w * preview_image_.header.h * 2;
-    preview_image_.data = (uint8_t*)heap_caps_malloc(preview_image_.data_size, MALLOC_CAP_SPIRAM);
-    if (preview_image_.data == nullptr) {
-        ESP_LOGE(TAG, "Failed to allocate memory for preview image");
-        return;
-    }
 }
 
 Esp32Camera::~Esp32Camera() {
+    StopStreaming();
+    vEventGroupDelete(stream_event_group_);
+    if (jpeg_ring_ != nullptr) {
+        vRingbufferDeleteWithCaps(jpeg_ring_);
+    }
+    preview_.WaitIdle();
     if (fb_) {
         esp_camera_fb_return(fb_);
         fb_ = nullptr;
     }
-    if (preview_image_.data) {
-        heap_caps_free((void*)preview_image_.data);
-        preview_image_.data = nullptr;
-    }
     esp_camera_deinit();
 }
 
@@ -85,9 +124,13 @@ void Esp32Camera::SetExplainUrl(const std::string& url, const std::string& token
 }
 
 bool Esp32Camera::Capture() {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    StopStreaming();
     if (encoder_thread_.joinable()) {
         encoder_thread_.join();
     }
+    // The previous frame may still be converting for the preview
+    preview_.WaitIdle();
 
     int frames_to_get = 2;
     // Try to get a stable frame
@@ -102,30 +145,156 @@ bool Esp32Camera::Capture() {
         }
     }
 
-    // 如果预览图片 buffer 为空，则跳过预览
-    // 但仍返回 true，因为此时图像可以上传至服务器
-    if (preview_image_.data_size == 0) {
-        ESP_LOGW(TAG, "Skip preview because of unsupported frame size");
+    // 只有 RGB565 帧可以预览，但仍返回 true，因为此时图像可以上传至服务器
+    if (fb_->format != PIXFORMAT_RGB565) {
+        ESP_LOGW(TAG, "Skip preview because of pixel format %d", fb_->format);
         return true;
     }
-    if (preview_image_.data == nullptr) {
-        ESP_LOGE(TAG, "Preview image data is not initialized");
+    // 在预览任务中转换并显示预览图片
+    auto display = Board::GetInstance().GetDisplay();
+    if (display != nullptr) {
+        preview_.Submit(fb_->buf, fb_->width, fb_->height, display);
+    }
+    return true;
+}
+
+void Esp32Camera::SetPreviewRotation(int degrees) {
+    preview_.SetRotation(degrees);
+}
+
+bool Esp32Camera::StartStreaming(int fps) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    fps = std::clamp(fps, 1, MAX_STREAM_FPS);
+    frame_interval_ms_ = 1000 / fps;
+    if (streaming_) {
         return true;
     }
-    // 显示预览图片
+
+    // The stream owns the driver's frame buffers, give back the last captured photo
+    if (encoder_thread_.joinable()) {
+        encoder_thread_.join();
+    }
+    preview_.WaitIdle();
+    if (fb_ != nullptr) {
+        esp_camera_fb_return(fb_);
+        fb_ = nullptr;
+    }
+
+    stream_frames_ = 0;
+    stream_dropped_ = 0;
+    preview_.ResetStats();
+    streaming_ = true;
+    xEventGroupClearBits(stream_event_group_, STREAM_STOPPED_EVENT);
+    BaseType_t ret = xTaskCreate([](void* arg) {
+        auto camera = (Esp32Camera*)arg;
+        camera->StreamLoop();
+        xEventGroupSetBits(camera->stream_event_group_, STREAM_STOPPED_EVENT);
+        vTaskDelete(NULL);
+    }, "camera_stream", 4096, this, 2, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the camera stream task");
+        streaming_ = false;
+        xEventGroupSetBits(stream_event_group_, STREAM_STOPPED_EVENT);
+        return false;
+    }
+    ESP_LOGI(TAG, "Streaming started at %d fps, %d frames in flight", fps, max_frames_in_flight_);
+    return true;
+}
+
+void Esp32Camera::StopStreaming() {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    if (!streaming_) {
+        return;
+    }
+    streaming_ = false;
+    xEventGroupWaitBits(stream_event_group_, STREAM_STOPPED_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
+
+    auto stats = GetStreamStats();
+    ESP_LOGI(TAG, "Streaming stopped: frames=%lu dropped=%lu previewed=%lu latency avg=%lums max=%lums",
+        stats.frames, stats.dropped, stats.previewed, stats.avg_latency_ms, stats.max_latency_ms);
+}
+
+int Esp32Camera::AddFrameListener(CameraFrameListener listener) {
+    std::lock_guard<std::mutex> lock(listeners_mutex_);
+    int id = next_listener_id_++;
+    listeners_[id] = std::move(listener);
+    return id;
+}
+
+void Esp32Camera::RemoveFrameListener(int id) {
+    std::lock_guard<std::mutex> lock(listeners_mutex_);
+    listeners_.erase(id);
+}
+
+CameraStreamStats Esp32Camera::GetStreamStats() {
+    auto preview_stats = preview_.GetStats();
+    CameraStreamStats stats;
+    stats.frames = stream_frames_;
+    stats.dropped = stream_dropped_;
+    stats.previewed = preview_stats.frames;
+    if (preview_stats.frames > 0) {
+        stats.avg_latency_ms = preview_stats.total_latency_ms / preview_stats.frames;
+    }
+    stats.max_latency_ms = preview_stats.max_latency_ms;
+    return stats;
+}
+
+void Esp32Camera::StreamLoop() {
     auto display = Board::GetInstance().GetDisplay();
-    if (display != nullptr) {
-        auto src = (uint16_t*)fb_->buf;
-        auto dst = (uint16_t*)preview_image_.data;
-        size_t pixel_count = fb_->len / 2;
-        for (size_t i = 0; i < pixel_count; i++) {
-            // 交换每个16位字内的字节
-            dst[i] = __builtin_bswap16(src[i]);
+    // The frame the preview task is reading, kept until the next one is handed over
+    camera_fb_t* previewing = nullptr;
+    std::vector<CameraFrameListener> listeners;
+    TickType_t last_wake_time = xTaskGetTickCount();
+
+    while (streaming_) {
+        vTaskDelayUntil(&last_wake_time, std::max<TickType_t>(1, pdMS_TO_TICKS(frame_interval_ms_)));
+        if (previewing != nullptr && max_frames_in_flight_ < 2) {
+            preview_.WaitIdle();
+            esp_camera_fb_return(previewing);
+            previewing = nullptr;
+        }
+
+        camera_fb_t* frame = esp_camera_fb_get();
+        if (frame == nullptr) {
+            ESP_LOGE(TAG, "Camera capture failed");
+            continue;
+        }
+        stream_frames_++;
+        // Call a copy so a listener can remove itself
+        {
+            std::lock_guard<std::mutex> lock(listeners_mutex_);
+            listeners.clear();
+            for (auto& [id, listener] : listeners_) {
+                listeners.push_back(listener);
+            }
+        }
+        for (auto& listener : listeners) {
+            listener(frame);
         }
-        display->SetPreviewImage(&preview_image_);
+
+        if (display != nullptr && frame->format == PIXFORMAT_RGB565) {
+            // Never queue behind a slow preview, skip the frame instead so the latency stays low
+            if (preview_.IsIdle()) {
+                if (previewing != nullptr) {
+                    esp_camera_fb_return(previewing);
+                }
+                previewing = frame;
+                // The driver stamps frames with esp_timer time
+                int64_t captured_us = (int64_t)frame->timestamp.tv_sec * 1000000 + frame->timestamp.tv_usec;
+                preview_.Submit(frame->buf, frame->width, frame->height, display, captured_us);
+                continue;
+            }
+            stream_dropped_++;
+        }
+        esp_camera_fb_return(frame);
+    }
+
+    preview_.WaitIdle();
+    if (previewing != nullptr) {
+        esp_camera_fb_return(previewing);
     }
-    return true;
 }
+
 bool Esp32Camera::SetHMirror(bool enabled) {
     sensor_t *s = esp_camera_sensor_get();
     if (s == nullptr) {
@@ -160,6 +329,28 @@ bool Esp32Camera::SetVFlip(bool enabled) {
     return true;
 }
 
+void Esp32Camera::ChooseJpegSettings(int& quality, int& scale) {
+    uint32_t uplink = uplink_bytes_per_second_ > 0 ? uplink_bytes_per_second_ : EXPLAIN_DEFAULT_UPLINK_BYTES_PER_SECOND;
+    size_t budget = std::clamp<size_t>((size_t)uplink * EXPLAIN_UPLOAD_TARGET_MS / 1000,
+        EXPLAIN_MIN_JPEG_BYTES, EXPLAIN_MAX_JPEG_BYTES);
+    bool can_scale = fb_->format == PIXFORMAT_RGB565;
+
+    // Highest quality first, halve the resolution only when even the lowest quality is too big
+    for (scale = 1; ; scale *= 2) {
+        bool last = !can_scale || fb_->width / (scale * 2) < EXPLAIN_MIN_WIDTH;
+        size_t pixels = (fb_->width / scale) * (fb_->height / scale);
+        for (auto& level : kJpegQualityLevels) {
+            quality = level.quality;
+            if (pixels * jpeg_bytes_per_pixel_ * level.relative_size <= budget) {
+                return;
+            }
+        }
+        if (last) {
+            return;
+        }
+    }
+}
+
 /**
  * @brief 将摄像头捕获的图像发送到远程服务器进行AI分析和解释
  * 
@@ -170,10 +361,12 @@ bool Esp32Camera::SetVFlip(bool enabled) {
  * 实现特点：
  * - 使用独立线程编码JPEG，与主线程分离
  * - 采用分块传输编码(chunked transfer encoding)优化内存使用
- * - 通过队列机制实现编码线程和发送线程的数据同步
+ * - 编码线程写入复用的环形缓冲区，发送线程直接从中写出，每块数据无需分配内存
+ * - 根据测得的上行速率选择JPEG质量和缩放，控制上传时间
  * - 支持设备ID、客户端ID和认证令牌的HTTP头部配置
  * 
  * @param question 要向AI提出的关于图像的问题，将作为表单字段发送
+ * @param on_partial 不为空时请求 text/event-stream 响应，每收到一段回答就回调一次
  * @return std::string 服务器返回的JSON格式响应字符串
  *         成功时包含AI分析结果，失败时包含错误信息
  *         格式示例：{"success": true, "result": "分析结果"}
@@ -183,32 +376,73 @@ bool Esp32Camera::SetVFlip(bool enabled) {
  * @note 函数会等待之前的编码线程完成后再开始新的处理
  * @warning 如果摄像头缓冲区为空或网络连接失败，将返回错误信息
  */
-std::string Esp32Camera::Explain(const std::string& question) {
+std::string Esp32Camera::Explain(const std::string& question, ExplainCallback on_partial) {
+    // The encoder reads fb_, keep streaming from returning it until the upload is done
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
     if (explain_url_.empty()) {
         return "{\"success\": false, \"message\": \"Image explain URL or token is not set\"}";
     }
 
-    // 创建局部的 JPEG 队列, 40 entries is about to store 512 * 40 = 20480 bytes of JPEG data
-    QueueHandle_t jpeg_queue = xQueueCreate(40, sizeof(JpegChunk));
-    if (jpeg_queue == nullptr) {
-        ESP_LOGE(TAG, "Failed to create JPEG queue");
-        return "{\"success\": false, \"message\": \"Failed to create JPEG queue\"}";
+    if (fb_ == nullptr) {
+        return "{\"success\": false, \"message\": \"No photo is captured\"}";
+    }
+    if (jpeg_ring_ == nullptr) {
+        // Keep the ring out of internal RAM
+        jpeg_ring_ = xRingbufferCreateWithCaps(JPEG_RING_SIZE, RINGBUF_TYPE_BYTEBUF, MALLOC_CAP_SPIRAM);
+        if (jpeg_ring_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to create JPEG ring buffer");
+            return "{\"success\": false, \"message\": \"Failed to create JPEG buffer\"}";
+        }
+    }
+
+    // 按上行速率选择质量和分辨率
+    int quality, scale;
+    ChooseJpegSettings(quality, scale);
+    const camera_fb_t* frame = fb_;
+    camera_fb_t scaled_frame;
+    uint8_t* scaled_pixels = nullptr;
+    if (scale > 1) {
+        scaled_pixels = DownscaleFrame(fb_, scale, scaled_frame);
+        if (scaled_pixels != nullptr) {
+            frame = &scaled_frame;
+        } else {
+            ESP_LOGW(TAG, "Failed to downscale the photo, sending it at full size");
+            scale = 1;
+        }
     }
 
     // We spawn a thread to encode the image to JPEG
-    encoder_thread_ = std::thread([this, jpeg_queue]() {
-        frame2jpg_cb(fb_, 80, [](void* arg, size_t index, const void* data, size_t len) -> unsigned int {
-            auto jpeg_queue = (QueueHandle_t)arg;
-            JpegChunk chunk = {
-                .data = (uint8_t*)heap_caps_aligned_alloc(16, len, MALLOC_CAP_SPIRAM),
-                .len = len
-            };
-            memcpy(chunk.data, data, len);
-            xQueueSend(jpeg_queue, &chunk, portMAX_DELAY);
+    jpeg_done_ = false;
+    encoder_thread_ = std::thread([this, frame, quality]() {
+        frame2jpg_cb((camera_fb_t*)frame, quality, [](void* arg, size_t index, const void* data, size_t len) -> unsigned int {
+            auto ring = (RingbufHandle_t)arg;
+            auto bytes = (const uint8_t*)data;
+            for (size_t sent = 0; sent < len; ) {
+                size_t size = std::min<size_t>(len - sent, JPEG_RING_SIZE / 2);
+                xRingbufferSend(ring, bytes + sent, size, portMAX_DELAY);
+                sent += size;
+            }
             return len;
-        }, jpeg_queue);
+        }, jpeg_ring_);
+        jpeg_done_ = true;
     });
 
+    // Passes the encoded bytes to write straight out of the ring until the encoder is done
+    auto read_jpeg = [this](auto&& write) {
+        while (true) {
+            bool done = jpeg_done_;
+            size_t size = 0;
+            auto data = (const char*)xRingbufferReceiveUpTo(jpeg_ring_, &size, pdMS_TO_TICKS(10), JPEG_RING_SIZE);
+            if (data != nullptr) {
+                write(data, size);
+                vRingbufferReturnItem(jpeg_ring_, (void*)data);
+            } else if (done) {
+                break;
+            }
+        }
+        encoder_thread_.join();
+    };
+
     auto http = Board::GetInstance().CreateHttp();
     // 构造multipart/form-data请求体
     std::string boundary = "----ESP32_CAMERA_BOUNDARY";
@@ -239,19 +473,14 @@ std::string Esp32Camera::Explain(const std::string& question) {
     }
     http->SetHeader("Content-Type", "multipart/form-data; boundary=" + boundary);
     http->SetHeader("Transfer-Encoding", "chunked");
+    if (on_partial) {
+        http->SetHeader("Accept", "text/event-stream");
+    }
     if (!http->Open("POST", explain_url_)) {
         ESP_LOGE(TAG, "Failed to connect to explain URL");
-        // Clear the queue
-        encoder_thread_.join();
-        JpegChunk chunk;
-        while (xQueueReceive(jpeg_queue, &chunk, portMAX_DELAY) == pdPASS) {
-            if (chunk.data != nullptr) {
-                heap_caps_free(chunk.data);
-            } else {
-                break;
-            }
-        }
-        vQueueDelete(jpeg_queue);
+        // Let the encoder finish
+        read_jpeg([](const char* data, size_t size) {});
+        heap_caps_free(scaled_pixels);
         return "{\"success\": false, \"message\": \"Failed to connect to explain URL\"}";
     }
     
@@ -263,23 +492,23 @@ std::string Esp32Camera::Explain(const std::string& question) {
     
     // 第三块：JPEG数据
     size_t total_sent = 0;
-    while (true) {
-        JpegChunk chunk;
-        if (xQueueReceive(jpeg_queue, &chunk, portMAX_DELAY) != pdPASS) {
-            ESP_LOGE(TAG, "Failed to receive JPEG chunk");
-            break;
-        }
-        if (chunk.data == nullptr) {
-            break; // The last chunk
-        }
-        http->Write((const char*)chunk.data, chunk.len);
-        total_sent += chunk.len;
-        heap_caps_free(chunk.data);
+    int64_t upload_start = esp_timer_get_time();
+    read_jpeg([&http, &total_sent](const char* data, size_t size) {
+        http->Write(data, size);
+        total_sent += size;
+    });
+    int64_t upload_us = esp_timer_get_time() - upload_start;
+
+    // 用本次的结果更新上行速率和 JPEG 大小的估计
+    if (total_sent >= EXPLAIN_MIN_MEASURED_BYTES && upload_us > 0) {
+        uint32_t measured = total_sent * 1000000LL / upload_us;
+        uplink_bytes_per_second_ = uplink_bytes_per_second_ == 0 ? measured : (uplink_bytes_per_second_ * 3 + measured) / 4;
+    }
+    if (total_sent > 0) {
+        jpeg_bytes_per_pixel_ = (float)total_sent / (frame->width * frame->height) / RelativeJpegSize(quality);
     }
-    // Wait for the encoder thread to finish
-    encoder_thread_.join();
-    // 清理队列
-    vQueueDelete(jpeg_queue);
+    int sent_width = frame->width, sent_height = frame->height;
+    heap_caps_free(scaled_pixels);
 
     // 第四块：multipart尾部
     http->Write(multipart_footer.c_str(), multipart_footer.size());
@@ -292,12 +521,13 @@ std::string Esp32Camera::Explain(const std::string& question) {
         return "{\"success\": false, \"message\": \"Failed to upload photo\"}";
     }
 
-    std::string result = http->ReadAll();
+    std::string result = ReadExplainResponse(http, on_partial);
     http->Close();
 
     // Get remain task stack size
     size_t remain_stack_size = uxTaskGetStackHighWaterMark(nullptr);
-    ESP_LOGI(TAG, "Explain image size=%dx%d, compressed size=%d, remain stack size=%d, question=%s\n%s",
-        fb_->width, fb_->height, total_sent, remain_stack_size, question.c_str(), result.c_str());
+    ESP_LOGI(TAG, "Explain image size=%dx%d, quality=%d, compressed size=%d, upload=%lldms, uplink=%luB/s, remain stack size=%d, question=%s\n%s",
+        sent_width, sent_height, quality, total_sent, upload_us / 1000, uplink_bytes_per_second_,
+        remain_stack_size, question.c_str(), result.c_str());
     return result;
 }
@@ -5,35 +5,77 @@
 #include <lvgl.h>
 #include <thread>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <map>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
+#include <freertos/event_groups.h>
+#include <freertos/ringbuf.h>
 
 #include "camera.h"
+#include "camera_preview.h"
 
-struct JpegChunk {
-    uint8_t* data;
-    size_t len;
+// Called on the streaming task, the frame is only valid during the call
+typedef std::function<void(const camera_fb_t* frame)> CameraFrameListener;
+
+struct CameraStreamStats {
+    uint32_t frames = 0;            // Frames taken from the driver
+    uint32_t dropped = 0;           // Frames not previewed because the preview was still busy
+    uint32_t previewed = 0;
+    uint32_t avg_latency_ms = 0;    // From frame capture to the preview being shown
+    uint32_t max_latency_ms = 0;
 };
 
 class Esp32Camera : public Camera {
 private:
     camera_fb_t* fb_ = nullptr;
-    lv_img_dsc_t preview_image_;
+    CameraPreview preview_;
     std::string explain_url_;
     std::string explain_token_;
     std::thread encoder_thread_;
 
+    // Explain 上传：编码器写入环形缓冲，上传直接从中读取
+    RingbufHandle_t jpeg_ring_ = nullptr;
+    std::atomic<bool> jpeg_done_{false};
+    uint32_t uplink_bytes_per_second_ = 0;  // 根据之前的上传测得，0 表示还没有测过
+    float jpeg_bytes_per_pixel_;            // 质量 80 时每像素的 JPEG 字节数，同样根据之前的编码更新
+
+    // 连续取帧
+    int max_frames_in_flight_ = 1;
+    std::atomic<bool> streaming_{false};
+    std::atomic<int> frame_interval_ms_{200};
+    EventGroupHandle_t stream_event_group_ = nullptr;
+    std::mutex listeners_mutex_;
+    std::map<int, CameraFrameListener> listeners_;
+    int next_listener_id_ = 1;
+    uint32_t stream_frames_ = 0;
+    uint32_t stream_dropped_ = 0;
+
+    void StreamLoop();
+    void ChooseJpegSettings(int& quality, int& scale);
+
 public:
     Esp32Camera(const camera_config_t& config);
     ~Esp32Camera();
 
     virtual void SetExplainUrl(const std::string& url, const std::string& token);
     virtual bool Capture();
+    // 预览图片顺时针旋转角度，0、90、180 或 270
+    void SetPreviewRotation(int degrees);
     // 翻转控制函数
     virtual bool SetHMirror(bool enabled) override;
     virtual bool SetVFlip(bool enabled) override;
-    virtual std::string Explain(const std::string& question);
+    virtual std::string Explain(const std::string& question, ExplainCallback on_partial = nullptr) override;
+
+    // 以指定帧率连续取帧并预览，Capture 会先停止取帧
+    virtual bool StartStreaming(int fps) override;
+    virtual void StopStreaming() override;
+    int AddFrameListener(CameraFrameListener listener);
+    void RemoveFrameListener(int id);
+    CameraStreamStats GetStreamStats();
 };
 
 #endif // ESP32_CAMERA_H
\ No newline at end of file
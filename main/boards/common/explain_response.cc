@@ -0,0 +1,188 @@
+#include "explain_response.h"
+
+#include <esp_log.h>
+#include <cJSON.h>
+#include <cstring>
+
+#define TAG "ExplainResponse"
+
+// 判断 SSE 所需的最少字节数
+#define SSE_SNIFF_BYTES 6
+
+static bool LooksLikeEventStream(const std::string& head) {
+    size_t start = head.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) {
+        return false;
+    }
+    const char* p = head.c_str() + start;
+    return strncmp(p, "data:", 5) == 0 || strncmp(p, "event:", 6) == 0
+        || strncmp(p, "id:", 3) == 0 || *p == ':';
+}
+
+namespace {
+
+class EventStreamParser {
+public:
+    EventStreamParser(const ExplainCallback& on_partial) : on_partial_(on_partial) {}
+
+    // 返回 false 表示流已结束
+    bool Feed(const char* data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            if (data[i] != '\n') {
+                line_ += data[i];
+                continue;
+            }
+            if (!line_.empty() && line_.back() == '\r') {
+                line_.pop_back();
+            }
+            bool more = HandleLine();
+            line_.clear();
+            if (!more) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Finish() {
+        if (!line_.empty()) {
+            HandleLine();
+            line_.clear();
+        }
+        if (!event_data_.empty()) {
+            Dispatch();
+        }
+    }
+
+    std::string TakeResult() {
+        if (!error_.empty()) {
+            return error_;
+        }
+        auto root = cJSON_CreateObject();
+        cJSON_AddBoolToObject(root, "success", true);
+        cJSON_AddStringToObject(root, "result", answer_.c_str());
+        auto json = cJSON_PrintUnformatted(root);
+        std::string result(json);
+        cJSON_free(json);
+        cJSON_Delete(root);
+        return result;
+    }
+
+    const std::string& answer() const { return answer_; }
+
+private:
+    const ExplainCallback& on_partial_;
+    std::string line_;
+    std::string event_data_;
+    bool has_data_ = false;
+    std::string answer_;
+    std::string error_;
+
+    bool HandleLine() {
+        // 空行结束一个事件
+        if (line_.empty()) {
+            return Dispatch();
+        }
+        if (line_.compare(0, 5, "data:") != 0) {
+            // 注释、event、id 和 retry 字段都不需要
+            return true;
+        }
+        size_t start = line_.size() > 5 && line_[5] == ' ' ? 6 : 5;
+        if (has_data_) {
+            event_data_ += '\n';
+        }
+        event_data_.append(line_, start, std::string::npos);
+        has_data_ = true;
+        return true;
+    }
+
+    bool Dispatch() {
+        if (!has_data_) {
+            return true;
+        }
+        std::string data;
+        data.swap(event_data_);
+        has_data_ = false;
+        if (data == "[DONE]") {
+            return false;
+        }
+
+        auto root = cJSON_Parse(data.c_str());
+        if (root == nullptr || !cJSON_IsObject(root)) {
+            // 纯文本片段
+            cJSON_Delete(root);
+            answer_ += data;
+        } else {
+            auto success = cJSON_GetObjectItem(root, "success");
+            auto text = cJSON_GetObjectItem(root, "text");
+            if (cJSON_IsFalse(success)) {
+                // 服务端报错，把错误原样交给调用者
+                error_ = data;
+                cJSON_Delete(root);
+                return false;
+            }
+            if (cJSON_IsString(text)) {
+                answer_ += text->valuestring;
+            }
+            cJSON_Delete(root);
+        }
+        if (on_partial_ && !answer_.empty()) {
+            on_partial_(answer_);
+        }
+        return true;
+    }
+};
+
+} // namespace
+
+std::string ReadExplainResponse(Http* http, const ExplainCallback& on_partial) {
+    char buffer[512];
+    std::string head;
+    EventStreamParser parser(on_partial);
+    bool event_stream = false;
+    bool sniffed = false;
+
+    while (true) {
+        int ret = http->Read(buffer, sizeof(buffer));
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to read response: %d", ret);
+            break;
+        }
+        if (ret == 0) {
+            break;
+        }
+        if (sniffed) {
+            if (!event_stream) {
+                head.append(buffer, ret);
+            } else if (!parser.Feed(buffer, ret)) {
+                break;
+            }
+            continue;
+        }
+
+        head.append(buffer, ret);
+        if (head.size() < SSE_SNIFF_BYTES) {
+            continue;
+        }
+        sniffed = true;
+        event_stream = LooksLikeEventStream(head);
+        if (event_stream) {
+            bool more = parser.Feed(head.data(), head.size());
+            head.clear();
+            head.shrink_to_fit();
+            if (!more) {
+                break;
+            }
+        }
+    }
+
+    if (!sniffed && LooksLikeEventStream(head)) {
+        event_stream = true;
+        parser.Feed(head.data(), head.size());
+    }
+    if (!event_stream) {
+        return head;
+    }
+    parser.Finish();
+    return parser.TakeResult();
+}
@@ -0,0 +1,15 @@
+#ifndef EXPLAIN_RESPONSE_H
+#define EXPLAIN_RESPONSE_H
+
+#include <http.h>
+#include <string>
+
+#include "camera.h"
+
+// 读取图片解释服务的响应。服务端返回 text/event-stream 时，每个事件的 data 是
+// {"text": "..."} 片段或纯文本，"[DONE]" 表示结束；每收到一段就把目前为止的完整回答
+// 交给 on_partial，最后返回 {"success": true, "result": "完整回答"}。
+// 普通 JSON 响应原样返回。
+std::string ReadExplainResponse(Http* http, const ExplainCallback& on_partial);
+
+#endif // EXPLAIN_RESPONSE_H
@@ -131,7 +131,8 @@ std::string Ml307Board::GetDeviceStatusJson() {
      * 返回的JSON结构如下：
      * {
      *     "audio_speaker": {
-     *         "volume": 70
+     *         "volume": 70,
+     *         "reference_delay_ms": 12
      *     },
      *     "screen": {
      *         "brightness": 100,
@@ -156,6 +157,10 @@ std::string Ml307Board::GetDeviceStatusJson() {
     auto audio_codec = board.GetAudioCodec();
     if (audio_codec) {
         cJSON_AddNumberToObject(audio_speaker, "volume", audio_codec->output_volume());
+        auto aligner = audio_codec->reference_aligner();
+        if (aligner && aligner->delay_valid()) {
+            cJSON_AddNumberToObject(audio_speaker, "reference_delay_ms", aligner->delay_ms());
+        }
     }
     cJSON_AddItemToObject(root, "audio_speaker", audio_speaker);
 
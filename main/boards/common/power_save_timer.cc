@@ -1,5 +1,6 @@
 #include "power_save_timer.h"
 #include "application.h"
+#include "settings.h"
 
 #include <esp_log.h>
 
@@ -78,6 +79,8 @@ void PowerSaveTimer::PowerSaveCheck() {
         }
     }
     if (seconds_to_shutdown_ != -1 && ticks_ >= seconds_to_shutdown_ && on_shutdown_request_) {
+        // Power off and deep sleep skip the shutdown handlers, write the settings back first
+        Settings::Flush();
         on_shutdown_request_();
     }
 }
@@ -189,7 +189,8 @@ std::string WifiBoard::GetDeviceStatusJson() {
      * 返回的JSON结构如下：
      * {
      *     "audio_speaker": {
-     *         "volume": 70
+     *         "volume": 70,
+     *         "reference_delay_ms": 12
      *     },
      *     "screen": {
      *         "brightness": 100,
@@ -217,6 +218,10 @@ std::string WifiBoard::GetDeviceStatusJson() {
     auto audio_codec = board.GetAudioCodec();
     if (audio_codec) {
         cJSON_AddNumberToObject(audio_speaker, "volume", audio_codec->output_volume());
+        auto aligner = audio_codec->reference_aligner();
+        if (aligner && aligner->delay_valid()) {
+            cJSON_AddNumberToObject(audio_speaker, "reference_delay_ms", aligner->delay_ms());
+        }
     }
     cJSON_AddItemToObject(root, "audio_speaker", audio_speaker);
 
@@ -10,6 +10,9 @@
 
 #define TAG "ElectronEmojiDisplay"
 
+// 预解码表情占用的PSRAM上限
+#define EMOJI_CACHE_SIZE (1024 * 1024)
+
 // 表情映射表 - 将多种表情映射到现有6个GIF
 const ElectronEmojiDisplay::EmotionMap ElectronEmojiDisplay::emotion_maps_[] = {
     // 中性/平静类表情 -> staticstate
@@ -53,8 +56,7 @@ ElectronEmojiDisplay::ElectronEmojiDisplay(esp_lcd_panel_io_handle_t panel_io,
                                            int offset_x, int offset_y, bool mirror_x, bool mirror_y,
                                            bool swap_xy, DisplayFonts fonts)
     : SpiLcdDisplay(panel_io, panel, width, height, offset_x, offset_y, mirror_x, mirror_y, swap_xy,
-                    fonts),
-      emotion_gif_(nullptr) {
+                    fonts) {
     SetupGifContainer();
 }
 
@@ -85,13 +87,10 @@ void ElectronEmojiDisplay::SetupGifContainer() {
     lv_obj_set_style_border_width(emotion_label_, 0, 0);
     lv_obj_add_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
 
-    emotion_gif_ = lv_gif_create(content_);
-    int gif_size = LV_HOR_RES;
-    lv_obj_set_size(emotion_gif_, gif_size, gif_size);
-    lv_obj_set_style_border_width(emotion_gif_, 0, 0);
-    lv_obj_set_style_bg_opa(emotion_gif_, LV_OPA_TRANSP, 0);
-    lv_obj_center(emotion_gif_);
-    lv_gif_set_src(emotion_gif_, &staticstate);
+    // GIF只解码一次，之后播放只拷贝变化的区域
+    emotion_animation_ = std::make_unique<EmojiAnimation>(content_, EMOJI_CACHE_SIZE, lv_color_black());
+    lv_obj_center(emotion_animation_->object());
+    emotion_animation_->Play(&staticstate);
 
     chat_message_label_ = lv_label_create(content_);
     lv_label_set_text(chat_message_label_, "");
@@ -111,7 +110,7 @@ void ElectronEmojiDisplay::SetupGifContainer() {
 }
 
 void ElectronEmojiDisplay::SetEmotion(const char* emotion) {
-    if (!emotion || !emotion_gif_) {
+    if (!emotion || !emotion_animation_) {
         return;
     }
 
@@ -119,13 +118,13 @@ void ElectronEmojiDisplay::SetEmotion(const char* emotion) {
 
     for (const auto& map : emotion_maps_) {
         if (map.name && strcmp(map.name, emotion) == 0) {
-            lv_gif_set_src(emotion_gif_, map.gif);
+            emotion_animation_->Play(map.gif);
             ESP_LOGI(TAG, "设置表情: %s", emotion);
             return;
         }
     }
 
-    lv_gif_set_src(emotion_gif_, &staticstate);
+    emotion_animation_->Play(&staticstate);
     ESP_LOGI(TAG, "未知表情'%s'，使用默认", emotion);
 }
 
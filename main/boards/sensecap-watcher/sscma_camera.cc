@@ -3,6 +3,7 @@
 #include "display.h"
 #include "board.h"
 #include "system_info.h"
+#include "explain_response.h"
 #include "config.h"
 
 #include <esp_log.h>
@@ -257,6 +258,7 @@ bool SscmaCamera::SetVFlip(bool enabled) {
  * 问题对图像进行AI分析并返回结果。
  * 
  * @param question 要向AI提出的关于图像的问题，将作为表单字段发送
+ * @param on_partial 不为空时请求 text/event-stream 响应，每收到一段回答就回调一次
  * @return std::string 服务器返回的JSON格式响应字符串
  *         成功时包含AI分析结果，失败时包含错误信息
  *         格式示例：{"success": true, "result": "分析结果"}
@@ -266,7 +268,7 @@ bool SscmaCamera::SetVFlip(bool enabled) {
  * @note 函数会等待之前的编码线程完成后再开始新的处理
  * @warning 如果摄像头缓冲区为空或网络连接失败，将返回错误信息
  */
-std::string SscmaCamera::Explain(const std::string& question) {
+std::string SscmaCamera::Explain(const std::string& question, ExplainCallback on_partial) {
     if (explain_url_.empty()) {
         return "{\"success\": false, \"message\": \"Image explain URL or token is not set\"}";
     }
@@ -301,6 +303,9 @@ std::string SscmaCamera::Explain(const std::string& question) {
     }
     http->SetHeader("Content-Type", "multipart/form-data; boundary=" + boundary);
     http->SetHeader("Transfer-Encoding", "chunked");
+    if (on_partial) {
+        http->SetHeader("Accept", "text/event-stream");
+    }
     if (!http->Open("POST", explain_url_)) {
         ESP_LOGE(TAG, "Failed to connect to explain URL");
         return "{\"success\": false, \"message\": \"Failed to connect to explain URL\"}";
@@ -326,7 +331,7 @@ std::string SscmaCamera::Explain(const std::string& question) {
         return "{\"success\": false, \"message\": \"Failed to upload photo\"}";
     }
 
-    std::string result = http->ReadAll();
+    std::string result = ReadExplainResponse(http, on_partial);
     http->Close();
 
     ESP_LOGI(TAG, "Explain image size=%d, question=%s\n%s", jpeg_data_.len, question.c_str(), result.c_str());
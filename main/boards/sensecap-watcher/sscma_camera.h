@@ -44,7 +44,7 @@ public:
     // 翻转控制函数
     virtual bool SetHMirror(bool enabled) override;
     virtual bool SetVFlip(bool enabled) override;
-    virtual std::string Explain(const std::string& question);
+    virtual std::string Explain(const std::string& question, ExplainCallback on_partial = nullptr) override;
 };
 
 #endif // ESP32_CAMERA_H
@@ -0,0 +1,114 @@
+#include "chat_history.h"
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "ChatHistory"
+
+ChatHistory::ChatHistory(size_t text_capacity, size_t max_messages)
+    : text_capacity_(std::min<size_t>(text_capacity, UINT16_MAX)), max_messages_(max_messages) {
+    // The text is only read when a message is shown, keep it out of internal RAM if possible
+    text_ = (char*)heap_caps_malloc(text_capacity_, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (text_ == nullptr) {
+        text_ = (char*)heap_caps_malloc(text_capacity_, MALLOC_CAP_8BIT);
+    }
+    if (text_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for the chat history", text_capacity_);
+        return;
+    }
+    entries_ = new Entry[max_messages_];
+}
+
+ChatHistory::~ChatHistory() {
+    heap_caps_free(text_);
+    delete[] entries_;
+}
+
+ChatHistory::Entry& ChatHistory::entry(uint32_t id) const {
+    return entries_[(head_ + (id - first_id())) % max_messages_];
+}
+
+ChatHistory::Role ChatHistory::role(uint32_t id) const {
+    return entry(id).role;
+}
+
+const char* ChatHistory::text(uint32_t id) const {
+    return text_ + entry(id).offset;
+}
+
+uint16_t ChatHistory::width(uint32_t id) const {
+    return entry(id).width;
+}
+
+void ChatHistory::SetWidth(uint32_t id, uint16_t width) {
+    entry(id).width = width;
+}
+
+void ChatHistory::PopFront() {
+    head_ = (head_ + 1) % max_messages_;
+    count_--;
+    if (count_ == 0) {
+        write_pos_ = 0;
+    }
+}
+
+void ChatHistory::PopBack() {
+    if (count_ == 0) {
+        return;
+    }
+    auto& last = entries_[(head_ + count_ - 1) % max_messages_];
+    write_pos_ = last.offset;
+    count_--;
+    next_id_--;
+    if (count_ == 0) {
+        write_pos_ = 0;
+    }
+}
+
+uint32_t ChatHistory::Push(Role role, const char* text) {
+    size_t length = strlen(text);
+    if (length + 1 > text_capacity_) {
+        // Cut at a UTF-8 character boundary
+        length = text_capacity_ - 1;
+        while (length > 0 && (text[length] & 0xC0) == 0x80) {
+            length--;
+        }
+    }
+    size_t need = length + 1;
+
+    if (count_ == max_messages_) {
+        PopFront();
+    }
+    // Text lives in [oldest, write_pos_) circularly, find a contiguous gap for the new one
+    size_t offset;
+    while (true) {
+        if (count_ == 0) {
+            offset = 0;
+            break;
+        }
+        size_t oldest = entries_[head_].offset;
+        if (write_pos_ > oldest) {
+            if (need <= text_capacity_ - write_pos_) {
+                offset = write_pos_;
+                break;
+            }
+            if (need <= oldest) {
+                offset = 0;
+                break;
+            }
+        } else if (need <= oldest - write_pos_) {
+            offset = write_pos_;
+            break;
+        }
+        PopFront();
+    }
+
+    memcpy(text_ + offset, text, length);
+    text_[offset + length] = '\0';
+    entries_[(head_ + count_) % max_messages_] = Entry{(uint16_t)offset, (uint16_t)length, 0, role};
+    count_++;
+    write_pos_ = offset + need;
+    return next_id_++;
+}
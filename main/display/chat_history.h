@@ -0,0 +1,58 @@
+#ifndef CHAT_HISTORY_H
+#define CHAT_HISTORY_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Chat messages packed into one fixed text ring. The oldest messages are dropped when
+// either the text space or the message slots run out, so memory use never grows.
+// Messages are addressed by an id that keeps increasing as they are added.
+class ChatHistory {
+public:
+    enum Role : uint8_t {
+        kRoleUser,
+        kRoleAssistant,
+        kRoleSystem,
+    };
+
+    ChatHistory(size_t text_capacity, size_t max_messages);
+    ~ChatHistory();
+
+    // Returns the id of the new message, text longer than the ring is truncated
+    uint32_t Push(Role role, const char* text);
+    // Drops the newest message
+    void PopBack();
+
+    inline uint32_t first_id() const { return next_id_ - count_; }
+    inline uint32_t end_id() const { return next_id_; }
+    inline bool empty() const { return count_ == 0; }
+    // False if the text ring could not be allocated, the history must not be used then
+    inline bool valid() const { return text_ != nullptr; }
+    Role role(uint32_t id) const;
+    const char* text(uint32_t id) const;
+    // Rendered width in pixels cached by the view, 0 until it is measured
+    uint16_t width(uint32_t id) const;
+    void SetWidth(uint32_t id, uint16_t width);
+
+private:
+    struct Entry {
+        uint16_t offset;
+        uint16_t length;
+        uint16_t width;
+        Role role;
+    };
+
+    char* text_ = nullptr;
+    size_t text_capacity_;
+    size_t write_pos_ = 0;
+    Entry* entries_ = nullptr;
+    size_t max_messages_;
+    size_t head_ = 0;   // Slot of the oldest message
+    size_t count_ = 0;
+    uint32_t next_id_ = 0;
+
+    Entry& entry(uint32_t id) const;
+    void PopFront();
+};
+
+#endif // CHAT_HISTORY_H
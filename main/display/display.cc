@@ -3,6 +3,7 @@
 #include <string>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 
 #include "display.h"
 #include "board.h"
@@ -14,6 +15,22 @@
 
 #define TAG "Display"
 
+// Posted updates are applied at about the LVGL refresh rate, and polled for more slowly
+// while nothing has been posted for a while
+#define DISPLAY_UPDATE_INTERVAL_MS 30
+#define DISPLAY_IDLE_UPDATE_INTERVAL_MS 100
+// The oldest chat messages are dropped if the LVGL task falls this far behind
+#define MAX_PENDING_MESSAGES 8
+// Rough speaking rate of the TTS voice, used to reveal a sentence along with its audio
+#define STREAMING_CJK_CHAR_MS 200
+#define STREAMING_ASCII_CHAR_MS 60
+
+static constexpr uint32_t kUpdateStatus = 1 << 0;
+static constexpr uint32_t kUpdateNotification = 1 << 1;
+static constexpr uint32_t kUpdateEmotion = 1 << 2;
+static constexpr uint32_t kUpdateIcon = 1 << 3;
+static constexpr uint32_t kUpdateStreamProgress = 1 << 4;
+
 Display::Display() {
     // Notification timer
     esp_timer_create_args_t notification_timer_args = {
@@ -40,6 +57,7 @@ Display::Display() {
 }
 
 Display::~Display() {
+    // The update timer was stopped by the subclass, Lock() is no longer available here
     if (notification_timer_ != nullptr) {
         esp_timer_stop(notification_timer_);
         esp_timer_delete(notification_timer_);
@@ -61,6 +79,222 @@ Display::~Display() {
     }
 }
 
+void Display::StartUpdateTimer() {
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    if (update_timer_ != nullptr) {
+        return;
+    }
+    update_timer_ = lv_timer_create([](lv_timer_t* timer) {
+        auto display = static_cast<Display*>(lv_timer_get_user_data(timer));
+        display->ApplyPendingUpdates();
+    }, DISPLAY_IDLE_UPDATE_INTERVAL_MS, this);
+}
+
+void Display::StopUpdateTimer() {
+    DisplayLockGuard lock(this);
+    std::lock_guard<std::mutex> guard(update_mutex_);
+    if (update_timer_ != nullptr) {
+        lv_timer_delete(update_timer_);
+        update_timer_ = nullptr;
+    }
+}
+
+void Display::PostStatus(const char* status) {
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+        if (update_timer_ != nullptr) {
+            pending_status_ = status;
+            // A newer status hides the notification anyway
+            pending_updates_ = (pending_updates_ & ~kUpdateNotification) | kUpdateStatus;
+            OnUpdatePosted();
+            return;
+        }
+    }
+    // No LVGL task to defer to, apply it right away
+    SetStatus(status);
+}
+
+void Display::PostNotification(const char* notification, int duration_ms) {
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+        if (update_timer_ != nullptr) {
+            pending_notification_ = notification;
+            pending_notification_duration_ms_ = duration_ms;
+            pending_updates_ |= kUpdateNotification;
+            OnUpdatePosted();
+            return;
+        }
+    }
+    ShowNotification(notification, duration_ms);
+}
+
+void Display::PostEmotion(const char* emotion) {
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+        if (update_timer_ != nullptr) {
+            pending_emotion_ = emotion;
+            pending_updates_ = (pending_updates_ & ~kUpdateIcon) | kUpdateEmotion;
+            OnUpdatePosted();
+            return;
+        }
+    }
+    SetEmotion(emotion);
+}
+
+void Display::PostIcon(const char* icon) {
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+        if (update_timer_ != nullptr) {
+            pending_emotion_ = icon;
+            pending_updates_ = (pending_updates_ & ~kUpdateEmotion) | kUpdateIcon;
+            OnUpdatePosted();
+            return;
+        }
+    }
+    SetIcon(icon);
+}
+
+void Display::PostChatMessage(const char* role, const char* content) {
+    PostMessage(role, content, false);
+}
+
+void Display::PostStreamingMessage(const char* role, const char* content) {
+    PostMessage(role, content, true);
+}
+
+void Display::PostMessage(const char* role, const char* content, bool streaming) {
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+        if (update_timer_ != nullptr) {
+            if (streaming) {
+                // Progress reported so far belongs to the previous message
+                pending_updates_ &= ~kUpdateStreamProgress;
+            }
+            // Every message gets its own bubble, so these are queued in order. A system message
+            // replaces a pending one just like the chat view folds consecutive system messages.
+            if (!streaming && strcmp(role, "system") == 0 && content[0] != '\0' && !pending_messages_.empty()
+                && pending_messages_.back().role == "system") {
+                pending_messages_.back().content = content;
+                return;
+            }
+            if (pending_messages_.size() >= MAX_PENDING_MESSAGES) {
+                ESP_LOGW(TAG, "Display is falling behind, dropping a chat message");
+                pending_messages_.pop_front();
+            }
+            pending_messages_.push_back({role, content, streaming});
+            OnUpdatePosted();
+            return;
+        }
+    }
+    // Without the LVGL task there is nothing to reveal the text with, show it whole
+    SetChatMessage(role, content);
+}
+
+void Display::PostStreamingProgress(int played_ms) {
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    if (update_timer_ != nullptr) {
+        pending_stream_ms_ = played_ms;
+        pending_updates_ |= kUpdateStreamProgress;
+        OnUpdatePosted();
+    }
+}
+
+// Called with update_mutex_ held after queuing an update. Never touches LVGL, so posting
+// does not wait for the display lock.
+void Display::OnUpdatePosted() {
+    updates_posted_ = true;
+}
+
+size_t Display::GetSpokenLength(const std::string& text, int played_ms) {
+    size_t length = 0;
+    int elapsed_ms = 0;
+    while (length < text.size() && elapsed_ms <= played_ms) {
+        uint8_t c = text[length];
+        if (c < 0x80) {
+            elapsed_ms += STREAMING_ASCII_CHAR_MS;
+            length += 1;
+        } else {
+            // Multi-byte characters are mostly CJK, each one is a syllable
+            elapsed_ms += STREAMING_CJK_CHAR_MS;
+            length += c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+        }
+    }
+    return std::min(length, text.size());
+}
+
+void Display::FinishStreaming() {
+    if (!streaming_) {
+        return;
+    }
+    streaming_ = false;
+    SetStreamingMessage(stream_role_.c_str(), stream_content_.c_str(), stream_content_.size());
+}
+
+void Display::ApplyPendingUpdates() {
+    uint32_t updates;
+    std::string status, notification, emotion;
+    int notification_duration_ms, stream_ms;
+    std::deque<PendingMessage> messages;
+    if (!updates_posted_.exchange(false)) {
+        // Poll slowly until something is posted again
+        if (update_timer_fast_) {
+            update_timer_fast_ = false;
+            lv_timer_set_period(update_timer_, DISPLAY_IDLE_UPDATE_INTERVAL_MS);
+        }
+        return;
+    }
+    if (!update_timer_fast_) {
+        update_timer_fast_ = true;
+        lv_timer_set_period(update_timer_, DISPLAY_UPDATE_INTERVAL_MS);
+    }
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+        updates = pending_updates_;
+        pending_updates_ = 0;
+        status.swap(pending_status_);
+        notification.swap(pending_notification_);
+        notification_duration_ms = pending_notification_duration_ms_;
+        emotion.swap(pending_emotion_);
+        messages.swap(pending_messages_);
+        stream_ms = pending_stream_ms_;
+    }
+
+    // Runs in the LVGL task which already holds the (recursive) display lock
+    if (updates & kUpdateStatus) {
+        SetStatus(status.c_str());
+    }
+    if (updates & kUpdateNotification) {
+        ShowNotification(notification.c_str(), notification_duration_ms);
+    }
+    if (updates & kUpdateEmotion) {
+        SetEmotion(emotion.c_str());
+    } else if (updates & kUpdateIcon) {
+        SetIcon(emotion.c_str());
+    }
+    for (auto& message : messages) {
+        FinishStreaming();
+        if (message.streaming) {
+            stream_role_ = std::move(message.role);
+            stream_content_ = std::move(message.content);
+            stream_visible_ = 0;
+            streaming_ = true;
+            SetStreamingMessage(stream_role_.c_str(), stream_content_.c_str(), 0);
+        } else {
+            SetChatMessage(message.role.c_str(), message.content.c_str());
+        }
+    }
+
+    if ((updates & kUpdateStreamProgress) && streaming_) {
+        size_t visible = stream_ms < 0 ? stream_content_.size() : GetSpokenLength(stream_content_, stream_ms);
+        if (visible >= stream_content_.size()) {
+            FinishStreaming();
+        } else if (visible > stream_visible_) {
+            stream_visible_ = visible;
+            SetStreamingMessage(stream_role_.c_str(), stream_content_.c_str(), visible);
+        }
+    }
+}
+
 void Display::SetStatus(const char* status) {
     DisplayLockGuard lock(this);
     if (status_label_ == nullptr) {
@@ -243,6 +477,11 @@ void Display::SetChatMessage(const char* role, const char* content) {
     lv_label_set_text(chat_message_label_, content);
 }
 
+void Display::SetStreamingMessage(const char* role, const char* content, size_t visible_length) {
+    // Without a dedicated widget the visible part is shown as a whole message
+    SetChatMessage(role, std::string(content, std::min(visible_length, strlen(content))).c_str());
+}
+
 void Display::SetTheme(const std::string& theme_name) {
     current_theme_name_ = theme_name;
     Settings settings("display", true);
@@ -7,6 +7,9 @@
 #include <esp_pm.h>
 
 #include <string>
+#include <deque>
+#include <mutex>
+#include <atomic>
 
 struct DisplayFonts {
     const lv_font_t* text_font = nullptr;
@@ -24,6 +27,9 @@ public:
     virtual void ShowNotification(const std::string &notification, int duration_ms = 3000);
     virtual void SetEmotion(const char* emotion);
     virtual void SetChatMessage(const char* role, const char* content);
+    // Shows the first visible_length bytes of a message that is revealed along with speech,
+    // called with a growing length until the whole message is visible
+    virtual void SetStreamingMessage(const char* role, const char* content, size_t visible_length);
     virtual void SetIcon(const char* icon);
     virtual void SetPreviewImage(const lv_img_dsc_t* image);
     virtual void SetTheme(const std::string& theme_name);
@@ -33,6 +39,20 @@ public:
     inline int width() const { return width_; }
     inline int height() const { return height_; }
 
+    // Safe to call from any task without waiting for the display lock. Only the latest value of
+    // each widget is kept and the LVGL task applies it on its next update tick.
+    void PostStatus(const char* status);
+    void PostNotification(const char* notification, int duration_ms = 3000);
+    void PostEmotion(const char* emotion);
+    void PostIcon(const char* icon);
+    void PostChatMessage(const char* role, const char* content);
+    // Starts revealing a message, PostStreamingProgress then reports how long its audio has
+    // played, or -1 to show the rest. Any other chat message finishes it too.
+    void PostStreamingMessage(const char* role, const char* content);
+    void PostStreamingProgress(int played_ms);
+    // Number of bytes of text spoken after played_ms, from the rough speaking rate of the voice
+    static size_t GetSpokenLength(const std::string& text, int played_ms);
+
 protected:
     int width_ = 0;
     int height_ = 0;
@@ -57,9 +77,44 @@ protected:
 
     esp_timer_handle_t notification_timer_ = nullptr;
 
+    // Starts applying posted updates in the LVGL task, call with the display locked
+    void StartUpdateTimer();
+    // Subclasses call this from their destructor while Lock() still works
+    void StopUpdateTimer();
+
     friend class DisplayLockGuard;
     virtual bool Lock(int timeout_ms = 0) = 0;
     virtual void Unlock() = 0;
+
+private:
+    struct PendingMessage {
+        std::string role;
+        std::string content;
+        bool streaming;
+    };
+
+    std::mutex update_mutex_;
+    uint32_t pending_updates_ = 0;
+    std::string pending_status_;
+    std::string pending_notification_;
+    int pending_notification_duration_ms_ = 0;
+    std::string pending_emotion_;       // Emotion name or icon, the two share one label
+    std::deque<PendingMessage> pending_messages_;
+    int pending_stream_ms_ = 0;
+    lv_timer_t* update_timer_ = nullptr;
+    std::atomic<bool> updates_posted_{false};
+    bool update_timer_fast_ = false;    // Only used in the LVGL task
+
+    // The message being revealed, only used in the LVGL task
+    std::string stream_role_;
+    std::string stream_content_;
+    size_t stream_visible_ = 0;
+    bool streaming_ = false;
+
+    void PostMessage(const char* role, const char* content, bool streaming);
+    void OnUpdatePosted();
+    void FinishStreaming();
+    void ApplyPendingUpdates();
 };
 
 
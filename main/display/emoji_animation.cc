@@ -0,0 +1,351 @@
+#include "emoji_animation.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <esp_pthread.h>
+#include <libs/gif/gifdec.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "EmojiAnimation"
+
+// A zero delay would otherwise redraw as fast as the LVGL task runs
+#define MIN_FRAME_DELAY_MS 20
+#define DEFAULT_FRAME_DELAY_MS 100
+// How often the LVGL task checks for a finished decode while one is outstanding
+#define PICKUP_INTERVAL_MS 20
+#define DECODE_STACK_SIZE 6144
+
+static void* AllocatePixels(size_t size) {
+    void* data = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (data == nullptr) {
+        data = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    return data;
+}
+
+EmojiAnimation::EmojiAnimation(lv_obj_t* parent, size_t cache_bytes, lv_color_t background)
+    : cache_bytes_(cache_bytes), background_(background) {
+    canvas_ = lv_canvas_create(parent);
+    timer_ = lv_timer_create([](lv_timer_t* timer) {
+        static_cast<EmojiAnimation*>(lv_timer_get_user_data(timer))->OnTimer();
+    }, DEFAULT_FRAME_DELAY_MS, this);
+    lv_timer_pause(timer_);
+    pickup_timer_ = lv_timer_create([](lv_timer_t* timer) {
+        static_cast<EmojiAnimation*>(lv_timer_get_user_data(timer))->OnDecoded();
+    }, PICKUP_INTERVAL_MS, this);
+    lv_timer_pause(pickup_timer_);
+
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.thread_name = "emoji_decode";
+    cfg.stack_size = DECODE_STACK_SIZE;
+    cfg.prio = 1;
+    esp_pthread_set_cfg(&cfg);
+    decode_thread_ = std::thread([this]() {
+        DecodeLoop();
+    });
+    // Threads created later by this task get the default config again
+    cfg = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&cfg);
+}
+
+EmojiAnimation::~EmojiAnimation() {
+    {
+        std::lock_guard<std::mutex> lock(decode_mutex_);
+        stopping_ = true;
+    }
+    decode_cv_.notify_all();
+    decode_thread_.join();
+
+    lv_timer_delete(pickup_timer_);
+    lv_timer_delete(timer_);
+    lv_obj_del(canvas_);
+    for (auto& animation : animations_) {
+        Release(animation);
+    }
+    for (auto& animation : decoded_) {
+        FreeFrames(animation);
+    }
+    heap_caps_free(canvas_buffer_);
+}
+
+void EmojiAnimation::FreeFrames(Animation& animation) {
+    for (auto& frame : animation.frames) {
+        heap_caps_free(frame.pixels);
+    }
+    heap_caps_free(animation.loop_frame.pixels);
+}
+
+void EmojiAnimation::Release(Animation& animation) {
+    FreeFrames(animation);
+    used_bytes_ -= animation.bytes;
+}
+
+void EmojiAnimation::Play(const lv_image_dsc_t* gif, bool loop) {
+    auto it = std::find_if(animations_.begin(), animations_.end(),
+        [gif](const Animation& animation) { return animation.source == gif; });
+    if (it != animations_.end()) {
+        {
+            // A GIF still being decoded was asked for earlier, this choice is newer
+            std::lock_guard<std::mutex> lock(decode_mutex_);
+            wanted_ = nullptr;
+        }
+        animations_.splice(animations_.begin(), animations_, it);
+        if (&animations_.front() != current_) {
+            Start(&animations_.front(), loop);
+        }
+        return;
+    }
+
+    // Keep the current animation playing while the new one is decoded
+    {
+        std::lock_guard<std::mutex> lock(decode_mutex_);
+        if (std::find(failed_.begin(), failed_.end(), gif) != failed_.end()) {
+            return;
+        }
+        wanted_ = gif;
+        wanted_loop_ = loop;
+    }
+    decode_cv_.notify_one();
+    lv_timer_resume(pickup_timer_);
+}
+
+void EmojiAnimation::Start(Animation* animation, bool loop) {
+    if (canvas_width_ != animation->width || canvas_height_ != animation->height) {
+        auto buffer = static_cast<uint16_t*>(AllocatePixels(animation->width * animation->height * sizeof(uint16_t)));
+        if (buffer == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate the canvas");
+            return;
+        }
+        lv_canvas_set_buffer(canvas_, buffer, animation->width, animation->height, LV_COLOR_FORMAT_RGB565);
+        heap_caps_free(canvas_buffer_);
+        canvas_buffer_ = buffer;
+        canvas_width_ = animation->width;
+        canvas_height_ = animation->height;
+    }
+
+    current_ = animation;
+    loop_ = loop;
+    frame_index_ = 0;
+    ShowFrame(animation->frames[0]);
+    if (animation->frames.size() > 1) {
+        lv_timer_set_period(timer_, animation->frames[0].delay_ms);
+        lv_timer_reset(timer_);
+        lv_timer_resume(timer_);
+    } else {
+        lv_timer_pause(timer_);
+    }
+}
+
+// Runs on the decode thread, decodes whatever GIF is wanted and not decoded yet
+void EmojiAnimation::DecodeLoop() {
+    auto needs_decode = [this]() {
+        if (wanted_ == nullptr || std::find(failed_.begin(), failed_.end(), wanted_) != failed_.end()) {
+            return false;
+        }
+        return std::none_of(decoded_.begin(), decoded_.end(),
+            [this](const Animation& animation) { return animation.source == wanted_; });
+    };
+    while (true) {
+        const lv_image_dsc_t* gif;
+        {
+            std::unique_lock<std::mutex> lock(decode_mutex_);
+            decode_cv_.wait(lock, [this, &needs_decode]() { return stopping_ || needs_decode(); });
+            if (stopping_) {
+                return;
+            }
+            gif = wanted_;
+            decoding_ = gif;
+        }
+
+        Animation animation = {};
+        bool ok = Decode(gif, animation);
+
+        std::lock_guard<std::mutex> lock(decode_mutex_);
+        decoding_ = nullptr;
+        if (ok) {
+            decoded_.push_back(std::move(animation));
+        } else {
+            failed_.push_back(gif);
+        }
+    }
+}
+
+// Runs in the LVGL task, moves finished animations into the cache and plays the wanted one
+void EmojiAnimation::OnDecoded() {
+    std::list<Animation> done;
+    const lv_image_dsc_t* wanted;
+    bool loop;
+    bool busy;
+    {
+        std::lock_guard<std::mutex> lock(decode_mutex_);
+        done.swap(decoded_);
+        wanted = wanted_;
+        loop = wanted_loop_;
+        bool finished = std::find(failed_.begin(), failed_.end(), wanted_) != failed_.end()
+            || std::any_of(done.begin(), done.end(), [this](const Animation& animation) { return animation.source == wanted_; });
+        if (finished) {
+            wanted_ = nullptr;
+        }
+        busy = wanted_ != nullptr || decoding_ != nullptr;
+    }
+    if (!busy) {
+        lv_timer_pause(pickup_timer_);
+    }
+
+    Animation* next = nullptr;
+    for (auto& animation : done) {
+        used_bytes_ += animation.bytes;
+    }
+    animations_.splice(animations_.begin(), done);
+    auto it = std::find_if(animations_.begin(), animations_.end(),
+        [wanted](const Animation& animation) { return animation.source == wanted; });
+    if (wanted != nullptr && it != animations_.end()) {
+        animations_.splice(animations_.begin(), animations_, it);
+        next = &animations_.front();
+    }
+
+    // Make room by dropping the animations that were not played for the longest time
+    while (used_bytes_ > cache_bytes_ && animations_.size() > 1 && &animations_.back() != current_
+        && &animations_.back() != next) {
+        Release(animations_.back());
+        animations_.pop_back();
+    }
+    if (next != nullptr && next != current_) {
+        Start(next, loop);
+    }
+}
+
+void EmojiAnimation::OnTimer() {
+    if (current_ == nullptr) {
+        return;
+    }
+    auto& frames = current_->frames;
+    if (frame_index_ + 1 < frames.size()) {
+        frame_index_++;
+        ShowFrame(frames[frame_index_]);
+    } else if (loop_) {
+        frame_index_ = 0;
+        ShowFrame(current_->loop_frame);
+    } else {
+        lv_timer_pause(timer_);
+        return;
+    }
+    lv_timer_set_period(timer_, frames[frame_index_].delay_ms);
+}
+
+void EmojiAnimation::ShowFrame(const Frame& frame) {
+    if (frame.pixels == nullptr) {
+        return;
+    }
+    int width = lv_area_get_width(&frame.area);
+    for (int y = frame.area.y1; y <= frame.area.y2; y++) {
+        memcpy(canvas_buffer_ + y * canvas_width_ + frame.area.x1,
+            frame.pixels + (y - frame.area.y1) * width, width * sizeof(uint16_t));
+    }
+
+    // Only redraw the pixels that changed, in screen coordinates
+    lv_area_t area;
+    lv_obj_get_coords(canvas_, &area);
+    area.x2 = area.x1 + frame.area.x2;
+    area.y2 = area.y1 + frame.area.y2;
+    area.x1 += frame.area.x1;
+    area.y1 += frame.area.y1;
+    lv_obj_invalidate_area(canvas_, &area);
+}
+
+bool EmojiAnimation::DiffFrame(const uint16_t* previous, const uint16_t* current, int width, int height, Frame& frame) {
+    int x1 = width, y1 = height, x2 = -1, y2 = -1;
+    for (int y = 0; y < height; y++) {
+        const uint16_t* a = previous != nullptr ? previous + y * width : nullptr;
+        const uint16_t* b = current + y * width;
+        for (int x = 0; x < width; x++) {
+            if (a == nullptr || a[x] != b[x]) {
+                x1 = std::min(x1, x);
+                x2 = std::max(x2, x);
+                y1 = std::min(y1, y);
+                y2 = y;
+            }
+        }
+    }
+
+    frame.pixels = nullptr;
+    frame.area = {0, 0, -1, -1};
+    if (x2 < 0) {
+        return true;
+    }
+    frame.area = {x1, y1, x2, y2};
+    int rect_width = x2 - x1 + 1;
+    frame.pixels = static_cast<uint16_t*>(AllocatePixels(rect_width * (y2 - y1 + 1) * sizeof(uint16_t)));
+    if (frame.pixels == nullptr) {
+        return false;
+    }
+    for (int y = y1; y <= y2; y++) {
+        memcpy(frame.pixels + (y - y1) * rect_width, current + y * width + x1, rect_width * sizeof(uint16_t));
+    }
+    return true;
+}
+
+// Runs on the decode thread, only touches the animation it fills in
+bool EmojiAnimation::Decode(const lv_image_dsc_t* gif, Animation& animation) {
+    int64_t start_time = esp_timer_get_time();
+    gd_GIF* decoder = gd_open_gif_data(gif->data);
+    if (decoder == nullptr) {
+        ESP_LOGE(TAG, "Failed to open GIF");
+        return false;
+    }
+
+    animation.source = gif;
+    animation.width = decoder->width;
+    animation.height = decoder->height;
+    size_t pixels = animation.width * animation.height;
+    auto argb = static_cast<lv_color32_t*>(AllocatePixels(pixels * sizeof(lv_color32_t)));
+    auto first = static_cast<uint16_t*>(AllocatePixels(pixels * sizeof(uint16_t)));
+    auto previous = static_cast<uint16_t*>(AllocatePixels(pixels * sizeof(uint16_t)));
+    auto current = static_cast<uint16_t*>(AllocatePixels(pixels * sizeof(uint16_t)));
+    bool ok = argb != nullptr && first != nullptr && previous != nullptr && current != nullptr;
+
+    while (ok && gd_get_frame(decoder) > 0) {
+        gd_render_frame(decoder, reinterpret_cast<uint8_t*>(argb));
+        // Flatten transparency onto the background once, the canvas is opaque
+        for (size_t i = 0; i < pixels; i++) {
+            lv_color_t color = lv_color_mix(lv_color_make(argb[i].red, argb[i].green, argb[i].blue), background_, argb[i].alpha);
+            current[i] = lv_color_to_u16(color);
+        }
+
+        Frame frame;
+        bool is_first = animation.frames.empty();
+        ok = DiffFrame(is_first ? nullptr : previous, current, animation.width, animation.height, frame);
+        frame.delay_ms = std::max<uint32_t>(decoder->gce.delay * 10, MIN_FRAME_DELAY_MS);
+        if (ok) {
+            animation.frames.push_back(frame);
+        }
+        if (is_first) {
+            memcpy(first, current, pixels * sizeof(uint16_t));
+        }
+        std::swap(previous, current);
+    }
+    if (ok && !animation.frames.empty()) {
+        ok = DiffFrame(previous, first, animation.width, animation.height, animation.loop_frame);
+        animation.loop_frame.delay_ms = animation.frames[0].delay_ms;
+    }
+    gd_close_gif(decoder);
+    heap_caps_free(argb);
+    heap_caps_free(first);
+    heap_caps_free(previous);
+    heap_caps_free(current);
+
+    if (!ok || animation.frames.empty()) {
+        ESP_LOGE(TAG, "Failed to decode GIF");
+        FreeFrames(animation);
+        return false;
+    }
+    for (auto& frame : animation.frames) {
+        animation.bytes += lv_area_get_size(&frame.area) * sizeof(uint16_t);
+    }
+    animation.bytes += lv_area_get_size(&animation.loop_frame.area) * sizeof(uint16_t);
+    ESP_LOGI(TAG, "Decoded %dx%d GIF, %u frames, %u bytes in %lld ms", animation.width, animation.height,
+        (unsigned)animation.frames.size(), (unsigned)animation.bytes, (esp_timer_get_time() - start_time) / 1000);
+    return true;
+}
@@ -0,0 +1,82 @@
+#ifndef EMOJI_ANIMATION_H
+#define EMOJI_ANIMATION_H
+
+#include <lvgl.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+// Plays GIF emoji animations without decoding them while they play. Each GIF is decoded
+// once into RGB565 and kept as its first frame plus the changed rectangle of every later
+// frame. Playing copies that rectangle into a canvas and only invalidates it, and switching
+// to an animation that was shown before needs no GIF parsing at all. Decoded animations
+// stay in PSRAM up to the cache size, least recently used first out.
+// GIFs that were not decoded yet are decoded on a worker thread, the current animation
+// keeps playing until the new one is ready. Must be used with the display locked.
+class EmojiAnimation {
+public:
+    EmojiAnimation(lv_obj_t* parent, size_t cache_bytes, lv_color_t background);
+    ~EmojiAnimation();
+
+    // The GIF is passed the same way as to lv_gif_set_src
+    void Play(const lv_image_dsc_t* gif, bool loop = true);
+    inline lv_obj_t* object() const { return canvas_; }
+
+private:
+    struct Frame {
+        lv_area_t area;     // Changed pixels, relative to the canvas
+        uint32_t delay_ms;
+        uint16_t* pixels;
+    };
+    struct Animation {
+        const void* source;
+        int width;
+        int height;
+        std::vector<Frame> frames;  // The first one covers the whole canvas
+        Frame loop_frame;           // From the last frame back to the first one
+        size_t bytes;
+    };
+
+    lv_obj_t* canvas_ = nullptr;
+    lv_timer_t* timer_ = nullptr;
+    uint16_t* canvas_buffer_ = nullptr;
+    int canvas_width_ = 0;
+    int canvas_height_ = 0;
+    size_t cache_bytes_;
+    size_t used_bytes_ = 0;
+    lv_color_t background_;
+
+    std::list<Animation> animations_;   // Most recently played first
+    Animation* current_ = nullptr;
+    size_t frame_index_ = 0;
+    bool loop_ = true;
+
+    // Shared with the decode thread
+    std::mutex decode_mutex_;
+    std::condition_variable decode_cv_;
+    std::thread decode_thread_;
+    const lv_image_dsc_t* wanted_ = nullptr;    // Waiting to be played once decoded
+    bool wanted_loop_ = true;
+    const lv_image_dsc_t* decoding_ = nullptr;
+    std::list<Animation> decoded_;      // Done, not yet added to the cache
+    std::vector<const void*> failed_;
+    bool stopping_ = false;
+    lv_timer_t* pickup_timer_ = nullptr;    // Runs while a decode is outstanding
+
+    void Start(Animation* animation, bool loop);
+    void DecodeLoop();
+    void OnDecoded();
+    bool Decode(const lv_image_dsc_t* gif, Animation& animation);
+    void Release(Animation& animation);
+    static void FreeFrames(Animation& animation);
+    static bool DiffFrame(const uint16_t* previous, const uint16_t* current, int width, int height, Frame& frame);
+    void ShowFrame(const Frame& frame);
+    void OnTimer();
+};
+
+#endif // EMOJI_ANIMATION_H
@@ -0,0 +1,121 @@
+#include "glyph_cache.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "GlyphCache"
+
+// One descriptor slot per this many bytes of bitmap cache
+#define BYTES_PER_DESCRIPTOR 512
+#define MIN_DESCRIPTORS 64
+
+static void* AllocateCacheMemory(size_t size) {
+    // Cached glyphs are copied once per draw, PSRAM is fast enough for that. Internal RAM
+    // is never used, the cache is not worth the space there.
+    return heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+}
+
+GlyphCache::GlyphCache(const lv_font_t* base, size_t capacity_bytes)
+    : font_(*base), base_(base) {
+    font_.get_glyph_dsc = GetGlyphDsc;
+    font_.get_glyph_bitmap = GetGlyphBitmap;
+    font_.user_data = this;
+
+    // Every slot holds an A8 bitmap as large as a line, larger glyphs are not cached
+    bitmap_slot_size_ = lv_draw_buf_width_to_stride(base->line_height, LV_COLOR_FORMAT_A8) * base->line_height;
+    bitmap_count_ = bitmap_slot_size_ > 0 ? capacity_bytes / bitmap_slot_size_ : 0;
+    if (bitmap_count_ > 0) {
+        bitmaps_ = static_cast<Bitmap*>(AllocateCacheMemory(bitmap_count_ * sizeof(Bitmap)));
+        bitmap_data_ = static_cast<uint8_t*>(AllocateCacheMemory(bitmap_count_ * bitmap_slot_size_));
+        if (bitmaps_ == nullptr || bitmap_data_ == nullptr) {
+            heap_caps_free(bitmaps_);
+            heap_caps_free(bitmap_data_);
+            bitmaps_ = nullptr;
+            bitmap_data_ = nullptr;
+            bitmap_count_ = 0;
+        } else {
+            std::fill(bitmaps_, bitmaps_ + bitmap_count_, Bitmap{0, 0, 0});
+        }
+    }
+
+    // With kerning the descriptor depends on the next letter as well, only bitmaps are cached then
+    bool kerning = base->kerning != LV_FONT_KERNING_NONE;
+    if (kerning && base->get_glyph_dsc == lv_font_get_glyph_dsc_fmt_txt) {
+        kerning = static_cast<const lv_font_fmt_txt_dsc_t*>(base->dsc)->kern_dsc != nullptr;
+    }
+    if (!kerning) {
+        descriptor_count_ = std::max<size_t>(MIN_DESCRIPTORS, capacity_bytes / BYTES_PER_DESCRIPTOR);
+        descriptors_ = static_cast<Descriptor*>(AllocateCacheMemory(descriptor_count_ * sizeof(Descriptor)));
+        if (descriptors_ != nullptr) {
+            std::fill(descriptors_, descriptors_ + descriptor_count_, Descriptor());
+        }
+    }
+    ESP_LOGI(TAG, "Glyph cache %u bitmaps of %u bytes, %u descriptors", (unsigned)bitmap_count_, (unsigned)bitmap_slot_size_,
+        descriptors_ != nullptr ? (unsigned)descriptor_count_ : 0);
+}
+
+GlyphCache::~GlyphCache() {
+    heap_caps_free(bitmaps_);
+    heap_caps_free(bitmap_data_);
+    heap_caps_free(descriptors_);
+}
+
+bool GlyphCache::GetGlyphDsc(const lv_font_t* font, lv_font_glyph_dsc_t* dsc, uint32_t letter, uint32_t letter_next) {
+    auto cache = static_cast<GlyphCache*>(font->user_data);
+    auto base = cache->base_;
+    if (cache->descriptors_ == nullptr || letter == 0) {
+        return base->get_glyph_dsc(base, dsc, letter, letter_next);
+    }
+
+    auto& slot = cache->descriptors_[letter % cache->descriptor_count_];
+    if (slot.letter != letter) {
+        slot.found = base->get_glyph_dsc(base, dsc, letter, letter_next);
+        slot.dsc = *dsc;
+        slot.letter = letter;
+        return slot.found;
+    }
+    *dsc = slot.dsc;
+    return slot.found;
+}
+
+const void* GlyphCache::GetGlyphBitmap(lv_font_glyph_dsc_t* dsc, lv_draw_buf_t* draw_buf) {
+    auto cache = static_cast<GlyphCache*>(dsc->resolved_font->user_data);
+    return cache->LoadBitmap(dsc, draw_buf);
+}
+
+const void* GlyphCache::LoadBitmap(lv_font_glyph_dsc_t* dsc, lv_draw_buf_t* draw_buf) {
+    uint32_t glyph = dsc->gid.index;
+    Bitmap* bitmap = nullptr;
+    uint8_t* data = nullptr;
+    if (bitmap_count_ > 0 && draw_buf != nullptr) {
+        size_t index = glyph % bitmap_count_;
+        bitmap = &bitmaps_[index];
+        data = bitmap_data_ + index * bitmap_slot_size_;
+        if (bitmap->size > 0 && bitmap->glyph == glyph && bitmap->stride == draw_buf->header.stride
+            && bitmap->size <= draw_buf->data_size) {
+            memcpy(draw_buf->data, data, bitmap->size);
+            hits_++;
+            return draw_buf;
+        }
+    }
+
+    misses_++;
+    dsc->resolved_font = base_;
+    const void* result = base_->get_glyph_bitmap(dsc, draw_buf);
+    dsc->resolved_font = &font_;
+    // Only bitmaps decoded into the draw buffer are worth keeping, others point into the font data
+    if (bitmap == nullptr || result != draw_buf) {
+        return result;
+    }
+
+    uint32_t size = draw_buf->header.stride * dsc->box_h;
+    if (size == 0 || size > draw_buf->data_size || size > bitmap_slot_size_) {
+        return result;
+    }
+    // The slot is shared by every glyph mapped to it, the newest one wins
+    memcpy(data, draw_buf->data, size);
+    *bitmap = Bitmap{glyph, draw_buf->header.stride, size};
+    return result;
+}
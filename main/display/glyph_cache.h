@@ -0,0 +1,52 @@
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <lvgl.h>
+
+#include <cstdint>
+#include <cstddef>
+
+// Wraps an LVGL font and keeps the decoded bitmaps of recently drawn glyphs, so redrawing
+// long CJK text copies bitmaps instead of decompressing every glyph again. Glyph
+// descriptors are cached too when the font has no kerning, which makes the line breaking
+// LVGL repeats on every redraw cheap. Both caches are direct mapped tables allocated once
+// in PSRAM, nothing is allocated per glyph. Only touched from the LVGL task.
+class GlyphCache {
+public:
+    GlyphCache(const lv_font_t* base, size_t capacity_bytes);
+    ~GlyphCache();
+
+    // Use this font in place of the base font, fallbacks and metrics are the same
+    inline const lv_font_t* font() const { return &font_; }
+    inline uint32_t hits() const { return hits_; }
+    inline uint32_t misses() const { return misses_; }
+
+private:
+    struct Bitmap {
+        uint32_t glyph;
+        uint32_t stride;
+        uint32_t size;      // 0 while the slot is empty
+    };
+    struct Descriptor {
+        uint32_t letter = 0;
+        bool found = false;
+        lv_font_glyph_dsc_t dsc;
+    };
+
+    lv_font_t font_;
+    const lv_font_t* base_;
+    Bitmap* bitmaps_ = nullptr;     // Direct mapped by glyph index
+    uint8_t* bitmap_data_ = nullptr;    // One fixed size slot per bitmap
+    size_t bitmap_count_ = 0;
+    size_t bitmap_slot_size_ = 0;
+    Descriptor* descriptors_ = nullptr;    // Direct mapped by letter
+    size_t descriptor_count_ = 0;
+    uint32_t hits_ = 0;
+    uint32_t misses_ = 0;
+
+    static bool GetGlyphDsc(const lv_font_t* font, lv_font_glyph_dsc_t* dsc, uint32_t letter, uint32_t letter_next);
+    static const void* GetGlyphBitmap(lv_font_glyph_dsc_t* dsc, lv_draw_buf_t* draw_buf);
+    const void* LoadBitmap(lv_font_glyph_dsc_t* dsc, lv_draw_buf_t* draw_buf);
+};
+
+#endif // GLYPH_CACHE_H
@@ -10,6 +10,7 @@
 #include "assets/lang_config.h"
 #include <cstring>
 #include "settings.h"
+#include "tiled_image_decoder.h"
 
 #include "board.h"
 
@@ -67,11 +68,22 @@ const ThemeColors LIGHT_THEME = {
 
 LV_FONT_DECLARE(font_awesome_30_4);
 
+// Decoded glyph bitmaps kept for the text font in PSRAM, a 16px CJK glyph takes about 256 bytes
+#define GLYPH_CACHE_SIZE (256 * 1024)
+
 LcdDisplay::LcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel, DisplayFonts fonts, int width, int height)
     : panel_io_(panel_io), panel_(panel), fonts_(fonts) {
     width_ = width;
     height_ = height;
 
+#if CONFIG_SPIRAM
+    // Without PSRAM the glyphs are decoded on every draw, internal RAM is worth more elsewhere
+    if (fonts_.text_font != nullptr) {
+        glyph_cache_ = std::make_unique<GlyphCache>(fonts_.text_font, GLYPH_CACHE_SIZE);
+        fonts_.text_font = glyph_cache_->font();
+    }
+#endif
+
     // Load theme from settings
     Settings settings("display", false);
     current_theme_name_ = settings.GetString("theme", "light");
@@ -109,7 +121,7 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD display");
-    const lvgl_port_display_cfg_t display_cfg = {
+    lvgl_port_display_cfg_t display_cfg = {
         .io_handle = panel_io_,
         .panel_handle = panel_,
         .control_handle = nullptr,
@@ -134,6 +146,7 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
             .direct_mode = 0,
         },
     };
+    ConfigureRenderMode(display_cfg, false);
 
     display_ = lvgl_port_add_disp(&display_cfg);
     if (display_ == nullptr) {
@@ -229,7 +242,7 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD display");
-    const lvgl_port_display_cfg_t disp_cfg = {
+    lvgl_port_display_cfg_t disp_cfg = {
             .io_handle = panel_io,
             .panel_handle = panel,
             .control_handle = nullptr,
@@ -250,6 +263,7 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
             .sw_rotate = false,
         },
     };
+    ConfigureRenderMode(disp_cfg, true);
 
     const lvgl_port_display_dsi_cfg_t dpi_cfg = {
         .flags = {
@@ -269,7 +283,38 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
     SetupUI();
 }
 
+void LcdDisplay::ConfigureRenderMode(lvgl_port_display_cfg_t& cfg, bool allow_direct_mode) {
+#if CONFIG_LCD_RENDER_MODE_DOUBLE_BUFFER
+    // Render the next band while DMA sends the previous one. Each band gets an eighth of
+    // the largest free DMA block, at least the default 20 lines and at most a quarter screen
+    size_t line_size = width_ * sizeof(uint16_t);
+    size_t budget = heap_caps_get_largest_free_block(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL) / 8;
+    int lines = std::clamp<int>(budget / line_size, 20, std::max(20, height_ / 4));
+    cfg.buffer_size = width_ * lines;
+    cfg.double_buffer = true;
+    cfg.flags.buff_dma = 1;
+    cfg.flags.buff_spiram = 0;
+    ESP_LOGI(TAG, "Render mode: double buffered, %d lines per band", lines);
+#elif CONFIG_LCD_RENDER_MODE_PSRAM_FULL_FRAME
+    // Whole frame in PSRAM, LVGL renders every dirty area at once and flushes it in one go
+    cfg.buffer_size = width_ * height_;
+    cfg.double_buffer = false;
+    cfg.flags.buff_dma = 0;
+    cfg.flags.buff_spiram = 1;
+    if (allow_direct_mode) {
+        // Panels with their own frame buffer only take the dirty areas
+        cfg.flags.direct_mode = 1;
+        ESP_LOGI(TAG, "Render mode: PSRAM frame buffer, direct mode");
+    } else {
+        ESP_LOGI(TAG, "Render mode: PSRAM frame buffer");
+    }
+#else
+    ESP_LOGI(TAG, "Render mode: single buffer, %lu lines per band", cfg.buffer_size / width_);
+#endif
+}
+
 LcdDisplay::~LcdDisplay() {
+    StopUpdateTimer();
     // 然后再清理 LVGL 对象
     if (content_ != nullptr) {
         lv_obj_del(content_);
@@ -304,8 +349,18 @@ void LcdDisplay::Unlock() {
 }
 
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
+#if CONFIG_IDF_TARGET_ESP32P4
+#define  MAX_MESSAGES 40
+#define  MAX_MESSAGE_TEXT_SIZE 8192
+#else
+#define  MAX_MESSAGES 20
+#define  MAX_MESSAGE_TEXT_SIZE 4096
+#endif
+
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
+    StartUpdateTimer();
+    TiledImageDecoder::Register();
 
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
@@ -347,7 +402,18 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_flex_align(content_, LV_FLEX_ALIGN_START, LV_FLEX_ALIGN_START, LV_FLEX_ALIGN_START);
     lv_obj_set_style_pad_row(content_, 10, 0); // Space between messages
 
-    // We'll create chat messages dynamically in SetChatMessage
+    // Messages are kept as text in the history and shown in a pool of recycled rows,
+    // just enough of them to fill the chat area
+    chat_history_ = std::make_unique<ChatHistory>(MAX_MESSAGE_TEXT_SIZE, MAX_MESSAGES);
+    if (!chat_history_->valid()) {
+        // Without the history the chat area stays empty
+        chat_history_.reset();
+    }
+    int min_row_height = fonts_.text_font->line_height + 2 * 8 + 2 + 10;
+    max_message_slots_ = std::min<size_t>(MAX_MESSAGES, LV_VER_RES / min_row_height + 2);
+    lv_obj_add_event_cb(content_, [](lv_event_t* e) {
+        static_cast<LcdDisplay*>(lv_event_get_user_data(e))->OnChatScrolled();
+    }, LV_EVENT_SCROLL_END, this);
     chat_message_label_ = nullptr;
 
     /* Status bar */
@@ -413,192 +479,332 @@ void LcdDisplay::SetupUI() {
     lv_obj_center(low_battery_label_);
     lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
 }
-#if CONFIG_IDF_TARGET_ESP32P4
-#define  MAX_MESSAGES 40
-#else
-#define  MAX_MESSAGES 20
-#endif
+LcdDisplay::MessageSlot& LcdDisplay::AcquireMessageSlot(size_t index) {
+    if (index < message_slots_.size()) {
+        return message_slots_[index];
+    }
+    message_slots_.push_back(CreateMessageSlot());
+    return message_slots_.back();
+}
+
+LcdDisplay::MessageSlot LcdDisplay::CreateMessageSlot() {
+    // Every message sits in a full-width transparent row, so the bubble can be aligned inside it
+    MessageSlot slot;
+    slot.row = lv_obj_create(content_);
+    lv_obj_set_width(slot.row, LV_HOR_RES);
+    lv_obj_set_height(slot.row, LV_SIZE_CONTENT);
+    lv_obj_set_style_bg_opa(slot.row, LV_OPA_TRANSP, 0);
+    lv_obj_set_style_border_width(slot.row, 0, 0);
+    lv_obj_set_style_pad_all(slot.row, 0, 0);
+    lv_obj_set_scrollbar_mode(slot.row, LV_SCROLLBAR_MODE_OFF);
+
+    slot.bubble = lv_obj_create(slot.row);
+    lv_obj_set_style_radius(slot.bubble, 8, 0);
+    lv_obj_set_scrollbar_mode(slot.bubble, LV_SCROLLBAR_MODE_OFF);
+    lv_obj_set_style_border_width(slot.bubble, 1, 0);
+    lv_obj_set_style_pad_all(slot.bubble, 8, 0);
+    lv_obj_set_size(slot.bubble, LV_SIZE_CONTENT, LV_SIZE_CONTENT);
+
+    slot.label = lv_label_create(slot.bubble);
+    lv_label_set_long_mode(slot.label, LV_LABEL_LONG_WRAP);
+    lv_obj_set_style_text_font(slot.label, fonts_.text_font, 0);
+
+    slot.role = ChatHistory::kRoleSystem;
+    return slot;
+}
+
+void LcdDisplay::ApplyMessageStyle(MessageSlot& slot) {
+    lv_obj_set_style_border_color(slot.bubble, current_theme_.border, 0);
+    switch (slot.role) {
+        case ChatHistory::kRoleUser:
+            lv_obj_set_style_bg_color(slot.bubble, current_theme_.user_bubble, 0);
+            lv_obj_set_style_text_color(slot.label, current_theme_.text, 0);
+            break;
+        case ChatHistory::kRoleAssistant:
+            lv_obj_set_style_bg_color(slot.bubble, current_theme_.assistant_bubble, 0);
+            lv_obj_set_style_text_color(slot.label, current_theme_.text, 0);
+            break;
+        case ChatHistory::kRoleSystem:
+            lv_obj_set_style_bg_color(slot.bubble, current_theme_.system_bubble, 0);
+            lv_obj_set_style_text_color(slot.label, current_theme_.system_text, 0);
+            break;
+    }
+    if (slot.role == ChatHistory::kRoleUser) {
+        lv_obj_align(slot.bubble, LV_ALIGN_RIGHT_MID, -25, 0);
+    } else if (slot.role == ChatHistory::kRoleSystem) {
+        lv_obj_align(slot.bubble, LV_ALIGN_CENTER, 0, 0);
+    } else {
+        lv_obj_align(slot.bubble, LV_ALIGN_LEFT_MID, 0, 0);
+    }
+}
+
+void LcdDisplay::BindMessageSlot(MessageSlot& slot, uint32_t id) {
+    const char* content = chat_history_->text(id);
+
+    // 计算气泡宽度，不超过屏幕宽度的85%。宽度只测量一次，之后翻页或换主题时直接复用
+    lv_coord_t width = chat_history_->width(id);
+    if (width == 0) {
+        lv_coord_t text_width = lv_txt_get_width(content, strlen(content), fonts_.text_font, 0);
+        lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;
+        lv_coord_t min_width = 20;
+        width = std::clamp(text_width, min_width, max_width);
+        chat_history_->SetWidth(id, width);
+    }
+    // Resize before setting the text, so the label only breaks the new text into lines once
+    if (lv_obj_get_style_width(slot.label, LV_PART_MAIN) != width) {
+        lv_label_set_text_static(slot.label, "");
+        lv_obj_set_width(slot.label, width);
+    }
+    lv_label_set_text(slot.label, content);
+
+    slot.role = chat_history_->role(id);
+    ApplyMessageStyle(slot);
+    lv_obj_clear_flag(slot.row, LV_OBJ_FLAG_HIDDEN);
+}
+
+// Binds the rows to the messages starting at first_id, the rest of the rows are hidden
+void LcdDisplay::ShowMessages(uint32_t first_id) {
+    first_id = std::max(first_id, chat_history_->first_id());
+    size_t count = std::min<size_t>(max_message_slots_, chat_history_->end_id() - first_id);
+    for (size_t i = 0; i < count; i++) {
+        auto& slot = AcquireMessageSlot(i);
+        // Rows taken by SetChatMessage were moved to the end, put the children back in slot order
+        if (lv_obj_get_index(slot.row) != (int32_t)i) {
+            lv_obj_move_to_index(slot.row, i);
+        }
+        BindMessageSlot(slot, first_id + i);
+    }
+    for (size_t i = count; i < message_slots_.size(); i++) {
+        lv_obj_add_flag(message_slots_[i].row, LV_OBJ_FLAG_HIDDEN);
+    }
+    first_visible_id_ = first_id;
+    visible_messages_ = count;
+    follow_latest_ = first_id + count == chat_history_->end_id();
+    // The image preview and the message being spoken belong after the latest messages
+    if (image_bubble_ != nullptr) {
+        if (follow_latest_) {
+            lv_obj_move_to_index(image_bubble_, count - std::min(messages_since_image_, count));
+            lv_obj_clear_flag(image_bubble_, LV_OBJ_FLAG_HIDDEN);
+        } else {
+            lv_obj_add_flag(image_bubble_, LV_OBJ_FLAG_HIDDEN);
+        }
+    }
+    if (stream_active_) {
+        if (follow_latest_) {
+            lv_obj_move_to_index(stream_slot_.row, -1);
+            lv_obj_clear_flag(stream_slot_.row, LV_OBJ_FLAG_HIDDEN);
+        } else {
+            lv_obj_add_flag(stream_slot_.row, LV_OBJ_FLAG_HIDDEN);
+        }
+    }
+}
+
+void LcdDisplay::OnChatScrolled() {
+    // Page through the history when a scroll reaches either end of the rows
+    if (visible_messages_ == 0 || paging_) {
+        return;
+    }
+    uint32_t anchor_id;
+    if (lv_obj_get_scroll_top(content_) <= 0 && first_visible_id_ > chat_history_->first_id()) {
+        anchor_id = first_visible_id_;
+        ShowMessages(first_visible_id_ - max_message_slots_ / 2);
+    } else if (lv_obj_get_scroll_bottom(content_) <= 0 && !follow_latest_) {
+        anchor_id = first_visible_id_ + visible_messages_ - 1;
+        ShowMessages(first_visible_id_ + max_message_slots_ / 2);
+    } else {
+        return;
+    }
+    // Keep the message that was at the edge in view
+    if (anchor_id >= first_visible_id_ && anchor_id < first_visible_id_ + visible_messages_) {
+        paging_ = true;
+        lv_obj_update_layout(content_);
+        lv_obj_scroll_to_view(message_slots_[anchor_id - first_visible_id_].row, LV_ANIM_OFF);
+        paging_ = false;
+    }
+}
+
+static ChatHistory::Role ParseRole(const char* role) {
+    if (strcmp(role, "user") == 0) {
+        return ChatHistory::kRoleUser;
+    } else if (strcmp(role, "system") == 0) {
+        return ChatHistory::kRoleSystem;
+    }
+    return ChatHistory::kRoleAssistant;
+}
+
 void LcdDisplay::SetChatMessage(const char* role, const char* content) {
     DisplayLockGuard lock(this);
-    if (content_ == nullptr) {
+    if (content_ == nullptr || chat_history_ == nullptr) {
         return;
     }
     
     //避免出现空的消息框
     if(strlen(content) == 0) return;
-    
-    // 检查消息数量是否超过限制
-    uint32_t child_count = lv_obj_get_child_cnt(content_);
-    if (child_count >= MAX_MESSAGES) {
-        // 删除最早的消息（第一个子对象）
-        lv_obj_t* first_child = lv_obj_get_child(content_, 0);
-        lv_obj_t* last_child = lv_obj_get_child(content_, child_count - 1);
-        if (first_child != nullptr) {
-            lv_obj_del(first_child);
+
+    ChatHistory::Role message_role = ParseRole(role);
+
+    // 折叠系统消息：如果最后一条也是系统消息，则替换它
+    bool replace_last = message_role == ChatHistory::kRoleSystem && !chat_history_->empty()
+        && chat_history_->role(chat_history_->end_id() - 1) == ChatHistory::kRoleSystem;
+    if (replace_last) {
+        chat_history_->PopBack();
+    }
+    uint32_t id = chat_history_->Push(message_role, content);
+
+    MessageSlot* slot;
+    if (!follow_latest_) {
+        // The user scrolled back through the history, jump to the latest messages
+        ShowMessages(id + 1 - std::min<size_t>(max_message_slots_, id + 1 - chat_history_->first_id()));
+        slot = &message_slots_[visible_messages_ - 1];
+    } else if (replace_last && visible_messages_ > 0) {
+        slot = &message_slots_[visible_messages_ - 1];
+        BindMessageSlot(*slot, id);
+    } else if (visible_messages_ < max_message_slots_) {
+        slot = &AcquireMessageSlot(visible_messages_);
+        lv_obj_move_to_index(slot->row, -1);
+        visible_messages_++;
+        BindMessageSlot(*slot, id);
+    } else {
+        // Recycle the row of the oldest visible message for the new one
+        std::rotate(message_slots_.begin(), message_slots_.begin() + 1, message_slots_.begin() + visible_messages_);
+        slot = &message_slots_[visible_messages_ - 1];
+        lv_obj_move_to_index(slot->row, -1);
+        BindMessageSlot(*slot, id);
+    }
+    first_visible_id_ = id + 1 - visible_messages_;
+    follow_latest_ = true;
+
+    // 图片预览在被足够多的新消息推出屏幕后删除
+    if (image_bubble_ != nullptr && ++messages_since_image_ > max_message_slots_) {
+        lv_obj_del(image_bubble_);
+        image_bubble_ = nullptr;
+    }
+
+    lv_obj_scroll_to_view_recursive(slot->row, LV_ANIM_ON);
+
+    // Store reference to the latest message label
+    chat_message_label_ = slot->label;
+}
+
+static uint32_t DecodeUtf8(const char* text, size_t& pos) {
+    uint8_t c = text[pos++];
+    int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+    uint32_t letter = extra == 0 ? c : c & (0x3F >> extra);
+    for (; extra > 0 && (text[pos] & 0xC0) == 0x80; extra--) {
+        letter = (letter << 6) | (text[pos++] & 0x3F);
+    }
+    return letter;
+}
+
+void LcdDisplay::StartStreamingMessage(ChatHistory::Role role, const char* content) {
+    if (stream_slot_.row == nullptr) {
+        stream_slot_ = CreateMessageSlot();
+        lv_label_set_long_mode(stream_slot_.label, LV_LABEL_LONG_CLIP);
+        stream_lines_.push_back(stream_slot_.label);
+    }
+
+    // Break the lines the way the bubble label would, wrapping words of Latin text
+    const lv_font_t* font = fonts_.text_font;
+    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;
+    lv_coord_t widest = 0, line_width = 0, word_start_width = 0;
+    size_t word_start = 0;
+    stream_breaks_.assign(1, 0);
+    size_t pos = 0;
+    while (content[pos] != '\0') {
+        size_t start = pos;
+        uint32_t letter = DecodeUtf8(content, pos);
+        if (letter == '\n') {
+            widest = std::max(widest, line_width);
+            stream_breaks_.push_back(pos);
+            line_width = 0;
+            continue;
+        }
+        lv_coord_t letter_width = lv_font_get_glyph_width(font, letter, 0);
+        if (line_width + letter_width > max_width && start > stream_breaks_.back()) {
+            if (letter != ' ' && letter < 0x80 && word_start > stream_breaks_.back()) {
+                widest = std::max(widest, word_start_width);
+                line_width -= word_start_width;
+                stream_breaks_.push_back(word_start);
+            } else {
+                widest = std::max(widest, line_width);
+                line_width = 0;
+                stream_breaks_.push_back(start);
+            }
         }
-        // Scroll to the last message immediately
-        if (last_child != nullptr) {
-            lv_obj_scroll_to_view_recursive(last_child, LV_ANIM_OFF);
+        line_width += letter_width;
+        if (letter == ' ' || letter >= 0x80) {
+            word_start = pos;
+            word_start_width = line_width;
         }
     }
-    
-    // 折叠系统消息（如果是系统消息，检查最后一个消息是否也是系统消息）
-    if (strcmp(role, "system") == 0 && child_count > 0) {
-        // 获取最后一个消息容器
-        lv_obj_t* last_container = lv_obj_get_child(content_, child_count - 1);
-        if (last_container != nullptr && lv_obj_get_child_cnt(last_container) > 0) {
-            // 获取容器内的气泡
-            lv_obj_t* last_bubble = lv_obj_get_child(last_container, 0);
-            if (last_bubble != nullptr) {
-                // 检查气泡类型是否为系统消息
-                void* bubble_type_ptr = lv_obj_get_user_data(last_bubble);
-                if (bubble_type_ptr != nullptr && strcmp((const char*)bubble_type_ptr, "system") == 0) {
-                    // 如果最后一个消息也是系统消息，则删除它
-                    lv_obj_del(last_container);
-                }
-            }
+    widest = std::max(widest, line_width);
+    stream_breaks_.push_back(pos);
+
+    // Every line gets a fixed size label, so the bubble has its final size from the start
+    lv_coord_t width = std::clamp<lv_coord_t>(widest, 20, max_width);
+    lv_coord_t line_height = lv_font_get_line_height(font);
+    size_t lines = stream_breaks_.size() - 1;
+    stream_slot_.role = role;
+    ApplyMessageStyle(stream_slot_);
+    lv_color_t text_color = lv_obj_get_style_text_color(stream_slot_.label, LV_PART_MAIN);
+    for (size_t i = 0; i < std::max(lines, stream_lines_.size()); i++) {
+        if (i == stream_lines_.size()) {
+            auto line = lv_label_create(stream_slot_.bubble);
+            lv_label_set_long_mode(line, LV_LABEL_LONG_CLIP);
+            lv_obj_set_style_text_font(line, font, 0);
+            stream_lines_.push_back(line);
+        }
+        auto line = stream_lines_[i];
+        if (i >= lines) {
+            lv_obj_add_flag(line, LV_OBJ_FLAG_HIDDEN);
+            continue;
         }
+        lv_obj_set_style_text_color(line, text_color, 0);
+        lv_label_set_text_static(line, "");
+        lv_obj_set_size(line, width, line_height);
+        lv_obj_set_pos(line, 0, i * line_height);
+        lv_obj_clear_flag(line, LV_OBJ_FLAG_HIDDEN);
     }
-    
-    // Create a message bubble
-    lv_obj_t* msg_bubble = lv_obj_create(content_);
-    lv_obj_set_style_radius(msg_bubble, 8, 0);
-    lv_obj_set_scrollbar_mode(msg_bubble, LV_SCROLLBAR_MODE_OFF);
-    lv_obj_set_style_border_width(msg_bubble, 1, 0);
-    lv_obj_set_style_border_color(msg_bubble, current_theme_.border, 0);
-    lv_obj_set_style_pad_all(msg_bubble, 8, 0);
-
-    // Create the message text
-    lv_obj_t* msg_text = lv_label_create(msg_bubble);
-    lv_label_set_text(msg_text, content);
-    
-    // 计算文本实际宽度
-    lv_coord_t text_width = lv_txt_get_width(content, strlen(content), fonts_.text_font, 0);
+    stream_shown_ = 0;
+    stream_active_ = true;
 
-    // 计算气泡宽度
-    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;  // 屏幕宽度的85%
-    lv_coord_t min_width = 20;  
-    lv_coord_t bubble_width;
-    
-    // 确保文本宽度不小于最小宽度
-    if (text_width < min_width) {
-        text_width = min_width;
+    if (!follow_latest_) {
+        ShowMessages(chat_history_->end_id() - std::min<size_t>(max_message_slots_, chat_history_->end_id() - chat_history_->first_id()));
     }
+    lv_obj_move_to_index(stream_slot_.row, -1);
+    lv_obj_clear_flag(stream_slot_.row, LV_OBJ_FLAG_HIDDEN);
+    lv_obj_scroll_to_view_recursive(stream_slot_.row, LV_ANIM_ON);
+}
 
-    // 如果文本宽度小于最大宽度，使用文本宽度
-    if (text_width < max_width) {
-        bubble_width = text_width; 
-    } else {
-        bubble_width = max_width;
+void LcdDisplay::SetStreamingMessage(const char* role, const char* content, size_t visible_length) {
+    DisplayLockGuard lock(this);
+    if (content_ == nullptr || chat_history_ == nullptr) {
+        return;
     }
-    
-    // 设置消息文本的宽度
-    lv_obj_set_width(msg_text, bubble_width);  // 减去padding
-    lv_label_set_long_mode(msg_text, LV_LABEL_LONG_WRAP);
-    lv_obj_set_style_text_font(msg_text, fonts_.text_font, 0);
-
-    // 设置气泡宽度
-    lv_obj_set_width(msg_bubble, bubble_width);
-    lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
 
-    // Set alignment and style based on message role
-    if (strcmp(role, "user") == 0) {
-        // User messages are right-aligned with green background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.user_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.text, 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"user");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    } else if (strcmp(role, "assistant") == 0) {
-        // Assistant messages are left-aligned with white background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.assistant_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.text, 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"assistant");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    } else if (strcmp(role, "system") == 0) {
-        // System messages are center-aligned with light gray background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.system_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.system_text, 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"system");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
+    if (visible_length >= strlen(content)) {
+        // Fully spoken, from now on it is an ordinary message in the history
+        if (stream_active_) {
+            stream_active_ = false;
+            lv_obj_add_flag(stream_slot_.row, LV_OBJ_FLAG_HIDDEN);
+        }
+        SetChatMessage(role, content);
+        return;
+    }
+    if (visible_length == 0 || !stream_active_) {
+        StartStreamingMessage(ParseRole(role), content);
     }
-    
-    // Create a full-width container for user messages to ensure right alignment
-    if (strcmp(role, "user") == 0) {
-        // Create a full-width container
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // Make container transparent and borderless
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // Move the message bubble into this container
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // Right align the bubble in the container
-        lv_obj_align(msg_bubble, LV_ALIGN_RIGHT_MID, -25, 0);
-        
-        // Auto-scroll to this container
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
-    } else if (strcmp(role, "system") == 0) {
-        // 为系统消息创建全宽容器以确保居中对齐
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // 使容器透明且无边框
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // 将消息气泡移入此容器
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // 将气泡居中对齐在容器中
-        lv_obj_align(msg_bubble, LV_ALIGN_CENTER, 0, 0);
-        
-        // 自动滚动底部
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
-    } else {
-        // For assistant messages
-        // Left align assistant messages
-        lv_obj_align(msg_bubble, LV_ALIGN_LEFT_MID, 0, 0);
 
-        // Auto-scroll to the message bubble
-        lv_obj_scroll_to_view_recursive(msg_bubble, LV_ANIM_ON);
+    // Only the lines the new text falls on are touched
+    for (size_t i = 0; i + 1 < stream_breaks_.size(); i++) {
+        size_t start = stream_breaks_[i];
+        size_t end = std::min(stream_breaks_[i + 1], visible_length);
+        if (stream_breaks_[i + 1] <= stream_shown_ || start >= end) {
+            continue;
+        }
+        lv_label_set_text(stream_lines_[i], std::string(content + start, end - start).c_str());
     }
-    
-    // Store reference to the latest message label
-    chat_message_label_ = msg_text;
+    stream_shown_ = visible_length;
 }
 
 void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
@@ -608,7 +814,25 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
     }
     
     if (img_dsc != nullptr) {
+        // A live camera view sends frames of the same size, refresh the newest bubble in place
+        if (image_bubble_ != nullptr && messages_since_image_ == 0) {
+            lv_obj_t* image = lv_obj_get_child(image_bubble_, 0);
+            auto shown = image != nullptr ? (const lv_img_dsc_t*)lv_image_get_src(image) : nullptr;
+            if (shown != nullptr && shown->header.w == img_dsc->header.w && shown->header.h == img_dsc->header.h
+                && shown->data_size == img_dsc->data_size) {
+                memcpy((void*)shown->data, img_dsc->data, img_dsc->data_size);
+                lv_image_cache_drop(shown);
+                lv_obj_invalidate(image);
+                return;
+            }
+        }
+
         // Create a message bubble for image preview
+        // Only the latest image is kept
+        if (image_bubble_ != nullptr) {
+            lv_obj_del(image_bubble_);
+            image_bubble_ = nullptr;
+        }
         lv_obj_t* img_bubble = lv_obj_create(content_);
         lv_obj_set_style_radius(img_bubble, 8, 0);
         lv_obj_set_scrollbar_mode(img_bubble, LV_SCROLLBAR_MODE_OFF);
@@ -700,11 +924,15 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
 
         // Auto-scroll to the image bubble
         lv_obj_scroll_to_view_recursive(img_bubble, LV_ANIM_ON);
+        image_bubble_ = img_bubble;
+        messages_since_image_ = 0;
     }
 }
 #else
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
+    StartUpdateTimer();
+    TiledImageDecoder::Register();
 
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
@@ -817,7 +1045,10 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
         // zoom factor 0.5
         lv_image_set_scale(preview_image_, 128 * width_ / img_dsc->header.w);
         // 设置图片源并显示预览图片
+        // The same image may come back with new pixels while streaming
+        lv_image_cache_drop(img_dsc);
         lv_image_set_src(preview_image_, img_dsc);
+        lv_obj_invalidate(preview_image_);
         lv_obj_clear_flag(preview_image_, LV_OBJ_FLAG_HIDDEN);
         // 隐藏emotion_label_
         if (emotion_label_ != nullptr) {
@@ -964,123 +1195,21 @@ void LcdDisplay::SetTheme(const std::string& theme_name) {
         lv_obj_set_style_bg_color(content_, current_theme_.chat_background, 0);
         lv_obj_set_style_border_color(content_, current_theme_.border, 0);
         
-        // If we have the chat message style, update all message bubbles
+        // If we have the chat message style, update the visible message rows
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
-        // Iterate through all children of content (message containers or bubbles)
-        uint32_t child_count = lv_obj_get_child_cnt(content_);
-        for (uint32_t i = 0; i < child_count; i++) {
-            lv_obj_t* obj = lv_obj_get_child(content_, i);
-            if (obj == nullptr) continue;
-            
-            lv_obj_t* bubble = nullptr;
-            
-            // 检查这个对象是容器还是气泡
-            // 如果是容器（用户或系统消息），则获取其子对象作为气泡
-            // 如果是气泡（助手消息），则直接使用
-            if (lv_obj_get_child_cnt(obj) > 0) {
-                // 可能是容器，检查它是否为用户或系统消息容器
-                // 用户和系统消息容器是透明的
-                lv_opa_t bg_opa = lv_obj_get_style_bg_opa(obj, 0);
-                if (bg_opa == LV_OPA_TRANSP) {
-                    // 这是用户或系统消息的容器
-                    bubble = lv_obj_get_child(obj, 0);
-                } else {
-                    // 这可能是助手消息的气泡自身
-                    bubble = obj;
-                }
-            } else {
-                // 没有子元素，可能是其他UI元素，跳过
-                continue;
-            }
-            
-            if (bubble == nullptr) continue;
-            
-            // 使用保存的用户数据来识别气泡类型
-            void* bubble_type_ptr = lv_obj_get_user_data(bubble);
-            if (bubble_type_ptr != nullptr) {
-                const char* bubble_type = static_cast<const char*>(bubble_type_ptr);
-                
-                // 根据气泡类型应用正确的颜色
-                if (strcmp(bubble_type, "user") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.user_bubble, 0);
-                } else if (strcmp(bubble_type, "assistant") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.assistant_bubble, 0); 
-                } else if (strcmp(bubble_type, "system") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                } else if (strcmp(bubble_type, "image") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                }
-                
-                // Update border color
-                lv_obj_set_style_border_color(bubble, current_theme_.border, 0);
-                
-                // Update text color for the message
-                if (lv_obj_get_child_cnt(bubble) > 0) {
-                    lv_obj_t* text = lv_obj_get_child(bubble, 0);
-                    if (text != nullptr) {
-                        // 根据气泡类型设置文本颜色
-                        if (strcmp(bubble_type, "system") == 0) {
-                            lv_obj_set_style_text_color(text, current_theme_.system_text, 0);
-                        } else {
-                            lv_obj_set_style_text_color(text, current_theme_.text, 0);
-                        }
-                    }
-                }
-            } else {
-                // 如果没有标记，回退到之前的逻辑（颜色比较）
-                // ...保留原有的回退逻辑...
-                lv_color_t bg_color = lv_obj_get_style_bg_color(bubble, 0);
-            
-                // 改进bubble类型检测逻辑，不仅使用颜色比较
-                bool is_user_bubble = false;
-                bool is_assistant_bubble = false;
-                bool is_system_bubble = false;
-            
-                // 检查用户bubble
-                if (lv_color_eq(bg_color, DARK_USER_BUBBLE_COLOR) || 
-                    lv_color_eq(bg_color, LIGHT_USER_BUBBLE_COLOR) ||
-                    lv_color_eq(bg_color, current_theme_.user_bubble)) {
-                    is_user_bubble = true;
-                }
-                // 检查系统bubble
-                else if (lv_color_eq(bg_color, DARK_SYSTEM_BUBBLE_COLOR) || 
-                         lv_color_eq(bg_color, LIGHT_SYSTEM_BUBBLE_COLOR) ||
-                         lv_color_eq(bg_color, current_theme_.system_bubble)) {
-                    is_system_bubble = true;
-                }
-                // 剩余的都当作助手bubble处理
-                else {
-                    is_assistant_bubble = true;
-                }
-            
-                // 根据bubble类型应用正确的颜色
-                if (is_user_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.user_bubble, 0);
-                } else if (is_assistant_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.assistant_bubble, 0);
-                } else if (is_system_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                }
-                
-                // Update border color
-                lv_obj_set_style_border_color(bubble, current_theme_.border, 0);
-                
-                // Update text color for the message
-                if (lv_obj_get_child_cnt(bubble) > 0) {
-                    lv_obj_t* text = lv_obj_get_child(bubble, 0);
-                    if (text != nullptr) {
-                        // 回退到颜色检测逻辑
-                        if (lv_color_eq(bg_color, current_theme_.system_bubble) ||
-                            lv_color_eq(bg_color, DARK_SYSTEM_BUBBLE_COLOR) || 
-                            lv_color_eq(bg_color, LIGHT_SYSTEM_BUBBLE_COLOR)) {
-                            lv_obj_set_style_text_color(text, current_theme_.system_text, 0);
-                        } else {
-                            lv_obj_set_style_text_color(text, current_theme_.text, 0);
-                        }
-                    }
-                }
+        for (auto& slot : message_slots_) {
+            ApplyMessageStyle(slot);
+        }
+        if (stream_slot_.row != nullptr) {
+            ApplyMessageStyle(stream_slot_);
+            for (auto line : stream_lines_) {
+                lv_obj_set_style_text_color(line, lv_obj_get_style_text_color(stream_slot_.label, LV_PART_MAIN), 0);
             }
         }
+        if (image_bubble_ != nullptr) {
+            lv_obj_set_style_bg_color(image_bubble_, current_theme_.system_bubble, 0);
+            lv_obj_set_style_border_color(image_bubble_, current_theme_.border, 0);
+        }
 #else
         // Simple UI mode - just update the main chat message
         if (chat_message_label_ != nullptr) {
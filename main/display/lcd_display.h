@@ -5,9 +5,15 @@
 
 #include <esp_lcd_panel_io.h>
 #include <esp_lcd_panel_ops.h>
+#include <esp_lvgl_port.h>
 #include <font_emoji.h>
 
 #include <atomic>
+#include <memory>
+#include <vector>
+
+#include "chat_history.h"
+#include "glyph_cache.h"
 
 // Theme color structure
 struct ThemeColors {
@@ -35,10 +41,48 @@ protected:
     lv_obj_t* side_bar_ = nullptr;
     lv_obj_t* preview_image_ = nullptr;
 
+    std::unique_ptr<GlyphCache> glyph_cache_;   // Wraps fonts_.text_font
     DisplayFonts fonts_;
     ThemeColors current_theme_;
 
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    // A row showing one message, rows are recycled instead of created per message
+    struct MessageSlot {
+        lv_obj_t* row;
+        lv_obj_t* bubble;
+        lv_obj_t* label;
+        ChatHistory::Role role;
+    };
+    std::unique_ptr<ChatHistory> chat_history_;
+    std::vector<MessageSlot> message_slots_;    // In display order
+    size_t max_message_slots_ = 0;
+    size_t visible_messages_ = 0;
+    uint32_t first_visible_id_ = 0;
+    bool follow_latest_ = true;
+    bool paging_ = false;
+    lv_obj_t* image_bubble_ = nullptr;
+    size_t messages_since_image_ = 0;
+
+    // The message being revealed along with speech. It is drawn one label per line, laid
+    // out for the whole text up front, so adding text only invalidates the line it lands on
+    MessageSlot stream_slot_ = {};
+    std::vector<lv_obj_t*> stream_lines_;
+    std::vector<size_t> stream_breaks_;     // Start of every line, then the end of the text
+    size_t stream_shown_ = 0;
+    bool stream_active_ = false;
+
+    MessageSlot CreateMessageSlot();
+    MessageSlot& AcquireMessageSlot(size_t index);
+    void BindMessageSlot(MessageSlot& slot, uint32_t id);
+    void ApplyMessageStyle(MessageSlot& slot);
+    void ShowMessages(uint32_t first_id);
+    void OnChatScrolled();
+    void StartStreamingMessage(ChatHistory::Role role, const char* content);
+#endif
+
     void SetupUI();
+    // Sizes the LVGL draw buffers for CONFIG_LCD_RENDER_MODE_*
+    void ConfigureRenderMode(lvgl_port_display_cfg_t& cfg, bool allow_direct_mode);
     virtual bool Lock(int timeout_ms = 0) override;
     virtual void Unlock() override;
 
@@ -53,6 +97,7 @@ public:
     virtual void SetPreviewImage(const lv_img_dsc_t* img_dsc) override;
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
     virtual void SetChatMessage(const char* role, const char* content) override; 
+    virtual void SetStreamingMessage(const char* role, const char* content, size_t visible_length) override;
 #endif  
 
     // Add theme switching function
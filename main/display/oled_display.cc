@@ -64,6 +64,7 @@ OledDisplay::OledDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handl
 }
 
 OledDisplay::~OledDisplay() {
+    StopUpdateTimer();
     if (content_ != nullptr) {
         lv_obj_del(content_);
     }
@@ -118,6 +119,7 @@ void OledDisplay::SetChatMessage(const char* role, const char* content) {
 
 void OledDisplay::SetupUI_128x64() {
     DisplayLockGuard lock(this);
+    StartUpdateTimer();
 
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
@@ -227,6 +229,7 @@ void OledDisplay::SetupUI_128x64() {
 
 void OledDisplay::SetupUI_128x32() {
     DisplayLockGuard lock(this);
+    StartUpdateTimer();
 
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
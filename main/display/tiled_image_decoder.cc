@@ -0,0 +1,168 @@
+#include "tiled_image_decoder.h"
+
+#include <esp_log.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "TiledImageDecoder"
+
+// "TRLE", rows per strip, strip count, then strip_count + 1 offsets from the start of the data
+#define TILED_RLE_MAGIC "TRLE"
+#define TILED_RLE_HEADER_SIZE 8
+
+static uint32_t ReadU32(const uint8_t* data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static uint16_t ReadU16(const uint8_t* data) {
+    uint16_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static const lv_image_dsc_t* GetTiledImage(const lv_image_decoder_dsc_t* dsc) {
+    if (dsc->src_type != LV_IMAGE_SRC_VARIABLE) {
+        return nullptr;
+    }
+    auto image = static_cast<const lv_image_dsc_t*>(dsc->src);
+    if ((image->header.flags & LV_IMAGE_FLAGS_USER1) == 0 || image->data_size < TILED_RLE_HEADER_SIZE
+        || memcmp(image->data, TILED_RLE_MAGIC, 4) != 0) {
+        return nullptr;
+    }
+    uint16_t strip_count = ReadU16(image->data + 6);
+    if (image->data_size < TILED_RLE_HEADER_SIZE + (strip_count + 1) * sizeof(uint32_t)
+        || lv_color_format_get_size((lv_color_format_t)image->header.cf) == 0) {
+        return nullptr;
+    }
+    return image;
+}
+
+void TiledImageDecoder::Register() {
+    static bool registered = false;
+    if (registered) {
+        return;
+    }
+    registered = true;
+
+    // Decoders created last are asked first, so this one sees its images before the built-in ones
+    auto decoder = lv_image_decoder_create();
+    lv_image_decoder_set_info_cb(decoder, Info);
+    lv_image_decoder_set_open_cb(decoder, Open);
+    lv_image_decoder_set_get_area_cb(decoder, GetArea);
+    lv_image_decoder_set_close_cb(decoder, Close);
+}
+
+lv_result_t TiledImageDecoder::Info(lv_image_decoder_t* decoder, lv_image_decoder_dsc_t* dsc, lv_image_header_t* header) {
+    auto image = GetTiledImage(dsc);
+    if (image == nullptr) {
+        return LV_RESULT_INVALID;
+    }
+    *header = image->header;
+    return LV_RESULT_OK;
+}
+
+lv_result_t TiledImageDecoder::Open(lv_image_decoder_t* decoder, lv_image_decoder_dsc_t* dsc) {
+    auto image = GetTiledImage(dsc);
+    if (image == nullptr) {
+        return LV_RESULT_INVALID;
+    }
+
+    auto context = new Context();
+    context->data = image->data;
+    context->strip_rows = ReadU16(image->data + 4);
+    context->strip_count = ReadU16(image->data + 6);
+    context->pixel_size = lv_color_format_get_size((lv_color_format_t)image->header.cf);
+    context->strip = lv_draw_buf_create(image->header.w, context->strip_rows,
+        (lv_color_format_t)image->header.cf, LV_STRIDE_AUTO);
+    if (context->strip == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate a %dx%d strip", image->header.w, context->strip_rows);
+        delete context;
+        return LV_RESULT_INVALID;
+    }
+    dsc->user_data = context;
+    // Leaving decoded empty makes LVGL draw the image piece by piece through GetArea
+    dsc->decoded = nullptr;
+    return LV_RESULT_OK;
+}
+
+lv_result_t TiledImageDecoder::GetArea(lv_image_decoder_t* decoder, lv_image_decoder_dsc_t* dsc,
+    const lv_area_t* full_area, lv_area_t* decoded_area) {
+    auto& context = *static_cast<Context*>(dsc->user_data);
+    int width = dsc->header.w;
+    int height = dsc->header.h;
+
+    // Start with the strip holding the first requested row, then walk down one strip per call
+    int strip = decoded_area->y1 == LV_COORD_MIN ? full_area->y1 / context.strip_rows
+        : decoded_area->y1 / context.strip_rows + 1;
+    int y1 = strip * context.strip_rows;
+    if (strip >= context.strip_count || y1 > full_area->y2 || y1 >= height) {
+        return LV_RESULT_INVALID;
+    }
+    int rows = std::min<int>(context.strip_rows, height - y1);
+    DecodeStrip(context, width, strip, rows);
+
+    context.strip->header.h = rows;
+    dsc->decoded = context.strip;
+    decoded_area->x1 = 0;
+    decoded_area->x2 = width - 1;
+    decoded_area->y1 = y1;
+    decoded_area->y2 = y1 + rows - 1;
+    return LV_RESULT_OK;
+}
+
+void TiledImageDecoder::DecodeStrip(Context& context, int width, int strip, int rows) {
+    // Same RLE as LVGL's converter: a control byte with the top bit set is followed by that
+    // many literal pixels, otherwise by one pixel repeated that many times
+    const uint8_t* offsets = context.data + TILED_RLE_HEADER_SIZE;
+    const uint8_t* in = context.data + ReadU32(offsets + strip * sizeof(uint32_t));
+    const uint8_t* end = context.data + ReadU32(offsets + (strip + 1) * sizeof(uint32_t));
+    const uint32_t pixel_size = context.pixel_size;
+    const uint32_t stride = context.strip->header.stride;
+    uint8_t* row = context.strip->data;
+    int x = 0, y = 0;
+
+    while (in < end && y < rows) {
+        uint8_t control = *in++;
+        int count = control & 0x7F;
+        bool literal = (control & 0x80) != 0;
+        if (!literal && in + pixel_size > end) {
+            break;
+        }
+        while (count > 0 && y < rows) {
+            int run = std::min(count, width - x);
+            uint8_t* out = row + x * pixel_size;
+            if (literal) {
+                size_t bytes = std::min<size_t>(run * pixel_size, end - in);
+                memcpy(out, in, bytes);
+                in += bytes;
+            } else {
+                for (int i = 0; i < run; i++) {
+                    memcpy(out + i * pixel_size, in, pixel_size);
+                }
+            }
+            count -= run;
+            x += run;
+            if (x == width) {
+                x = 0;
+                y++;
+                row += stride;
+            }
+        }
+        if (!literal) {
+            in += pixel_size;
+        }
+    }
+}
+
+void TiledImageDecoder::Close(lv_image_decoder_t* decoder, lv_image_decoder_dsc_t* dsc) {
+    auto context = static_cast<Context*>(dsc->user_data);
+    if (context == nullptr) {
+        return;
+    }
+    lv_draw_buf_destroy(context->strip);
+    delete context;
+    dsc->user_data = nullptr;
+    dsc->decoded = nullptr;
+}
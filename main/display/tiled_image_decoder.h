@@ -0,0 +1,33 @@
+#ifndef TILED_IMAGE_DECODER_H
+#define TILED_IMAGE_DECODER_H
+
+#include <lvgl.h>
+
+// LVGL image decoder for C array images written by scripts/Image_Converter/LVGLImage.py
+// with --compress TILED_RLE. The pixels are stored as RLE compressed strips of rows with
+// an offset table, so drawing part of an image only reads and expands the strips it
+// covers, one strip at a time straight into a small draw buffer. Nothing is decompressed
+// up front and the full image never exists in RAM.
+class TiledImageDecoder {
+public:
+    // Call once with the display locked, later calls do nothing
+    static void Register();
+
+private:
+    struct Context {
+        const uint8_t* data;
+        uint16_t strip_rows;
+        uint16_t strip_count;
+        uint32_t pixel_size;
+        lv_draw_buf_t* strip;
+    };
+
+    static lv_result_t Info(lv_image_decoder_t* decoder, lv_image_decoder_dsc_t* dsc, lv_image_header_t* header);
+    static lv_result_t Open(lv_image_decoder_t* decoder, lv_image_decoder_dsc_t* dsc);
+    static lv_result_t GetArea(lv_image_decoder_t* decoder, lv_image_decoder_dsc_t* dsc,
+        const lv_area_t* full_area, lv_area_t* decoded_area);
+    static void Close(lv_image_decoder_t* decoder, lv_image_decoder_dsc_t* dsc);
+    static void DecodeStrip(Context& context, int width, int strip, int rows);
+};
+
+#endif // TILED_IMAGE_DECODER_H
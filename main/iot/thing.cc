@@ -35,21 +35,40 @@ Thing* CreateThing(const std::string& type) {
 }
 
 std::string Thing::GetDescriptorJson() {
-    std::string json_str = "{";
-    json_str += "\"name\":\"" + name_ + "\",";
-    json_str += "\"description\":\"" + description_ + "\",";
-    json_str += "\"properties\":" + properties_.GetDescriptorJson() + ",";
-    json_str += "\"methods\":" + methods_.GetDescriptorJson();
-    json_str += "}";
-    return json_str;
+    std::string json;
+    JsonWriter writer(json);
+    WriteDescriptor(writer);
+    return json;
+}
+
+void Thing::WriteDescriptor(JsonWriter& writer) {
+    writer.BeginObject()
+        .Field("name", name_)
+        .Field("description", description_)
+        .Key("properties");
+    properties_.WriteDescriptor(writer);
+    writer.Key("methods");
+    methods_.WriteDescriptor(writer);
+    writer.EndObject();
 }
 
 std::string Thing::GetStateJson() {
-    std::string json_str = "{";
-    json_str += "\"name\":\"" + name_ + "\",";
-    json_str += "\"state\":" + properties_.GetStateJson();
-    json_str += "}";
-    return json_str;
+    std::string json;
+    JsonWriter writer(json);
+    writer.BeginObject().Field("name", name_).Key("state");
+    properties_.WriteState(writer);
+    writer.EndObject();
+    return json;
+}
+
+bool Thing::WriteChangedState(JsonWriter& writer, uint32_t version, uint32_t since_version) {
+    if (!properties_.Refresh(version, since_version)) {
+        return false;
+    }
+    writer.BeginObject().Field("name", name_).Key("state");
+    properties_.WriteChangedState(writer, since_version);
+    writer.EndObject();
+    return true;
 }
 
 void Thing::Invoke(const cJSON* command) {
@@ -8,6 +8,8 @@
 #include <stdexcept>
 #include <cJSON.h>
 
+#include "json_writer.h"
+
 namespace iot {
 
 enum ValueType {
@@ -16,6 +18,14 @@ enum ValueType {
     kValueTypeString
 };
 
+inline const char* ValueTypeName(ValueType type) {
+    switch (type) {
+        case kValueTypeBoolean: return "boolean";
+        case kValueTypeNumber: return "number";
+        default: return "string";
+    }
+}
+
 class Property {
 private:
     std::string name_;
@@ -25,6 +35,13 @@ private:
     std::function<int()> number_getter_;
     std::function<std::string()> string_getter_;
 
+    // 最近一次读到的值，值变化时记录当时的状态版本
+    bool observed_ = false;
+    bool last_boolean_ = false;
+    int last_number_ = 0;
+    std::string last_string_;
+    uint32_t version_ = 0;
+
 public:
     Property(const std::string& name, const std::string& description, std::function<bool()> getter) :
         name_(name), description_(description), type_(kValueTypeBoolean), boolean_getter_(getter) {}
@@ -41,29 +58,58 @@ public:
     int number() const { return number_getter_(); }
     std::string string() const { return string_getter_(); }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
-        json_str += "\"description\":\"" + description_ + "\",";
+    void WriteDescriptor(JsonWriter& writer) const {
+        writer.BeginObject().Field("description", description_).Field("type", ValueTypeName(type_)).EndObject();
+    }
+
+    void WriteState(JsonWriter& writer) const {
+        if (type_ == kValueTypeBoolean) {
+            writer.Bool(boolean_getter_());
+        } else if (type_ == kValueTypeNumber) {
+            writer.Int(number_getter_());
+        } else if (type_ == kValueTypeString) {
+            writer.String(string_getter_());
+        } else {
+            writer.Null();
+        }
+    }
+
+    // 读取当前值，与上次不同时把版本更新为 version
+    bool Refresh(uint32_t version) {
+        bool changed = !observed_;
         if (type_ == kValueTypeBoolean) {
-            json_str += "\"type\":\"boolean\"";
+            bool value = boolean_getter_();
+            changed = changed || value != last_boolean_;
+            last_boolean_ = value;
         } else if (type_ == kValueTypeNumber) {
-            json_str += "\"type\":\"number\"";
+            int value = number_getter_();
+            changed = changed || value != last_number_;
+            last_number_ = value;
         } else if (type_ == kValueTypeString) {
-            json_str += "\"type\":\"string\"";
+            std::string value = string_getter_();
+            changed = changed || value != last_string_;
+            last_string_ = std::move(value);
+        }
+        observed_ = true;
+        if (changed) {
+            version_ = version;
         }
-        json_str += "}";
-        return json_str;
+        return changed;
     }
 
-    std::string GetStateJson() {
+    uint32_t version() const { return version_; }
+
+    // 写入 Refresh 读到的值
+    void WriteLastState(JsonWriter& writer) const {
         if (type_ == kValueTypeBoolean) {
-            return boolean_getter_() ? "true" : "false";
+            writer.Bool(last_boolean_);
         } else if (type_ == kValueTypeNumber) {
-            return std::to_string(number_getter_());
+            writer.Int(last_number_);
         } else if (type_ == kValueTypeString) {
-            return "\"" + string_getter_() + "\"";
+            writer.String(last_string_);
+        } else {
+            writer.Null();
         }
-        return "null";
     }
 };
 
@@ -94,28 +140,44 @@ public:
         throw std::runtime_error("Property not found: " + name);
     }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
+    void WriteDescriptor(JsonWriter& writer) const {
+        writer.BeginObject();
         for (auto& property : properties_) {
-            json_str += "\"" + property.name() + "\":" + property.GetDescriptorJson() + ",";
+            writer.Key(property.name());
+            property.WriteDescriptor(writer);
         }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
+        writer.EndObject();
+    }
+
+    void WriteState(JsonWriter& writer) const {
+        writer.BeginObject();
+        for (auto& property : properties_) {
+            writer.Key(property.name());
+            property.WriteState(writer);
         }
-        json_str += "}";
-        return json_str;
+        writer.EndObject();
     }
 
-    std::string GetStateJson() {
-        std::string json_str = "{";
+    // 刷新所有属性，返回是否有属性的版本比 since_version 新
+    bool Refresh(uint32_t version, uint32_t since_version) {
+        bool changed = false;
         for (auto& property : properties_) {
-            json_str += "\"" + property.name() + "\":" + property.GetStateJson() + ",";
+            property.Refresh(version);
+            changed = changed || property.version() > since_version;
         }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
+        return changed;
+    }
+
+    // 写入 Refresh 之后版本比 since_version 新的属性
+    void WriteChangedState(JsonWriter& writer, uint32_t since_version) const {
+        writer.BeginObject();
+        for (auto& property : properties_) {
+            if (property.version() > since_version) {
+                writer.Key(property.name());
+                property.WriteLastState(writer);
+            }
         }
-        json_str += "}";
-        return json_str;
+        writer.EndObject();
     }
 };
 
@@ -146,18 +208,8 @@ public:
     void set_number(int value) { number_ = value; }
     void set_string(const std::string& value) { string_ = value; }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
-        json_str += "\"description\":\"" + description_ + "\",";
-        if (type_ == kValueTypeBoolean) {
-            json_str += "\"type\":\"boolean\"";
-        } else if (type_ == kValueTypeNumber) {
-            json_str += "\"type\":\"number\"";
-        } else if (type_ == kValueTypeString) {
-            json_str += "\"type\":\"string\"";
-        }
-        json_str += "}";
-        return json_str;
+    void WriteDescriptor(JsonWriter& writer) const {
+        writer.BeginObject().Field("description", description_).Field("type", ValueTypeName(type_)).EndObject();
     }
 };
 
@@ -185,16 +237,13 @@ public:
     auto begin() { return parameters_.begin(); }
     auto end() { return parameters_.end(); }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
+    void WriteDescriptor(JsonWriter& writer) const {
+        writer.BeginObject();
         for (auto& parameter : parameters_) {
-            json_str += "\"" + parameter.name() + "\":" + parameter.GetDescriptorJson() + ",";
-        }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
+            writer.Key(parameter.name());
+            parameter.WriteDescriptor(writer);
         }
-        json_str += "}";
-        return json_str;
+        writer.EndObject();
     }
 };
 
@@ -213,12 +262,10 @@ public:
     const std::string& description() const { return description_; }
     ParameterList& parameters() { return parameters_; }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
-        json_str += "\"description\":\"" + description_ + "\",";
-        json_str += "\"parameters\":" + parameters_.GetDescriptorJson();
-        json_str += "}";
-        return json_str;
+    void WriteDescriptor(JsonWriter& writer) const {
+        writer.BeginObject().Field("description", description_).Key("parameters");
+        parameters_.WriteDescriptor(writer);
+        writer.EndObject();
     }
 
     void Invoke() {
@@ -247,16 +294,13 @@ public:
         throw std::runtime_error("Method not found: " + name);
     }
 
-    std::string GetDescriptorJson() {
-        std::string json_str = "{";
+    void WriteDescriptor(JsonWriter& writer) const {
+        writer.BeginObject();
         for (auto& method : methods_) {
-            json_str += "\"" + method.name() + "\":" + method.GetDescriptorJson() + ",";
-        }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
+            writer.Key(method.name());
+            method.WriteDescriptor(writer);
         }
-        json_str += "}";
-        return json_str;
+        writer.EndObject();
     }
 };
 
@@ -267,7 +311,11 @@ public:
     virtual ~Thing() = default;
 
     virtual std::string GetDescriptorJson();
+    // 写入 {"name":...,"description":...,"properties":{...},"methods":{...}}
+    virtual void WriteDescriptor(JsonWriter& writer);
     virtual std::string GetStateJson();
+    // 写入 {"name":...,"state":{...}}，只包含版本比 since_version 新的属性，没有时不写入并返回 false
+    virtual bool WriteChangedState(JsonWriter& writer, uint32_t version, uint32_t since_version);
     virtual void Invoke(const cJSON* command);
 
     const std::string& name() const { return name_; }
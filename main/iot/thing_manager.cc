@@ -11,42 +11,31 @@ void ThingManager::AddThing(Thing* thing) {
 }
 
 std::string ThingManager::GetDescriptorsJson() {
-    std::string json_str = "[";
+    std::string json;
+    JsonWriter writer(json);
+    writer.BeginArray();
     for (auto& thing : things_) {
-        json_str += thing->GetDescriptorJson() + ",";
+        thing->WriteDescriptor(writer);
     }
-    if (json_str.back() == ',') {
-        json_str.pop_back();
-    }
-    json_str += "]";
-    return json_str;
+    writer.EndArray();
+    return json;
 }
 
 bool ThingManager::GetStatesJson(std::string& json, bool delta) {
-    if (!delta) {
-        last_states_.clear();
-    }
+    // 读取每个属性并记录变化的版本，delta 时只序列化上次上报之后变化的属性
+    uint32_t version = ++state_version_;
+    uint32_t since_version = delta ? reported_version_ : 0;
     bool changed = false;
-    json = "[";
-    // 枚举thing，获取每个thing的state，如果发生变化，则更新，保存到last_states_
-    // 如果delta为true，则只返回变化的部分
+    json.clear();
+    JsonWriter writer(json);
+    writer.BeginArray();
     for (auto& thing : things_) {
-        std::string state = thing->GetStateJson();
-        if (delta) {
-            // 如果delta为true，则只返回变化的部分
-            auto it = last_states_.find(thing->name());
-            if (it != last_states_.end() && it->second == state) {
-                continue;
-            }
+        if (thing->WriteChangedState(writer, version, since_version)) {
             changed = true;
-            last_states_[thing->name()] = state;
         }
-        json += state + ",";
-    }
-    if (json.back() == ',') {
-        json.pop_back();
     }
-    json += "]";
+    writer.EndArray();
+    reported_version_ = version;
     return changed;
 }
 
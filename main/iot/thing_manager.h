@@ -9,7 +9,6 @@
 #include <vector>
 #include <memory>
 #include <functional>
-#include <map>
 
 namespace iot {
 
@@ -25,6 +24,7 @@ public:
     void AddThing(Thing* thing);
 
     std::string GetDescriptorsJson();
+    // delta 为 true 时只包含上次上报之后变化的属性，没有需要上报的状态时返回 false
     bool GetStatesJson(std::string& json, bool delta = false);
     void Invoke(const cJSON* command);
 
@@ -33,7 +33,9 @@ private:
     ~ThingManager() = default;
 
     std::vector<Thing*> things_;
-    std::map<std::string, std::string> last_states_;
+    // 每次收集状态递增，属性记录自己最后一次变化时的版本
+    uint32_t state_version_ = 0;
+    uint32_t reported_version_ = 0;
 };
 
 
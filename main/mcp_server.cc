@@ -9,6 +9,7 @@
 #include <algorithm>
 #include <cstring>
 #include <esp_pthread.h>
+#include <esp_timer.h>
 
 #include "application.h"
 #include "display.h"
@@ -17,6 +18,11 @@
 #define TAG "MCP"
 
 #define DEFAULT_TOOLCALL_STACK_SIZE 6144
+// Tool call workers are created once with this stack, calls asking for more are rejected
+#define TOOL_WORKER_COUNT 2
+#define TOOL_WORKER_STACK_SIZE 8192
+#define TOOL_CALL_QUEUE_SIZE 4
+#define TOOL_CALL_TIMEOUT_MS 60000
 
 McpServer::McpServer() {
 }
@@ -55,6 +61,35 @@ void McpServer::AddCommonTools() {
             codec->SetOutputVolume(properties["volume"].value<int>());
             return true;
         });
+
+    auto codec = board.GetAudioCodec();
+    if (codec->post_processor()) {
+        AddTool("self.audio_speaker.set_equalizer",
+            "Adjust the sound of the audio speaker. Gains are in dB, 0 is flat. Leave out an argument to keep its current value.\n"
+            "Args:\n"
+            "  `bass`: Boost or cut the low frequencies.\n"
+            "  `treble`: Boost or cut the high frequencies.\n"
+            "  `loudness`: Extra loudness, peaks are limited so it does not distort.",
+            PropertyList({
+                Property("bass", kPropertyTypeInteger, -12, 12).set_optional(),
+                Property("treble", kPropertyTypeInteger, -12, 12).set_optional(),
+                Property("loudness", kPropertyTypeInteger, 0, 12).set_optional()
+            }),
+            [codec](const PropertyList& properties) -> ReturnValue {
+                auto config = codec->post_processor()->config();
+                if (properties["bass"].has_value()) {
+                    config.bass_db = properties["bass"].value<int>();
+                }
+                if (properties["treble"].has_value()) {
+                    config.treble_db = properties["treble"].value<int>();
+                }
+                if (properties["loudness"].has_value()) {
+                    config.loudness_db = properties["loudness"].value<int>();
+                }
+                codec->SetPostProcessorConfig(config);
+                return true;
+            });
+    }
     
     auto backlight = board.GetBacklight();
     if (backlight) {
@@ -94,28 +129,59 @@ void McpServer::AddCommonTools() {
             PropertyList({
                 Property("question", kPropertyTypeString)
             }),
-            [camera](const PropertyList& properties) -> ReturnValue {
+            [camera, display](const PropertyList& properties) -> ReturnValue {
+                auto lock = camera->Lock();
                 if (!camera->Capture()) {
                     return "{\"success\": false, \"message\": \"Failed to capture photo\"}";
                 }
                 auto question = properties["question"].value<std::string>();
-                return camera->Explain(question);
+                if (display == nullptr) {
+                    return camera->Explain(question);
+                }
+                // Show the answer while it streams in, consecutive system messages replace each other
+                return camera->Explain(question, [display](const std::string& text) {
+                    display->SetChatMessage("system", text.c_str());
+                });
+            });
+
+        AddTool("self.camera.set_viewfinder",
+            "Show or hide the live camera view on the screen, so the user can aim the camera before asking about something. "
+            "Taking a photo closes the live view.\n"
+            "Args:\n"
+            "  `enabled`: Whether the live view is shown.\n"
+            "  `fps`: Frames per second of the live view.",
+            PropertyList({
+                Property("enabled", kPropertyTypeBoolean),
+                Property("fps", kPropertyTypeInteger, 5, 1, 15)
+            }),
+            [camera, display](const PropertyList& properties) -> ReturnValue {
+                if (!properties["enabled"].value<bool>()) {
+                    camera->StopStreaming();
+                    if (display) {
+                        display->SetPreviewImage(nullptr);
+                    }
+                    return true;
+                }
+                return camera->StartStreaming(properties["fps"].value<int>());
             });
     }
 
     // Restore the original tools list to the end of the tools list
     tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
+    tools_list_built_ = false;
 }
 
 void McpServer::AddTool(McpTool* tool) {
     // Prevent adding duplicate tools
-    if (std::find_if(tools_.begin(), tools_.end(), [tool](const McpTool* t) { return t->name() == tool->name(); }) != tools_.end()) {
+    if (tools_by_name_.find(tool->name()) != tools_by_name_.end()) {
         ESP_LOGW(TAG, "Tool %s already added", tool->name().c_str());
         return;
     }
 
     ESP_LOGI(TAG, "Add tool: %s", tool->name().c_str());
     tools_.push_back(tool);
+    tools_by_name_[tool->name()] = tool;
+    tools_list_built_ = false;
 }
 
 void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
@@ -123,114 +189,110 @@ void McpServer::AddTool(const std::string& name, const std::string& description,
 }
 
 void McpServer::ParseMessage(const std::string& message) {
-    cJSON* json = cJSON_Parse(message.c_str());
-    if (json == nullptr) {
+    JsonObject json(message);
+    if (!json.valid()) {
         ESP_LOGE(TAG, "Failed to parse MCP message: %s", message.c_str());
         return;
     }
     ParseMessage(json);
-    cJSON_Delete(json);
 }
 
-void McpServer::ParseCapabilities(const cJSON* capabilities) {
-    auto vision = cJSON_GetObjectItem(capabilities, "vision");
-    if (cJSON_IsObject(vision)) {
-        auto url = cJSON_GetObjectItem(vision, "url");
-        auto token = cJSON_GetObjectItem(vision, "token");
-        if (cJSON_IsString(url)) {
+void McpServer::ParseCapabilities(const JsonObject& capabilities) {
+    auto vision = capabilities["vision"].AsObject();
+    if (vision.valid()) {
+        std::string url_str, token_str;
+        if (vision["url"].GetString(url_str)) {
             auto camera = Board::GetInstance().GetCamera();
             if (camera) {
-                std::string url_str = std::string(url->valuestring);
-                std::string token_str;
-                if (cJSON_IsString(token)) {
-                    token_str = std::string(token->valuestring);
-                }
+                vision["token"].GetString(token_str);
                 camera->SetExplainUrl(url_str, token_str);
             }
         }
     }
 }
 
-void McpServer::ParseMessage(const cJSON* json) {
+void McpServer::ParseMessage(const JsonObject& json) {
     // Check JSONRPC version
-    auto version = cJSON_GetObjectItem(json, "jsonrpc");
-    if (version == nullptr || !cJSON_IsString(version) || strcmp(version->valuestring, "2.0") != 0) {
-        ESP_LOGE(TAG, "Invalid JSONRPC version: %s", version ? version->valuestring : "null");
+    auto version = json["jsonrpc"];
+    if (!version.Equals("2.0")) {
+        ESP_LOGE(TAG, "Invalid JSONRPC version: %.*s", (int)version.raw().size(), version.raw().data());
         return;
     }
     
     // Check method
-    auto method = cJSON_GetObjectItem(json, "method");
-    if (method == nullptr || !cJSON_IsString(method)) {
+    std::string method_str;
+    if (!json["method"].GetString(method_str)) {
         ESP_LOGE(TAG, "Missing method");
         return;
     }
     
-    auto method_str = std::string(method->valuestring);
     if (method_str.find("notifications") == 0) {
+        if (method_str == "notifications/cancelled") {
+            auto request_id = json["params"].AsObject()["requestId"];
+            if (request_id.IsNumber()) {
+                CancelToolCall(request_id.AsInt());
+            }
+        }
         return;
     }
     
     // Check params
-    auto params = cJSON_GetObjectItem(json, "params");
-    if (params != nullptr && !cJSON_IsObject(params)) {
+    auto params_value = json["params"];
+    if (params_value.type() != kJsonNone && !params_value.IsObject()) {
         ESP_LOGE(TAG, "Invalid params for method: %s", method_str.c_str());
         return;
     }
+    auto params = params_value.AsObject();
 
-    auto id = cJSON_GetObjectItem(json, "id");
-    if (id == nullptr || !cJSON_IsNumber(id)) {
+    auto id = json["id"];
+    if (!id.IsNumber()) {
         ESP_LOGE(TAG, "Invalid id for method: %s", method_str.c_str());
         return;
     }
-    auto id_int = id->valueint;
+    auto id_int = id.AsInt();
     
     if (method_str == "initialize") {
-        if (cJSON_IsObject(params)) {
-            auto capabilities = cJSON_GetObjectItem(params, "capabilities");
-            if (cJSON_IsObject(capabilities)) {
-                ParseCapabilities(capabilities);
-            }
+        auto capabilities = params["capabilities"].AsObject();
+        if (capabilities.valid()) {
+            ParseCapabilities(capabilities);
         }
         auto app_desc = esp_app_get_description();
-        std::string message = "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{\"tools\":{}},\"serverInfo\":{\"name\":\"" BOARD_NAME "\",\"version\":\"";
-        message += app_desc->version;
-        message += "\"}}";
+        std::string message;
+        JsonWriter(message).BeginObject()
+            .Field("protocolVersion", "2024-11-05")
+            .Key("capabilities").BeginObject().Key("tools").BeginObject().EndObject().EndObject()
+            .Key("serverInfo").BeginObject().Field("name", BOARD_NAME).Field("version", app_desc->version).EndObject()
+            .EndObject();
         ReplyResult(id_int, message);
     } else if (method_str == "tools/list") {
         std::string cursor_str = "";
-        if (params != nullptr) {
-            auto cursor = cJSON_GetObjectItem(params, "cursor");
-            if (cJSON_IsString(cursor)) {
-                cursor_str = std::string(cursor->valuestring);
-            }
-        }
+        params["cursor"].GetString(cursor_str);
         GetToolsList(id_int, cursor_str);
     } else if (method_str == "tools/call") {
-        if (!cJSON_IsObject(params)) {
+        if (!params.valid()) {
             ESP_LOGE(TAG, "tools/call: Missing params");
             ReplyError(id_int, "Missing params");
             return;
         }
-        auto tool_name = cJSON_GetObjectItem(params, "name");
-        if (!cJSON_IsString(tool_name)) {
+        std::string tool_name;
+        if (!params["name"].GetString(tool_name)) {
             ESP_LOGE(TAG, "tools/call: Missing name");
             ReplyError(id_int, "Missing name");
             return;
         }
-        auto tool_arguments = cJSON_GetObjectItem(params, "arguments");
-        if (tool_arguments != nullptr && !cJSON_IsObject(tool_arguments)) {
+        auto tool_arguments = params["arguments"];
+        if (tool_arguments.type() != kJsonNone && !tool_arguments.IsObject()) {
             ESP_LOGE(TAG, "tools/call: Invalid arguments");
             ReplyError(id_int, "Invalid arguments");
             return;
         }
-        auto stack_size = cJSON_GetObjectItem(params, "stackSize");
-        if (stack_size != nullptr && !cJSON_IsNumber(stack_size)) {
+        auto stack_size = params["stackSize"];
+        if (stack_size.type() != kJsonNone && !stack_size.IsNumber()) {
             ESP_LOGE(TAG, "tools/call: Invalid stackSize");
             ReplyError(id_int, "Invalid stackSize");
             return;
         }
-        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments, stack_size ? stack_size->valueint : DEFAULT_TOOLCALL_STACK_SIZE);
+        DoToolCall(id_int, tool_name, tool_arguments.AsObject(), stack_size.AsInt(DEFAULT_TOOLCALL_STACK_SIZE));
     } else {
         ESP_LOGE(TAG, "Method not implemented: %s", method_str.c_str());
         ReplyError(id_int, "Method not implemented: " + method_str);
@@ -238,104 +300,111 @@ void McpServer::ParseMessage(const cJSON* json) {
 }
 
 void McpServer::ReplyResult(int id, const std::string& result) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id) + ",\"result\":";
-    payload += result;
-    payload += "}";
+    std::string payload;
+    payload.reserve(result.size() + 40);
+    JsonWriter(payload).BeginObject()
+        .Field("jsonrpc", "2.0")
+        .Field("id", id)
+        .Key("result").Raw(result)
+        .EndObject();
     Application::GetInstance().SendMcpMessage(payload);
 }
 
 void McpServer::ReplyError(int id, const std::string& message) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id);
-    payload += ",\"error\":{\"message\":\"";
-    payload += message;
-    payload += "\"}}";
+    std::string payload;
+    JsonWriter(payload).BeginObject()
+        .Field("jsonrpc", "2.0")
+        .Field("id", id)
+        .Key("error").BeginObject().Field("message", message).EndObject()
+        .EndObject();
     Application::GetInstance().SendMcpMessage(payload);
 }
 
-void McpServer::GetToolsList(int id, const std::string& cursor) {
+// Splits the tools into tools/list results under the payload size limit. Each page starts
+// at the tool named by the previous page's nextCursor.
+void McpServer::BuildToolsListPages() {
     const int max_payload_size = 8000;
+    tools_list_pages_.clear();
+    tools_list_cursors_.clear();
+    tools_list_error_tool_.clear();
+
     std::string json = "{\"tools\":[";
-    
-    bool found_cursor = cursor.empty();
-    auto it = tools_.begin();
-    std::string next_cursor = "";
-    
-    while (it != tools_.end()) {
-        // 如果我们还没有找到起始位置，继续搜索
-        if (!found_cursor) {
-            if ((*it)->name() == cursor) {
-                found_cursor = true;
-            } else {
-                ++it;
-                continue;
-            }
-        }
-        
-        // 添加tool前检查大小
-        std::string tool_json = (*it)->to_json() + ",";
+    tools_list_cursors_[""] = 0;
+    for (auto tool : tools_) {
+        std::string tool_json = tool->to_json() + ",";
         if (json.length() + tool_json.length() + 30 > max_payload_size) {
-            // 如果添加这个tool会超出大小限制，设置next_cursor并退出循环
-            next_cursor = (*it)->name();
-            break;
+            if (json.back() == '[') {
+                // 单个tool就超出了大小限制，从这一页开始无法返回
+                tools_list_error_tool_ = tool->name();
+                tools_list_cursors_[tool->name()] = tools_list_pages_.size();
+                ESP_LOGE(TAG, "tools/list: Tool %s exceeds the payload size limit", tool->name().c_str());
+                return;
+            }
+            json.pop_back();
+            json += "],\"nextCursor\":\"" + tool->name() + "\"}";
+            tools_list_pages_.push_back(std::move(json));
+            tools_list_cursors_[tool->name()] = tools_list_pages_.size();
+            json = "{\"tools\":[";
         }
-        
         json += tool_json;
-        ++it;
     }
-    
     if (json.back() == ',') {
         json.pop_back();
     }
-    
-    if (json.back() == '[' && !tools_.empty()) {
-        // 如果没有添加任何tool，返回错误
-        ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", next_cursor.c_str());
-        ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit");
-        return;
+    json += "]}";
+    tools_list_pages_.push_back(std::move(json));
+    ESP_LOGI(TAG, "tools/list: %u tools in %u pages", tools_.size(), tools_list_pages_.size());
+}
+
+void McpServer::GetToolsList(int id, const std::string& cursor) {
+    if (!tools_list_built_) {
+        BuildToolsListPages();
+        tools_list_built_ = true;
     }
 
-    if (next_cursor.empty()) {
-        json += "]}";
-    } else {
-        json += "],\"nextCursor\":\"" + next_cursor + "\"}";
+    auto it = tools_list_cursors_.find(cursor);
+    if (it == tools_list_cursors_.end()) {
+        // 不是页面起点的cursor，返回空列表
+        ReplyResult(id, "{\"tools\":[]}");
+        return;
     }
-    
-    ReplyResult(id, json);
+    if (it->second >= tools_list_pages_.size()) {
+        ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", tools_list_error_tool_.c_str());
+        ReplyError(id, "Failed to add tool " + tools_list_error_tool_ + " because of payload size limit");
+        return;
+    }
+    ReplyResult(id, tools_list_pages_[it->second]);
 }
 
-void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size) {
-    auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
-                                 [&tool_name](const McpTool* tool) { 
-                                     return tool->name() == tool_name; 
-                                 });
-    
-    if (tool_iter == tools_.end()) {
+void McpServer::DoToolCall(int id, const std::string& tool_name, const JsonObject& tool_arguments, int stack_size) {
+    auto tool_iter = tools_by_name_.find(tool_name);
+    if (tool_iter == tools_by_name_.end()) {
         ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
         ReplyError(id, "Unknown tool: " + tool_name);
         return;
     }
 
-    PropertyList arguments = (*tool_iter)->properties();
+    McpTool* tool = tool_iter->second;
+    PropertyList arguments = tool->properties();
     try {
         for (auto& argument : arguments) {
             bool found = false;
-            if (cJSON_IsObject(tool_arguments)) {
-                auto value = cJSON_GetObjectItem(tool_arguments, argument.name().c_str());
-                if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
-                    argument.set_value<bool>(value->valueint == 1);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeInteger && cJSON_IsNumber(value)) {
-                    argument.set_value<int>(value->valueint);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeString && cJSON_IsString(value)) {
-                    argument.set_value<std::string>(value->valuestring);
+            auto value = tool_arguments[argument.name()];
+            if (argument.type() == kPropertyTypeBoolean && value.IsBool()) {
+                argument.set_value<bool>(value.AsBool());
+                found = true;
+            } else if (argument.type() == kPropertyTypeInteger && value.IsNumber()) {
+                argument.set_value<int>(value.AsInt());
+                found = true;
+            } else if (argument.type() == kPropertyTypeString && value.IsString()) {
+                std::string str;
+                if (value.GetString(str)) {
+                    argument.set_value<std::string>(str);
                     found = true;
                 }
             }
 
-            if (!argument.has_default_value() && !found) {
+            if (argument.is_required() && !found) {
                 ESP_LOGE(TAG, "tools/call: Missing valid argument: %s", argument.name().c_str());
                 ReplyError(id, "Missing valid argument: " + argument.name());
                 return;
@@ -347,21 +416,159 @@ void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* to
         return;
     }
 
-    // Start a task to receive data with stack size
+    if (stack_size > TOOL_WORKER_STACK_SIZE) {
+        ESP_LOGE(TAG, "tools/call: stackSize %d exceeds the worker stack %d", stack_size, TOOL_WORKER_STACK_SIZE);
+        {
+            std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+            tool_call_stats_.rejected++;
+        }
+        ReplyError(id, "stackSize exceeds the tool worker stack");
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(tool_calls_mutex_);
+    if (tool_workers_.empty()) {
+        StartToolWorkers();
+    }
+    if (pending_tool_calls_.size() >= TOOL_CALL_QUEUE_SIZE) {
+        tool_call_stats_.rejected++;
+        ESP_LOGW(TAG, "tools/call: Queue is full, rejecting %s (queued=%u, running=%lu, rejected=%lu)", tool_name.c_str(),
+            pending_tool_calls_.size(), tool_call_stats_.running, tool_call_stats_.rejected);
+        lock.unlock();
+        ReplyError(id, "Too many tool calls in progress");
+        return;
+    }
+    auto call = std::make_shared<ToolCall>();
+    call->id = id;
+    call->tool = tool;
+    call->arguments = std::move(arguments);
+    call->deadline_us = esp_timer_get_time() + TOOL_CALL_TIMEOUT_MS * 1000LL;
+    pending_tool_calls_.push_back(call);
+    active_tool_calls_[id] = call;
+    if (!esp_timer_is_active(tool_call_timer_)) {
+        esp_timer_start_periodic(tool_call_timer_, 1000 * 1000);
+    }
+    tool_calls_cv_.notify_one();
+}
+
+// Called with tool_calls_mutex_ held
+void McpServer::StartToolWorkers() {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            static_cast<McpServer*>(arg)->CheckToolCallTimeouts();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "tool_call_timeout",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &tool_call_timer_));
+
     esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
     cfg.thread_name = "tool_call";
-    cfg.stack_size = stack_size;
+    cfg.stack_size = TOOL_WORKER_STACK_SIZE;
     cfg.prio = 1;
     esp_pthread_set_cfg(&cfg);
+    for (int i = 0; i < TOOL_WORKER_COUNT; i++) {
+        tool_workers_.emplace_back([this]() {
+            ToolWorkerLoop();
+        });
+    }
+    // Threads created later by this task get the default config again
+    cfg = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&cfg);
+}
+
+void McpServer::ToolWorkerLoop() {
+    while (true) {
+        std::unique_lock<std::mutex> lock(tool_calls_mutex_);
+        tool_calls_cv_.wait(lock, [this]() { return !pending_tool_calls_.empty(); });
+        auto call = pending_tool_calls_.front();
+        pending_tool_calls_.pop_front();
+        tool_call_stats_.running++;
+        lock.unlock();
 
-    // Use a thread to call the tool to avoid blocking the main thread
-    tool_call_thread_ = std::thread([this, id, tool_iter, arguments = std::move(arguments)]() {
+        std::string result, error;
         try {
-            ReplyResult(id, (*tool_iter)->Call(arguments));
+            result = call->tool->Call(call->arguments);
         } catch (const std::exception& e) {
             ESP_LOGE(TAG, "tools/call: %s", e.what());
-            ReplyError(id, e.what());
+            error = e.what();
         }
-    });
-    tool_call_thread_.detach();
+
+        lock.lock();
+        tool_call_stats_.running--;
+        auto it = active_tool_calls_.find(call->id);
+        if (it != active_tool_calls_.end() && it->second == call) {
+            active_tool_calls_.erase(it);
+        }
+        // A call that timed out or was cancelled while running already got its answer
+        bool reply = !call->finished;
+        call->finished = true;
+        if (reply) {
+            tool_call_stats_.completed++;
+        }
+        lock.unlock();
+
+        if (!reply) {
+            ESP_LOGW(TAG, "tools/call: Dropping late result of %s", call->tool->name().c_str());
+        } else if (error.empty()) {
+            ReplyResult(call->id, result);
+        } else {
+            ReplyError(call->id, error);
+        }
+    }
+}
+
+// Answers calls past their deadline. A running tool cannot be stopped, its worker stays
+// busy until it returns and the late result is dropped.
+void McpServer::CheckToolCallTimeouts() {
+    std::vector<int> timed_out;
+    {
+        std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+        int64_t now = esp_timer_get_time();
+        for (auto it = active_tool_calls_.begin(); it != active_tool_calls_.end();) {
+            auto& call = it->second;
+            if (call->deadline_us > now) {
+                ++it;
+                continue;
+            }
+            call->finished = true;
+            pending_tool_calls_.erase(std::remove(pending_tool_calls_.begin(), pending_tool_calls_.end(), call),
+                pending_tool_calls_.end());
+            tool_call_stats_.timed_out++;
+            timed_out.push_back(it->first);
+            it = active_tool_calls_.erase(it);
+        }
+        if (active_tool_calls_.empty()) {
+            esp_timer_stop(tool_call_timer_);
+        }
+    }
+    for (int id : timed_out) {
+        ESP_LOGE(TAG, "tools/call: Request %d timed out", id);
+        ReplyError(id, "Tool call timed out");
+    }
+}
+
+// The receiver of a cancellation does not reply to the cancelled request
+void McpServer::CancelToolCall(int id) {
+    std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+    auto it = active_tool_calls_.find(id);
+    if (it == active_tool_calls_.end()) {
+        return;
+    }
+    auto call = it->second;
+    call->finished = true;
+    pending_tool_calls_.erase(std::remove(pending_tool_calls_.begin(), pending_tool_calls_.end(), call),
+        pending_tool_calls_.end());
+    active_tool_calls_.erase(it);
+    tool_call_stats_.cancelled++;
+    ESP_LOGI(TAG, "tools/call: Request %d cancelled", id);
+}
+
+McpToolCallStats McpServer::GetToolCallStats() {
+    std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+    McpToolCallStats stats = tool_call_stats_;
+    stats.queued = pending_tool_calls_.size();
+    return stats;
 }
\ No newline at end of file
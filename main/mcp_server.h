@@ -4,13 +4,22 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <functional>
 #include <variant>
 #include <optional>
 #include <stdexcept>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 
 #include <cJSON.h>
+#include <esp_timer.h>
+
+#include "json_writer.h"
+#include "json_reader.h"
 
 // 添加类型别名
 using ReturnValue = std::variant<bool, int, std::string>;
@@ -29,6 +38,8 @@ private:
     bool has_default_value_;
     std::optional<int> min_value_;  // 新增：整数最小值
     std::optional<int> max_value_;  // 新增：整数最大值
+    bool optional_ = false;
+    bool has_value_ = false;
 
 public:
     // Required field constructor
@@ -38,7 +49,7 @@ public:
     // Optional field constructor with default value
     template<typename T>
     Property(const std::string& name, PropertyType type, const T& default_value)
-        : name_(name), type_(type), has_default_value_(true) {
+        : name_(name), type_(type), has_default_value_(true), has_value_(true) {
         value_ = default_value;
     }
 
@@ -50,7 +61,7 @@ public:
     }
 
     Property(const std::string& name, PropertyType type, int default_value, int min_value, int max_value)
-        : name_(name), type_(type), has_default_value_(true), min_value_(min_value), max_value_(max_value) {
+        : name_(name), type_(type), has_default_value_(true), min_value_(min_value), max_value_(max_value), has_value_(true) {
         if (type != kPropertyTypeInteger) {
             throw std::invalid_argument("Range limits only apply to integer properties");
         }
@@ -63,6 +74,10 @@ public:
     inline const std::string& name() const { return name_; }
     inline PropertyType type() const { return type_; }
     inline bool has_default_value() const { return has_default_value_; }
+    // A field without a default value that the caller may leave out, check has_value() before reading it
+    inline Property& set_optional() { optional_ = true; return *this; }
+    inline bool is_required() const { return !has_default_value_ && !optional_; }
+    inline bool has_value() const { return has_value_; }
     inline bool has_range() const { return min_value_.has_value() && max_value_.has_value(); }
     inline int min_value() const { return min_value_.value_or(0); }
     inline int max_value() const { return max_value_.value_or(0); }
@@ -84,9 +99,10 @@ public:
             }
         }
         value_ = value;
+        has_value_ = true;
     }
 
-    std::string to_json() const {
+    cJSON* to_cjson() const {
         cJSON *json = cJSON_CreateObject();
         
         if (type_ == kPropertyTypeBoolean) {
@@ -111,7 +127,11 @@ public:
                 cJSON_AddStringToObject(json, "default", value<std::string>().c_str());
             }
         }
-        
+        return json;
+    }
+
+    std::string to_json() const {
+        cJSON *json = to_cjson();
         char *json_str = cJSON_PrintUnformatted(json);
         std::string result(json_str);
         cJSON_free(json_str);
@@ -147,21 +167,23 @@ public:
     std::vector<std::string> GetRequired() const {
         std::vector<std::string> required;
         for (auto& property : properties_) {
-            if (!property.has_default_value()) {
+            if (property.is_required()) {
                 required.push_back(property.name());
             }
         }
         return required;
     }
 
-    std::string to_json() const {
+    cJSON* to_cjson() const {
         cJSON *json = cJSON_CreateObject();
-        
         for (const auto& property : properties_) {
-            cJSON *prop_json = cJSON_Parse(property.to_json().c_str());
-            cJSON_AddItemToObject(json, property.name().c_str(), prop_json);
+            cJSON_AddItemToObject(json, property.name().c_str(), property.to_cjson());
         }
-        
+        return json;
+    }
+
+    std::string to_json() const {
+        cJSON *json = to_cjson();
         char *json_str = cJSON_PrintUnformatted(json);
         std::string result(json_str);
         cJSON_free(json_str);
@@ -202,8 +224,7 @@ public:
         cJSON *input_schema = cJSON_CreateObject();
         cJSON_AddStringToObject(input_schema, "type", "object");
         
-        cJSON *properties = cJSON_Parse(properties_.to_json().c_str());
-        cJSON_AddItemToObject(input_schema, "properties", properties);
+        cJSON_AddItemToObject(input_schema, "properties", properties_.to_cjson());
         
         if (!required.empty()) {
             cJSON *required_array = cJSON_CreateArray();
@@ -226,29 +247,36 @@ public:
     std::string Call(const PropertyList& properties) {
         ReturnValue return_value = callback_(properties);
         // 返回结果
-        cJSON* result = cJSON_CreateObject();
-        cJSON* content = cJSON_CreateArray();
-        cJSON* text = cJSON_CreateObject();
-        cJSON_AddStringToObject(text, "type", "text");
+        std::string text;
         if (std::holds_alternative<std::string>(return_value)) {
-            cJSON_AddStringToObject(text, "text", std::get<std::string>(return_value).c_str());
+            text = std::move(std::get<std::string>(return_value));
         } else if (std::holds_alternative<bool>(return_value)) {
-            cJSON_AddStringToObject(text, "text", std::get<bool>(return_value) ? "true" : "false");
+            text = std::get<bool>(return_value) ? "true" : "false";
         } else if (std::holds_alternative<int>(return_value)) {
-            cJSON_AddStringToObject(text, "text", std::to_string(std::get<int>(return_value)).c_str());
+            text = std::to_string(std::get<int>(return_value));
         }
-        cJSON_AddItemToArray(content, text);
-        cJSON_AddItemToObject(result, "content", content);
-        cJSON_AddBoolToObject(result, "isError", false);
 
-        auto json_str = cJSON_PrintUnformatted(result);
-        std::string result_str(json_str);
-        cJSON_free(json_str);
-        cJSON_Delete(result);
-        return result_str;
+        std::string result;
+        result.reserve(text.size() + 64);
+        JsonWriter(result).BeginObject()
+            .Key("content").BeginArray()
+                .BeginObject().Field("type", "text").Field("text", text).EndObject()
+            .EndArray()
+            .Field("isError", false)
+            .EndObject();
+        return result;
     }
 };
 
+struct McpToolCallStats {
+    uint32_t queued = 0;        // Waiting for a worker
+    uint32_t running = 0;
+    uint32_t completed = 0;
+    uint32_t rejected = 0;      // Queue full or stack too large
+    uint32_t timed_out = 0;
+    uint32_t cancelled = 0;
+};
+
 class McpServer {
 public:
     static McpServer& GetInstance() {
@@ -259,23 +287,53 @@ public:
     void AddCommonTools();
     void AddTool(McpTool* tool);
     void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
-    void ParseMessage(const cJSON* json);
+    void ParseMessage(const JsonObject& json);
     void ParseMessage(const std::string& message);
+    McpToolCallStats GetToolCallStats();
 
 private:
     McpServer();
     ~McpServer();
 
-    void ParseCapabilities(const cJSON* capabilities);
+    void ParseCapabilities(const JsonObject& capabilities);
 
     void ReplyResult(int id, const std::string& result);
     void ReplyError(int id, const std::string& message);
 
     void GetToolsList(int id, const std::string& cursor);
-    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size);
+    void DoToolCall(int id, const std::string& tool_name, const JsonObject& tool_arguments, int stack_size);
+
+    // A tools/call request waiting for or running on a worker
+    struct ToolCall {
+        int id;
+        McpTool* tool;
+        PropertyList arguments;
+        int64_t deadline_us;
+        bool finished = false;  // Replied to, timed out or cancelled
+    };
+    void StartToolWorkers();
+    void ToolWorkerLoop();
+    void CheckToolCallTimeouts();
+    void CancelToolCall(int id);
+
+    void BuildToolsListPages();
 
     std::vector<McpTool*> tools_;
-    std::thread tool_call_thread_;
+    std::unordered_map<std::string, McpTool*> tools_by_name_;
+    // tools/list 的每一页预先序列化好，新增工具时重建
+    std::vector<std::string> tools_list_pages_;
+    std::unordered_map<std::string, size_t> tools_list_cursors_;
+    std::string tools_list_error_tool_;
+    bool tools_list_built_ = false;
+
+    // Tool calls run on a fixed set of workers fed by a bounded queue
+    std::mutex tool_calls_mutex_;
+    std::condition_variable tool_calls_cv_;
+    std::deque<std::shared_ptr<ToolCall>> pending_tool_calls_;
+    std::map<int, std::shared_ptr<ToolCall>> active_tool_calls_;  // Pending and running, by JSON-RPC id
+    std::vector<std::thread> tool_workers_;
+    esp_timer_handle_t tool_call_timer_ = nullptr;
+    McpToolCallStats tool_call_stats_;
 };
 
 #endif // MCP_SERVER_H
@@ -0,0 +1,110 @@
+#include "binary_protocol.h"
+
+#include <esp_log.h>
+#include <arpa/inet.h>
+#include <cstring>
+
+#define TAG "BinaryProtocol"
+
+bool ParseBinaryProtocol2(const uint8_t* data, size_t size, AudioStreamPacket& packet) {
+    if (size < sizeof(BinaryProtocol2)) {
+        ESP_LOGE(TAG, "Invalid audio packet size: %u", (unsigned)size);
+        return false;
+    }
+    auto bp2 = (const BinaryProtocol2*)data;
+    uint32_t payload_size = ntohl(bp2->payload_size);
+    if (payload_size > size - sizeof(BinaryProtocol2)) {
+        ESP_LOGE(TAG, "Invalid audio payload size: %lu, packet size: %u", (unsigned long)payload_size, (unsigned)size);
+        return false;
+    }
+    packet.timestamp = ntohl(bp2->timestamp);
+    packet.payload.assign(bp2->payload, bp2->payload + payload_size);
+    return true;
+}
+
+bool ParseBinaryProtocol3(const uint8_t* data, size_t size, AudioStreamPacket& packet) {
+    if (size < sizeof(BinaryProtocol3)) {
+        ESP_LOGE(TAG, "Invalid audio packet size: %u", (unsigned)size);
+        return false;
+    }
+    auto bp3 = (const BinaryProtocol3*)data;
+    uint16_t payload_size = ntohs(bp3->payload_size);
+    if (payload_size > size - sizeof(BinaryProtocol3)) {
+        ESP_LOGE(TAG, "Invalid audio payload size: %u, packet size: %u", payload_size, (unsigned)size);
+        return false;
+    }
+    packet.timestamp = 0;
+    packet.payload.assign(bp3->payload, bp3->payload + payload_size);
+    return true;
+}
+
+bool EncryptUdpAudioPacket(mbedtls_aes_context& aes, const std::string& nonce, const AudioStreamPacket& packet,
+    uint32_t sequence, std::string& encrypted) {
+    if (nonce.size() != UDP_AUDIO_HEADER_SIZE || packet.payload.size() > UINT16_MAX) {
+        ESP_LOGE(TAG, "Invalid nonce size: %u or payload size: %u", (unsigned)nonce.size(), (unsigned)packet.payload.size());
+        return false;
+    }
+    encrypted.resize(UDP_AUDIO_HEADER_SIZE + packet.payload.size());
+    uint8_t header[UDP_AUDIO_HEADER_SIZE];
+    memcpy(header, nonce.data(), UDP_AUDIO_HEADER_SIZE);
+    uint16_t payload_len = htons(packet.payload.size());
+    uint32_t timestamp = htonl(packet.timestamp);
+    sequence = htonl(sequence);
+    memcpy(&header[2], &payload_len, sizeof(payload_len));
+    memcpy(&header[8], &timestamp, sizeof(timestamp));
+    memcpy(&header[12], &sequence, sizeof(sequence));
+    memcpy(encrypted.data(), header, UDP_AUDIO_HEADER_SIZE);
+
+    // The counter block is updated in place, so the header is copied out first
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    if (mbedtls_aes_crypt_ctr(&aes, packet.payload.size(), &nc_off, header, stream_block,
+        packet.payload.data(), (uint8_t*)&encrypted[UDP_AUDIO_HEADER_SIZE]) != 0) {
+        ESP_LOGE(TAG, "Failed to encrypt audio data");
+        return false;
+    }
+    return true;
+}
+
+bool DecryptUdpAudioPacket(mbedtls_aes_context& aes, const std::string& data, AudioStreamPacket& packet,
+    uint32_t& sequence) {
+    if (data.size() < UDP_AUDIO_HEADER_SIZE) {
+        ESP_LOGE(TAG, "Invalid audio packet size: %u", (unsigned)data.size());
+        return false;
+    }
+    if (data[0] != 0x01) {
+        ESP_LOGE(TAG, "Invalid audio packet type: %x", (uint8_t)data[0]);
+        return false;
+    }
+    uint8_t nonce[UDP_AUDIO_HEADER_SIZE];
+    memcpy(nonce, data.data(), UDP_AUDIO_HEADER_SIZE);
+    uint16_t payload_len;
+    uint32_t timestamp;
+    memcpy(&payload_len, &nonce[2], sizeof(payload_len));
+    memcpy(&timestamp, &nonce[8], sizeof(timestamp));
+    memcpy(&sequence, &nonce[12], sizeof(sequence));
+    sequence = ntohl(sequence);
+
+    // A payload length in the header must fit in the packet, trailing bytes are ignored
+    size_t decrypted_size = data.size() - UDP_AUDIO_HEADER_SIZE;
+    payload_len = ntohs(payload_len);
+    if (payload_len > decrypted_size) {
+        ESP_LOGE(TAG, "Invalid audio payload size: %u, packet size: %u", payload_len, (unsigned)data.size());
+        return false;
+    }
+    if (payload_len != 0) {
+        decrypted_size = payload_len;
+    }
+
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    packet.timestamp = ntohl(timestamp);
+    packet.payload.resize(decrypted_size);
+    int ret = mbedtls_aes_crypt_ctr(&aes, decrypted_size, &nc_off, nonce, stream_block,
+        (const uint8_t*)data.data() + UDP_AUDIO_HEADER_SIZE, packet.payload.data());
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <mbedtls/aes.h>
+
+struct AudioStreamPacket {
+    int sample_rate = 0;
+    int frame_duration = 0;
+    uint32_t timestamp = 0;
+    std::vector<uint8_t> payload;
+};
+
+struct BinaryProtocol2 {
+    uint16_t version;
+    uint16_t type;          // Message type (0: OPUS, 1: JSON)
+    uint32_t reserved;      // Reserved for future use
+    uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
+    uint32_t payload_size;  // Payload size in bytes
+    uint8_t payload[];      // Payload data
+} __attribute__((packed));
+
+struct BinaryProtocol3 {
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t payload_size;
+    uint8_t payload[];
+} __attribute__((packed));
+
+// The UDP audio header doubles as the AES-CTR nonce
+#define UDP_AUDIO_HEADER_SIZE 16
+
+// Fill in the timestamp and payload of a WebSocket binary frame. They return false for
+// a frame shorter than its header or its payload size, without touching the packet.
+bool ParseBinaryProtocol2(const uint8_t* data, size_t size, AudioStreamPacket& packet);
+bool ParseBinaryProtocol3(const uint8_t* data, size_t size, AudioStreamPacket& packet);
+
+/*
+ * UDP Encrypted OPUS Packet Format:
+ * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
+ * |payload payload_len|
+ */
+// nonce is the session's header template, its type, flags and ssrc are kept
+bool EncryptUdpAudioPacket(mbedtls_aes_context& aes, const std::string& nonce, const AudioStreamPacket& packet,
+    uint32_t sequence, std::string& encrypted);
+// Returns false for a malformed packet or when the payload fails to decrypt
+bool DecryptUdpAudioPacket(mbedtls_aes_context& aes, const std::string& data, AudioStreamPacket& packet,
+    uint32_t& sequence);
+
+#endif // BINARY_PROTOCOL_H
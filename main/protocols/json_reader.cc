@@ -0,0 +1,345 @@
+#include "json_reader.h"
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+// Nesting deeper than this is treated as malformed
+#define JSON_MAX_DEPTH 32
+
+static inline size_t SkipWhitespace(std::string_view json, size_t i) {
+    while (i < json.size() && (json[i] == ' ' || json[i] == '\t' || json[i] == '\n' || json[i] == '\r')) {
+        i++;
+    }
+    return i;
+}
+
+// Returns the position after the closing quote of the string starting at i, or npos
+static size_t SkipString(std::string_view json, size_t i) {
+    for (i++; i < json.size(); i++) {
+        if (json[i] == '\\') {
+            i++;
+        } else if (json[i] == '"') {
+            return i + 1;
+        }
+    }
+    return std::string_view::npos;
+}
+
+static inline bool IsDelimiter(char c) {
+    return c == ',' || c == '}' || c == ']' || c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline size_t SkipDigits(std::string_view json, size_t i) {
+    while (i < json.size() && json[i] >= '0' && json[i] <= '9') {
+        i++;
+    }
+    return i;
+}
+
+// Returns the position after the number starting at i, or npos when it does not follow
+// the JSON grammar: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+static size_t SkipNumber(std::string_view json, size_t i) {
+    if (i < json.size() && json[i] == '-') {
+        i++;
+    }
+    size_t end = SkipDigits(json, i);
+    if (end == i || (json[i] == '0' && end > i + 1)) {
+        return std::string_view::npos;
+    }
+    i = end;
+    if (i < json.size() && json[i] == '.') {
+        end = SkipDigits(json, i + 1);
+        if (end == i + 1) {
+            return std::string_view::npos;
+        }
+        i = end;
+    }
+    if (i < json.size() && (json[i] == 'e' || json[i] == 'E')) {
+        i++;
+        if (i < json.size() && (json[i] == '+' || json[i] == '-')) {
+            i++;
+        }
+        end = SkipDigits(json, i);
+        if (end == i) {
+            return std::string_view::npos;
+        }
+        i = end;
+    }
+    return i;
+}
+
+// Returns the position after the value starting at i, or npos
+static size_t SkipValue(std::string_view json, size_t i, JsonValueType& type) {
+    if (i >= json.size()) {
+        return std::string_view::npos;
+    }
+    char c = json[i];
+    if (c == '"') {
+        type = kJsonString;
+        return SkipString(json, i);
+    }
+    if (c == '{' || c == '[') {
+        type = c == '{' ? kJsonObject : kJsonArray;
+        // The closing bracket expected at each level
+        char closing[JSON_MAX_DEPTH];
+        int depth = 0;
+        while (i < json.size()) {
+            c = json[i];
+            if (c == '"') {
+                i = SkipString(json, i);
+                if (i == std::string_view::npos) {
+                    return i;
+                }
+                continue;
+            }
+            if (c == '{' || c == '[') {
+                if (depth == JSON_MAX_DEPTH) {
+                    return std::string_view::npos;
+                }
+                closing[depth++] = c == '{' ? '}' : ']';
+            } else if (c == '}' || c == ']') {
+                if (c != closing[--depth]) {
+                    return std::string_view::npos;
+                }
+                if (depth == 0) {
+                    return i + 1;
+                }
+            }
+            i++;
+        }
+        return std::string_view::npos;
+    }
+
+    // Literals and numbers must be followed by a delimiter or the end of the text
+    size_t end;
+    if (json.substr(i, 4) == "true") {
+        type = kJsonBool;
+        end = i + 4;
+    } else if (json.substr(i, 5) == "false") {
+        type = kJsonBool;
+        end = i + 5;
+    } else if (json.substr(i, 4) == "null") {
+        type = kJsonNull;
+        end = i + 4;
+    } else {
+        type = kJsonNumber;
+        end = SkipNumber(json, i);
+        if (end == std::string_view::npos) {
+            return end;
+        }
+    }
+    if (end < json.size() && !IsDelimiter(json[end])) {
+        return std::string_view::npos;
+    }
+    return end;
+}
+
+JsonObject::JsonObject(std::string_view json) {
+    // Trailing NULs from C strings are not part of the text
+    while (!json.empty() && json.back() == '\0') {
+        json.remove_suffix(1);
+    }
+    size_t start = SkipWhitespace(json, 0);
+    if (start >= json.size() || json[start] != '{') {
+        return;
+    }
+    JsonValueType type;
+    size_t end = SkipValue(json, start, type);
+    if (end == std::string_view::npos) {
+        return;
+    }
+    json_ = json.substr(start, end - start);
+
+    // Check the members once so lookups can trust the layout
+    size_t position = 0;
+    std::string_view key;
+    JsonValue value;
+    while (Next(position, key, value)) {
+    }
+    valid_ = position == json_.size();
+}
+
+bool JsonObject::Next(size_t& position, std::string_view& key, JsonValue& value) const {
+    if (json_.empty() || position >= json_.size()) {
+        return false;
+    }
+    // Position 0 is the opening brace, later positions follow the previous value
+    size_t i = SkipWhitespace(json_, position == 0 ? 1 : position);
+    if (i < json_.size() && json_[i] == '}') {
+        position = json_.size();
+        return false;
+    }
+    if (position != 0) {
+        if (i >= json_.size() || json_[i] != ',') {
+            return false;
+        }
+        i = SkipWhitespace(json_, i + 1);
+    }
+
+    if (i >= json_.size() || json_[i] != '"') {
+        return false;
+    }
+    size_t key_end = SkipString(json_, i);
+    if (key_end == std::string_view::npos) {
+        return false;
+    }
+    key = json_.substr(i + 1, key_end - i - 2);
+    i = SkipWhitespace(json_, key_end);
+    if (i >= json_.size() || json_[i] != ':') {
+        return false;
+    }
+    i = SkipWhitespace(json_, i + 1);
+    JsonValueType type = kJsonNone;
+    size_t value_end = SkipValue(json_, i, type);
+    if (value_end == std::string_view::npos) {
+        return false;
+    }
+    value = JsonValue(type, json_.substr(i, value_end - i));
+    position = value_end;
+    return true;
+}
+
+JsonValue JsonObject::Find(std::string_view key) const {
+    if (!valid_) {
+        return JsonValue();
+    }
+    size_t position = 0;
+    std::string_view member;
+    JsonValue value;
+    while (Next(position, member, value)) {
+        // Keys are compared as written, servers do not escape the ones we look for
+        if (member == key) {
+            return value;
+        }
+    }
+    return JsonValue();
+}
+
+static int HexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static void AppendUtf8(std::string& output, uint32_t code_point) {
+    if (code_point < 0x80) {
+        output += (char)code_point;
+    } else if (code_point < 0x800) {
+        output += (char)(0xC0 | (code_point >> 6));
+        output += (char)(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        output += (char)(0xE0 | (code_point >> 12));
+        output += (char)(0x80 | ((code_point >> 6) & 0x3F));
+        output += (char)(0x80 | (code_point & 0x3F));
+    } else {
+        output += (char)(0xF0 | (code_point >> 18));
+        output += (char)(0x80 | ((code_point >> 12) & 0x3F));
+        output += (char)(0x80 | ((code_point >> 6) & 0x3F));
+        output += (char)(0x80 | (code_point & 0x3F));
+    }
+}
+
+static bool ReadHex4(std::string_view text, size_t i, uint32_t& value) {
+    if (i + 4 > text.size()) {
+        return false;
+    }
+    value = 0;
+    for (size_t j = i; j < i + 4; j++) {
+        int digit = HexValue(text[j]);
+        if (digit < 0) {
+            return false;
+        }
+        value = (value << 4) | digit;
+    }
+    return true;
+}
+
+bool JsonValue::GetString(std::string& value) const {
+    if (type_ != kJsonString) {
+        return false;
+    }
+    std::string_view text = raw_.substr(1, raw_.size() - 2);
+    value.clear();
+    value.reserve(text.size());
+    size_t run = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != '\\') {
+            continue;
+        }
+        value.append(text.data() + run, i - run);
+        if (++i >= text.size()) {
+            return false;
+        }
+        switch (text[i]) {
+            case 'n': value += '\n'; break;
+            case 'r': value += '\r'; break;
+            case 't': value += '\t'; break;
+            case 'b': value += '\b'; break;
+            case 'f': value += '\f'; break;
+            case 'u': {
+                uint32_t code_point;
+                if (!ReadHex4(text, i + 1, code_point)) {
+                    return false;
+                }
+                i += 4;
+                // Surrogate pair
+                uint32_t low;
+                if (code_point >= 0xD800 && code_point < 0xDC00 && i + 2 < text.size() && text[i + 1] == '\\'
+                    && text[i + 2] == 'u' && ReadHex4(text, i + 3, low) && low >= 0xDC00 && low < 0xE000) {
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                    i += 6;
+                }
+                AppendUtf8(value, code_point);
+                break;
+            }
+            default: value += text[i]; break;
+        }
+        run = i + 1;
+    }
+    value.append(text.data() + run, text.size() - run);
+    return true;
+}
+
+bool JsonValue::Equals(std::string_view value) const {
+    if (type_ != kJsonString) {
+        return false;
+    }
+    std::string_view text = raw_.substr(1, raw_.size() - 2);
+    if (text.find('\\') == std::string_view::npos) {
+        return text == value;
+    }
+    std::string unescaped;
+    return GetString(unescaped) && unescaped == value;
+}
+
+int JsonValue::AsInt(int default_value) const {
+    if (type_ != kJsonNumber) {
+        return default_value;
+    }
+    // The number is always followed by a delimiter inside the text. Out of range values
+    // saturate like cJSON's valueint, a plain cast would be undefined.
+    double number = strtod(raw_.data(), nullptr);
+    if (number >= INT_MAX) {
+        return INT_MAX;
+    }
+    if (number <= (double)INT_MIN) {
+        return INT_MIN;
+    }
+    return (int)number;
+}
+
+bool JsonValue::AsBool(bool default_value) const {
+    if (type_ != kJsonBool) {
+        return default_value;
+    }
+    return raw_[0] == 't';
+}
+
+JsonObject JsonValue::AsObject() const {
+    if (type_ != kJsonObject) {
+        return JsonObject();
+    }
+    return JsonObject(raw_);
+}
@@ -0,0 +1,72 @@
+#ifndef JSON_READER_H
+#define JSON_READER_H
+
+#include <string>
+#include <string_view>
+
+enum JsonValueType {
+    kJsonNone,      // Missing or malformed
+    kJsonNull,
+    kJsonBool,
+    kJsonNumber,
+    kJsonString,
+    kJsonObject,
+    kJsonArray
+};
+
+class JsonObject;
+
+// A value inside a JSON text. It only points into the text, nothing is copied until
+// a string with escapes is read.
+class JsonValue {
+public:
+    JsonValue() = default;
+    JsonValue(JsonValueType type, std::string_view raw) : type_(type), raw_(raw) {}
+
+    inline JsonValueType type() const { return type_; }
+    inline bool IsString() const { return type_ == kJsonString; }
+    inline bool IsNumber() const { return type_ == kJsonNumber; }
+    inline bool IsBool() const { return type_ == kJsonBool; }
+    inline bool IsObject() const { return type_ == kJsonObject; }
+    inline bool IsArray() const { return type_ == kJsonArray; }
+    // The value as it appears in the text, strings include their quotes
+    inline std::string_view raw() const { return raw_; }
+
+    // Unescapes a string value, returns false for other types
+    bool GetString(std::string& value) const;
+    // Compares a string value without unescaping when it has no escapes
+    bool Equals(std::string_view value) const;
+    int AsInt(int default_value = 0) const;
+    bool AsBool(bool default_value = false) const;
+    JsonObject AsObject() const;
+
+private:
+    JsonValueType type_ = kJsonNone;
+    std::string_view raw_;
+};
+
+// Pull reader over the members of a JSON object. Members are found by scanning the
+// text, nested values are skipped by matching brackets and only looked at when asked
+// for, so reading a few fields of a message needs no heap at all. Payloads that need
+// a full tree can still pass json() to cJSON_ParseWithLength.
+class JsonObject {
+public:
+    JsonObject() = default;
+    // Checks that the text is an object with well formed members
+    explicit JsonObject(std::string_view json);
+
+    inline bool valid() const { return valid_; }
+    inline std::string_view json() const { return json_; }
+
+    JsonValue Find(std::string_view key) const;
+    inline JsonValue operator[](std::string_view key) const { return Find(key); }
+
+    // Iterates over the members, start with position 0
+    bool Next(size_t& position, std::string_view& key, JsonValue& value) const;
+
+private:
+    std::string_view json_;
+    bool valid_ = false;
+};
+
+#endif // JSON_READER_H
@@ -0,0 +1,44 @@
+#include "json_writer.h"
+
+#include <cstdio>
+
+JsonWriter& JsonWriter::Int(int64_t value) {
+    Separate();
+    char buffer[24];
+    int length = snprintf(buffer, sizeof(buffer), "%lld", (long long)value);
+    output_.append(buffer, length);
+    need_comma_ = true;
+    return *this;
+}
+
+void JsonWriter::AppendString(std::string& output, std::string_view value) {
+    static const char hex[] = "0123456789abcdef";
+    output += '"';
+    // Copy runs of plain characters at once, only quotes, backslashes and control
+    // characters need escaping. UTF-8 passes through unchanged.
+    size_t run = 0;
+    for (size_t i = 0; i < value.size(); i++) {
+        unsigned char c = value[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        output.append(value.data() + run, i - run);
+        run = i + 1;
+        switch (c) {
+            case '"': output += "\\\""; break;
+            case '\\': output += "\\\\"; break;
+            case '\n': output += "\\n"; break;
+            case '\r': output += "\\r"; break;
+            case '\t': output += "\\t"; break;
+            case '\b': output += "\\b"; break;
+            case '\f': output += "\\f"; break;
+            default: {
+                char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+                output.append(escaped, sizeof(escaped));
+                break;
+            }
+        }
+    }
+    output.append(value.data() + run, value.size() - run);
+    output += '"';
+}
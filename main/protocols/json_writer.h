@@ -0,0 +1,60 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+// Writes compact JSON straight into a string, without building a cJSON tree first.
+// Values are appended to the output, so a buffer reused across messages only
+// allocates when a message outgrows it. Commas are inserted automatically, the
+// caller is responsible for balancing Begin/End and putting a key before every
+// object member.
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& output) : output_(output) {}
+
+    JsonWriter& BeginObject() { Separate(); output_ += '{'; need_comma_ = false; return *this; }
+    JsonWriter& EndObject() { output_ += '}'; need_comma_ = true; return *this; }
+    JsonWriter& BeginArray() { Separate(); output_ += '['; need_comma_ = false; return *this; }
+    JsonWriter& EndArray() { output_ += ']'; need_comma_ = true; return *this; }
+
+    JsonWriter& Key(std::string_view key) {
+        Separate();
+        AppendString(key);
+        output_ += ':';
+        need_comma_ = false;
+        return *this;
+    }
+
+    JsonWriter& String(std::string_view value) { Separate(); AppendString(value); need_comma_ = true; return *this; }
+    JsonWriter& Int(int64_t value);
+    JsonWriter& Bool(bool value) { Separate(); output_ += value ? "true" : "false"; need_comma_ = true; return *this; }
+    JsonWriter& Null() { Separate(); output_ += "null"; need_comma_ = true; return *this; }
+    // Appends an already serialized JSON value as is
+    JsonWriter& Raw(std::string_view json) { Separate(); output_ += json; need_comma_ = true; return *this; }
+
+    // Object members
+    JsonWriter& Field(std::string_view key, std::string_view value) { return Key(key).String(value); }
+    JsonWriter& Field(std::string_view key, const char* value) { return Key(key).String(value); }
+    JsonWriter& Field(std::string_view key, const std::string& value) { return Key(key).String(value); }
+    JsonWriter& Field(std::string_view key, int value) { return Key(key).Int(value); }
+    JsonWriter& Field(std::string_view key, int64_t value) { return Key(key).Int(value); }
+    JsonWriter& Field(std::string_view key, bool value) { return Key(key).Bool(value); }
+
+    // Escapes and quotes value onto output
+    static void AppendString(std::string& output, std::string_view value);
+
+private:
+    std::string& output_;
+    bool need_comma_ = false;
+
+    inline void Separate() {
+        if (need_comma_) {
+            output_ += ',';
+        }
+    }
+    inline void AppendString(std::string_view value) { AppendString(output_, value); }
+};
+
+#endif // JSON_WRITER_H
@@ -2,6 +2,7 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "json_writer.h"
 
 #include <esp_log.h>
 #include <ml307_mqtt.h>
@@ -61,24 +62,26 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
-        if (root == nullptr) {
+        JsonObject root(payload);
+        if (!root.valid()) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
             return;
         }
-        cJSON* type = cJSON_GetObjectItem(root, "type");
-        if (!cJSON_IsString(type)) {
+        auto type = root["type"];
+        if (!type.IsString()) {
             ESP_LOGE(TAG, "Message type is invalid");
-            cJSON_Delete(root);
             return;
         }
 
-        if (strcmp(type->valuestring, "hello") == 0) {
-            ParseServerHello(root);
-        } else if (strcmp(type->valuestring, "goodbye") == 0) {
-            auto session_id = cJSON_GetObjectItem(root, "session_id");
-            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
+        if (type.Equals("hello")) {
+            // Rare and read field by field, parse it fully
+            cJSON* hello = cJSON_ParseWithLength(payload.data(), payload.size());
+            ParseServerHello(hello);
+            cJSON_Delete(hello);
+        } else if (type.Equals("goodbye")) {
+            auto session_id = root["session_id"];
+            ESP_LOGI(TAG, "Received goodbye message, session_id: %.*s", (int)session_id.raw().size(), session_id.raw().data());
+            if (!session_id.IsString() || session_id.Equals(session_id_)) {
                 Application::GetInstance().Schedule([this]() {
                     CloseAudioChannel();
                 });
@@ -86,7 +89,6 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
         } else if (on_incoming_json_ != nullptr) {
             on_incoming_json_(root);
         }
-        cJSON_Delete(root);
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -128,23 +130,10 @@ bool MqttProtocol::SendAudio(const AudioStreamPacket& packet) {
         return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet.payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet.timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
     std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet.payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
-
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet.payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet.payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
-        ESP_LOGE(TAG, "Failed to encrypt audio data");
+    if (!EncryptUdpAudioPacket(aes_ctx_, aes_nonce_, packet, ++local_sequence_, encrypted)) {
         return false;
     }
-
     return udp_->Send(encrypted) > 0;
 }
 
@@ -157,10 +146,11 @@ void MqttProtocol::CloseAudioChannel() {
         }
     }
 
-    std::string message = "{";
-    message += "\"session_id\":\"" + session_id_ + "\",";
-    message += "\"type\":\"goodbye\"";
-    message += "}";
+    std::string message;
+    JsonWriter(message).BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "goodbye")
+        .EndObject();
     SendText(message);
 
     if (on_audio_channel_closed_ != nullptr) {
@@ -199,21 +189,11 @@ bool MqttProtocol::OpenAudioChannel() {
     }
     udp_ = Board::GetInstance().CreateUdp();
     udp_->OnMessage([this](const std::string& data) {
-        /*
-         * UDP Encrypted OPUS Packet Format:
-         * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
-         * |payload payload_len|
-         */
-        if (data.size() < sizeof(aes_nonce_)) {
-            ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
-            return;
-        }
-        if (data[0] != 0x01) {
-            ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
+        AudioStreamPacket packet;
+        uint32_t sequence;
+        if (!DecryptUdpAudioPacket(aes_ctx_, data, packet, sequence)) {
             return;
         }
-        uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
-        uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
         if (sequence < remote_sequence_) {
             ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
             return;
@@ -222,21 +202,8 @@ bool MqttProtocol::OpenAudioChannel() {
             ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
         }
 
-        size_t decrypted_size = data.size() - aes_nonce_.size();
-        size_t nc_off = 0;
-        uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        AudioStreamPacket packet;
         packet.sample_rate = server_sample_rate_;
         packet.frame_duration = server_frame_duration_;
-        packet.timestamp = timestamp;
-        packet.payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet.payload.data());
-        if (ret != 0) {
-            ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
-            return;
-        }
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
@@ -254,28 +221,27 @@ bool MqttProtocol::OpenAudioChannel() {
 
 std::string MqttProtocol::GetHelloMessage() {
     // 发送 hello 消息申请 UDP 通道
-    cJSON* root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "type", "hello");
-    cJSON_AddNumberToObject(root, "version", 3);
-    cJSON_AddStringToObject(root, "transport", "udp");
-    cJSON* features = cJSON_CreateObject();
+    std::string message;
+    JsonWriter writer(message);
+    writer.BeginObject()
+        .Field("type", "hello")
+        .Field("version", 3)
+        .Field("transport", "udp")
+        .Key("features").BeginObject();
 #if CONFIG_USE_SERVER_AEC
-    cJSON_AddBoolToObject(features, "aec", true);
+    writer.Field("aec", true);
 #endif
 #if CONFIG_IOT_PROTOCOL_MCP
-    cJSON_AddBoolToObject(features, "mcp", true);
+    writer.Field("mcp", true);
 #endif
-    cJSON_AddItemToObject(root, "features", features);
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
-    auto json_str = cJSON_PrintUnformatted(root);
-    std::string message(json_str);
-    cJSON_free(json_str);
-    cJSON_Delete(root);
+    writer.EndObject()
+        .Key("audio_params").BeginObject()
+            .Field("format", "opus")
+            .Field("sample_rate", 16000)
+            .Field("channels", 1)
+            .Field("frame_duration", OPUS_FRAME_DURATION_MS)
+        .EndObject()
+        .EndObject();
     return message;
 }
 
@@ -1,10 +1,11 @@
 #include "protocol.h"
+#include "json_writer.h"
 
 #include <esp_log.h>
 
 #define TAG "Protocol"
 
-void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
+void Protocol::OnIncomingJson(std::function<void(const JsonObject& root)> callback) {
     on_incoming_json_ = callback;
 }
 
@@ -32,36 +33,51 @@ void Protocol::SetError(const std::string& message) {
 }
 
 void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
+    std::string message;
+    JsonWriter writer(message);
+    writer.BeginObject().Field("session_id", session_id_).Field("type", "abort");
     if (reason == kAbortReasonWakeWordDetected) {
-        message += ",\"reason\":\"wake_word_detected\"";
+        writer.Field("reason", "wake_word_detected");
     }
-    message += "}";
+    writer.EndObject();
     SendText(message);
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    std::string message;
+    JsonWriter(message).BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "listen")
+        .Field("state", "detect")
+        .Field("text", wake_word)
+        .EndObject();
+    SendText(message);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
-    message += ",\"type\":\"listen\",\"state\":\"start\"";
+    const char* mode_str = "manual";
     if (mode == kListeningModeRealtime) {
-        message += ",\"mode\":\"realtime\"";
+        mode_str = "realtime";
     } else if (mode == kListeningModeAutoStop) {
-        message += ",\"mode\":\"auto\"";
-    } else {
-        message += ",\"mode\":\"manual\"";
+        mode_str = "auto";
     }
-    message += "}";
+    std::string message;
+    JsonWriter(message).BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "listen")
+        .Field("state", "start")
+        .Field("mode", mode_str)
+        .EndObject();
     SendText(message);
 }
 
 void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
+    std::string message;
+    JsonWriter(message).BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "listen")
+        .Field("state", "stop")
+        .EndObject();
     SendText(message);
 }
 
@@ -111,12 +127,25 @@ void Protocol::SendIotDescriptors(const std::string& descriptors) {
 }
 
 void Protocol::SendIotStates(const std::string& states) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"update\":true,\"states\":" + states + "}";
+    std::string message;
+    message.reserve(states.size() + 80);
+    JsonWriter(message).BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "iot")
+        .Field("update", true)
+        .Key("states").Raw(states)
+        .EndObject();
     SendText(message);
 }
 
 void Protocol::SendMcpMessage(const std::string& payload) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":" + payload + "}";
+    std::string message;
+    message.reserve(payload.size() + 64);
+    JsonWriter(message).BeginObject()
+        .Field("session_id", session_id_)
+        .Field("type", "mcp")
+        .Key("payload").Raw(payload)
+        .EndObject();
     SendText(message);
 }
 
@@ -7,28 +7,8 @@
 #include <chrono>
 #include <vector>
 
-struct AudioStreamPacket {
-    int sample_rate = 0;
-    int frame_duration = 0;
-    uint32_t timestamp = 0;
-    std::vector<uint8_t> payload;
-};
-
-struct BinaryProtocol2 {
-    uint16_t version;
-    uint16_t type;          // Message type (0: OPUS, 1: JSON)
-    uint32_t reserved;      // Reserved for future use
-    uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
-    uint32_t payload_size;  // Payload size in bytes
-    uint8_t payload[];      // Payload data
-} __attribute__((packed));
-
-struct BinaryProtocol3 {
-    uint8_t type;
-    uint8_t reserved;
-    uint16_t payload_size;
-    uint8_t payload[];
-} __attribute__((packed));
+#include "json_reader.h"
+#include "binary_protocol.h"
 
 enum AbortReason {
     kAbortReasonNone,
@@ -56,7 +36,7 @@ public:
     }
 
     void OnIncomingAudio(std::function<void(AudioStreamPacket&& packet)> callback);
-    void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    void OnIncomingJson(std::function<void(const JsonObject& root)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
@@ -75,7 +55,7 @@ public:
     virtual void SendMcpMessage(const std::string& message);
 
 protected:
-    std::function<void(const cJSON* root)> on_incoming_json_;
+    std::function<void(const JsonObject& root)> on_incoming_json_;
     std::function<void(AudioStreamPacket&& packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
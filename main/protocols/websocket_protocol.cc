@@ -3,6 +3,7 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "json_writer.h"
 
 #include <cstring>
 #include <cJSON.h>
@@ -116,30 +117,15 @@ bool WebsocketProtocol::OpenAudioChannel() {
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
             if (on_incoming_audio_ != nullptr) {
-                if (version_ == 2) {
-                    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
-                    bp2->version = ntohs(bp2->version);
-                    bp2->type = ntohs(bp2->type);
-                    bp2->timestamp = ntohl(bp2->timestamp);
-                    bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    });
-                } else if (version_ == 3) {
-                    BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
-                    bp3->type = bp3->type;
-                    bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    });
+                if (version_ == 2 || version_ == 3) {
+                    AudioStreamPacket packet;
+                    packet.sample_rate = server_sample_rate_;
+                    packet.frame_duration = server_frame_duration_;
+                    bool ok = version_ == 2 ? ParseBinaryProtocol2((const uint8_t*)data, len, packet)
+                        : ParseBinaryProtocol3((const uint8_t*)data, len, packet);
+                    if (ok) {
+                        on_incoming_audio_(std::move(packet));
+                    }
                 } else {
                     on_incoming_audio_(AudioStreamPacket{
                         .sample_rate = server_sample_rate_,
@@ -151,20 +137,22 @@ bool WebsocketProtocol::OpenAudioChannel() {
             }
         } else {
             // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (cJSON_IsString(type)) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
+            JsonObject root(std::string_view(data, len));
+            auto type = root["type"];
+            if (type.IsString()) {
+                if (type.Equals("hello")) {
+                    // Rare and read field by field, parse it fully
+                    cJSON* hello = cJSON_ParseWithLength(data, len);
+                    ParseServerHello(hello);
+                    cJSON_Delete(hello);
                 } else {
                     if (on_incoming_json_ != nullptr) {
                         on_incoming_json_(root);
                     }
                 }
             } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+                ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)len, data);
             }
-            cJSON_Delete(root);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
@@ -206,28 +194,27 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
 std::string WebsocketProtocol::GetHelloMessage() {
     // keys: message type, version, audio_params (format, sample_rate, channels)
-    cJSON* root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "type", "hello");
-    cJSON_AddNumberToObject(root, "version", version_);
-    cJSON* features = cJSON_CreateObject();
+    std::string message;
+    JsonWriter writer(message);
+    writer.BeginObject()
+        .Field("type", "hello")
+        .Field("version", version_)
+        .Field("transport", "websocket")
+        .Key("features").BeginObject();
 #if CONFIG_USE_SERVER_AEC
-    cJSON_AddBoolToObject(features, "aec", true);
+    writer.Field("aec", true);
 #endif
 #if CONFIG_IOT_PROTOCOL_MCP
-    cJSON_AddBoolToObject(features, "mcp", true);
+    writer.Field("mcp", true);
 #endif
-    cJSON_AddItemToObject(root, "features", features);
-    cJSON_AddStringToObject(root, "transport", "websocket");
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
-    auto json_str = cJSON_PrintUnformatted(root);
-    std::string message(json_str);
-    cJSON_free(json_str);
-    cJSON_Delete(root);
+    writer.EndObject()
+        .Key("audio_params").BeginObject()
+            .Field("format", "opus")
+            .Field("sample_rate", 16000)
+            .Field("channels", 1)
+            .Field("frame_duration", OPUS_FRAME_DURATION_MS)
+        .EndObject()
+        .EndObject();
     return message;
 }
 
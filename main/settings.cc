@@ -1,67 +1,260 @@
 #include "settings.h"
 
 #include <esp_log.h>
+#include <esp_system.h>
 #include <nvs_flash.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <map>
+#include <mutex>
+#include <vector>
 
 #define TAG "Settings"
 
-Settings::Settings(const std::string& ns, bool read_write) : ns_(ns), read_write_(read_write) {
-    nvs_open(ns.c_str(), read_write_ ? NVS_READWRITE : NVS_READONLY, &nvs_handle_);
-}
+// Delay from the first pending change to the write-back
+#define SETTINGS_WRITE_BACK_DELAY_MS 1000
+#define SETTINGS_WRITE_BACK_STACK_SIZE 4096
 
-Settings::~Settings() {
-    if (nvs_handle_ != 0) {
-        if (read_write_ && dirty_) {
-            ESP_ERROR_CHECK(nvs_commit(nvs_handle_));
+namespace {
+
+struct CachedValue {
+    enum Type { kMissing, kInt, kString };
+    Type type = kMissing;
+    int32_t int_value = 0;
+    std::string string_value;
+    bool dirty = false;     // Differs from NVS, a dirty kMissing is a pending erase
+};
+
+class SettingsCache {
+public:
+    static SettingsCache& GetInstance() {
+        static SettingsCache instance;
+        return instance;
+    }
+
+    bool Get(const std::string& ns, const std::string& key, CachedValue::Type type, CachedValue& value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& entry = Lookup(ns, key);
+        if (entry.type != type) {
+            return false;
         }
-        nvs_close(nvs_handle_);
+        value = entry;
+        return true;
     }
-}
 
-std::string Settings::GetString(const std::string& key, const std::string& default_value) {
-    if (nvs_handle_ == 0) {
-        return default_value;
+    void Set(const std::string& ns, const std::string& key, const CachedValue& value) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& entry = Lookup(ns, key);
+            if (entry.type == value.type && entry.int_value == value.int_value
+                && entry.string_value == value.string_value) {
+                return;
+            }
+            entry = value;
+            entry.dirty = true;
+            ScheduleWriteBack();
+        }
+        Notify(ns, key);
     }
 
-    size_t length = 0;
-    if (nvs_get_str(nvs_handle_, key.c_str(), nullptr, &length) != ESP_OK) {
-        return default_value;
+    void EraseAll(const std::string& ns) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            nvs_handle_t handle;
+            if (nvs_open(ns.c_str(), NVS_READWRITE, &handle) == ESP_OK) {
+                ESP_ERROR_CHECK(nvs_erase_all(handle));
+                ESP_ERROR_CHECK(nvs_commit(handle));
+                nvs_close(handle);
+            }
+            namespaces_.erase(ns);
+        }
+        Notify(ns, "");
+    }
+
+    void Flush() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        write_back_pending_ = false;
+        for (auto& [ns, values] : namespaces_) {
+            WriteBack(ns, values);
+        }
+    }
+
+    int AddObserver(const std::string& ns, SettingsObserver observer) {
+        std::lock_guard<std::mutex> lock(observers_mutex_);
+        int id = next_observer_id_++;
+        observers_[id] = {ns, std::move(observer)};
+        return id;
+    }
+
+    void RemoveObserver(int id) {
+        std::lock_guard<std::mutex> lock(observers_mutex_);
+        observers_.erase(id);
+    }
+
+private:
+    std::mutex mutex_;
+    std::map<std::string, std::map<std::string, CachedValue>> namespaces_;
+    TaskHandle_t write_back_task_ = nullptr;
+    bool write_back_pending_ = false;
+
+    std::mutex observers_mutex_;
+    std::map<int, std::pair<std::string, SettingsObserver>> observers_;
+    int next_observer_id_ = 1;
+
+    SettingsCache() {
+        // NVS writes can take a while, keep them off the esp_timer task
+        xTaskCreate([](void* arg) {
+            auto cache = static_cast<SettingsCache*>(arg);
+            while (true) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                vTaskDelay(pdMS_TO_TICKS(SETTINGS_WRITE_BACK_DELAY_MS));
+                cache->Flush();
+            }
+        }, "settings_write_back", SETTINGS_WRITE_BACK_STACK_SIZE, this, 1, &write_back_task_);
+        esp_register_shutdown_handler([]() {
+            SettingsCache::GetInstance().Flush();
+        });
+    }
+
+    // Returns the cached entry, reading it from NVS on the first access
+    CachedValue& Lookup(const std::string& ns, const std::string& key) {
+        auto& values = namespaces_[ns];
+        auto it = values.find(key);
+        if (it != values.end()) {
+            return it->second;
+        }
+
+        auto& entry = values[key];
+        nvs_handle_t handle;
+        if (nvs_open(ns.c_str(), NVS_READONLY, &handle) != ESP_OK) {
+            return entry;
+        }
+        // NVS keys are typed, load whichever one is stored so a later read of the other
+        // type still sees it as mismatched rather than missing
+        size_t length = 0;
+        if (nvs_get_i32(handle, key.c_str(), &entry.int_value) == ESP_OK) {
+            entry.type = CachedValue::kInt;
+        } else if (nvs_get_str(handle, key.c_str(), nullptr, &length) == ESP_OK) {
+            entry.string_value.resize(length);
+            ESP_ERROR_CHECK(nvs_get_str(handle, key.c_str(), entry.string_value.data(), &length));
+            while (!entry.string_value.empty() && entry.string_value.back() == '\0') {
+                entry.string_value.pop_back();
+            }
+            entry.type = CachedValue::kString;
+        }
+        nvs_close(handle);
+        return entry;
     }
 
-    std::string value;
-    value.resize(length);
-    ESP_ERROR_CHECK(nvs_get_str(nvs_handle_, key.c_str(), value.data(), &length));
-    while (!value.empty() && value.back() == '\0') {
-        value.pop_back();
+    void ScheduleWriteBack() {
+        if (!write_back_pending_) {
+            write_back_pending_ = true;
+            xTaskNotifyGive(write_back_task_);
+        }
+    }
+
+    void WriteBack(const std::string& ns, std::map<std::string, CachedValue>& values) {
+        nvs_handle_t handle = 0;
+        int written = 0;
+        for (auto& [key, value] : values) {
+            if (!value.dirty) {
+                continue;
+            }
+            if (handle == 0 && nvs_open(ns.c_str(), NVS_READWRITE, &handle) != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to open namespace %s", ns.c_str());
+                return;
+            }
+            esp_err_t ret;
+            switch (value.type) {
+                case CachedValue::kInt:
+                    ret = nvs_set_i32(handle, key.c_str(), value.int_value);
+                    break;
+                case CachedValue::kString:
+                    ret = nvs_set_str(handle, key.c_str(), value.string_value.c_str());
+                    break;
+                default:
+                    ret = nvs_erase_key(handle, key.c_str());
+                    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+                        ret = ESP_OK;
+                    }
+                    break;
+            }
+            // A failed change stays dirty and is retried with the next write-back
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write %s.%s: %s", ns.c_str(), key.c_str(), esp_err_to_name(ret));
+                continue;
+            }
+            value.dirty = false;
+            written++;
+        }
+        if (handle != 0) {
+            auto ret = nvs_commit(handle);
+            nvs_close(handle);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to commit %s: %s", ns.c_str(), esp_err_to_name(ret));
+                return;
+            }
+            ESP_LOGI(TAG, "Committed %d change(s) to %s", written, ns.c_str());
+        }
+    }
+
+    void Notify(const std::string& ns, const std::string& key) {
+        std::vector<SettingsObserver> observers;
+        {
+            std::lock_guard<std::mutex> lock(observers_mutex_);
+            for (auto& [id, observer] : observers_) {
+                if (observer.first.empty() || observer.first == ns) {
+                    observers.push_back(observer.second);
+                }
+            }
+        }
+        for (auto& observer : observers) {
+            observer(ns, key);
+        }
+    }
+};
+
+} // namespace
+
+Settings::Settings(const std::string& ns, bool read_write) : ns_(ns), read_write_(read_write) {
+}
+
+Settings::~Settings() {
+}
+
+std::string Settings::GetString(const std::string& key, const std::string& default_value) {
+    CachedValue value;
+    if (!SettingsCache::GetInstance().Get(ns_, key, CachedValue::kString, value)) {
+        return default_value;
     }
-    return value;
+    return value.string_value;
 }
 
 void Settings::SetString(const std::string& key, const std::string& value) {
     if (read_write_) {
-        ESP_ERROR_CHECK(nvs_set_str(nvs_handle_, key.c_str(), value.c_str()));
-        dirty_ = true;
+        CachedValue cached;
+        cached.type = CachedValue::kString;
+        cached.string_value = value;
+        SettingsCache::GetInstance().Set(ns_, key, cached);
     } else {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
     }
 }
 
 int32_t Settings::GetInt(const std::string& key, int32_t default_value) {
-    if (nvs_handle_ == 0) {
-        return default_value;
-    }
-
-    int32_t value;
-    if (nvs_get_i32(nvs_handle_, key.c_str(), &value) != ESP_OK) {
+    CachedValue value;
+    if (!SettingsCache::GetInstance().Get(ns_, key, CachedValue::kInt, value)) {
         return default_value;
     }
-    return value;
+    return value.int_value;
 }
 
 void Settings::SetInt(const std::string& key, int32_t value) {
     if (read_write_) {
-        ESP_ERROR_CHECK(nvs_set_i32(nvs_handle_, key.c_str(), value));
-        dirty_ = true;
+        CachedValue cached;
+        cached.type = CachedValue::kInt;
+        cached.int_value = value;
+        SettingsCache::GetInstance().Set(ns_, key, cached);
     } else {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
     }
@@ -69,10 +262,7 @@ void Settings::SetInt(const std::string& key, int32_t value) {
 
 void Settings::EraseKey(const std::string& key) {
     if (read_write_) {
-        auto ret = nvs_erase_key(nvs_handle_, key.c_str());
-        if (ret != ESP_ERR_NVS_NOT_FOUND) {
-            ESP_ERROR_CHECK(ret);
-        }
+        SettingsCache::GetInstance().Set(ns_, key, CachedValue());
     } else {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
     }
@@ -80,8 +270,20 @@ void Settings::EraseKey(const std::string& key) {
 
 void Settings::EraseAll() {
     if (read_write_) {
-        ESP_ERROR_CHECK(nvs_erase_all(nvs_handle_));
+        SettingsCache::GetInstance().EraseAll(ns_);
     } else {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
     }
 }
+
+void Settings::Flush() {
+    SettingsCache::GetInstance().Flush();
+}
+
+int Settings::AddObserver(const std::string& ns, SettingsObserver observer) {
+    return SettingsCache::GetInstance().AddObserver(ns, std::move(observer));
+}
+
+void Settings::RemoveObserver(int id) {
+    SettingsCache::GetInstance().RemoveObserver(id);
+}
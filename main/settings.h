@@ -2,8 +2,16 @@
 #define SETTINGS_H
 
 #include <string>
+#include <functional>
 #include <nvs_flash.h>
 
+// Called with the namespace and key after a value changes
+using SettingsObserver = std::function<void(const std::string& ns, const std::string& key)>;
+
+// Settings are served from a process-wide cache, so constructing one is cheap. Writes
+// land in the cache and are written back to NVS shortly after, changes that arrive
+// close together share one commit on a small task. Pending writes are also flushed on
+// esp_restart() and before the power save timer shuts the device down.
 class Settings {
 public:
     Settings(const std::string& ns, bool read_write = false);
@@ -16,11 +24,15 @@ public:
     void EraseKey(const std::string& key);
     void EraseAll();
 
+    // Writes pending changes to NVS now
+    static void Flush();
+    // An empty namespace observes every namespace
+    static int AddObserver(const std::string& ns, SettingsObserver observer);
+    static void RemoveObserver(int id);
+
 private:
     std::string ns_;
-    nvs_handle_t nvs_handle_ = 0;
     bool read_write_ = false;
-    bool dirty_ = false;
 };
 
 #endif
@@ -100,6 +100,8 @@ class CompressMethod(Enum):
     NONE = 0x00
     RLE = 0x01
     LZ4 = 0x02
+    # Not an LVGL method, decoded by the firmware's TiledImageDecoder, C array only
+    TILED_RLE = 0x10
 
 
 class ColorFormat(Enum):
@@ -316,7 +318,9 @@ def write_c_array_file(
     varname = varname.replace(".", "_")
 
     flags = "0"
-    if compress is not CompressMethod.NONE:
+    if compress is CompressMethod.TILED_RLE:
+        flags += " | LV_IMAGE_FLAGS_USER1"
+    elif compress is not CompressMethod.NONE:
         flags += " | LV_IMAGE_FLAGS_COMPRESSED"
     if premultiplied:
         flags += " | LV_IMAGE_FLAGS_PREMULTIPLIED"
@@ -488,6 +492,47 @@ class LVGLCompressData:
         return bin
 
 
+class TiledRLEData:
+    '''
+    Pixel data split into strips of rows that are RLE compressed one by one, so the
+    firmware can decode any strip straight into a small draw buffer. Little endian:
+    "TRLE", uint16 rows per strip, uint16 strip count, uint32 offset of each strip
+    from the start of the data plus the end offset, then the strips. Rows are stored
+    without stride padding. Only formats with whole byte pixels are supported.
+    '''
+
+    MAGIC = b"TRLE"
+
+    def __init__(self,
+                 cf: ColorFormat,
+                 w: int,
+                 h: int,
+                 stride: int,
+                 raw_data: bytes,
+                 strip_rows: int = 16):
+        if cf.bpp % 8 or cf.is_indexed or cf is ColorFormat.RGB565A8:
+            raise ParameterError(f"Tiled RLE does not support {cf.name}")
+        self.blk_size = cf.bpp // 8
+        row_size = w * self.blk_size
+
+        strips = []
+        for y in range(0, h, strip_rows):
+            rows = b"".join(raw_data[r * stride:r * stride + row_size]
+                            for r in range(y, min(y + strip_rows, h)))
+            strips.append(RLEImage().rle_compress(rows, self.blk_size))
+
+        self.data = bytearray(self.MAGIC)
+        self.data += uint16_t(strip_rows)
+        self.data += uint16_t(len(strips))
+        offset = len(self.data) + (len(strips) + 1) * 4
+        for strip in strips:
+            self.data += uint32_t(offset)
+            offset += len(strip)
+        self.data += uint32_t(offset)
+        for strip in strips:
+            self.data += strip
+
+
 class LVGLImage:
 
     def __init__(self,
@@ -750,6 +795,8 @@ class LVGLImage:
         """
         self._check_ext(filename, ".bin")
         self._check_dir(filename)
+        if compress == CompressMethod.TILED_RLE:
+            raise ParameterError("Tiled RLE is only supported for C arrays")
 
         with open(filename, "wb+") as f:
             bin = bytearray()
@@ -776,7 +823,10 @@ class LVGLImage:
         self._check_ext(filename, ".c")
         self._check_dir(filename)
 
-        if compress != CompressMethod.NONE:
+        if compress == CompressMethod.TILED_RLE:
+            data = TiledRLEData(self.cf, self.w, self.h, self.stride,
+                                self.data).data
+        elif compress != CompressMethod.NONE:
             data = LVGLCompressData(self.cf, compress, self.data).compressed
         else:
             data = self.data
@@ -1336,7 +1386,7 @@ def main():
     parser.add_argument('--compress',
                         help=("Binary data compress method, default to NONE"),
                         default="NONE",
-                        choices=["NONE", "RLE", "LZ4"])
+                        choices=["NONE", "RLE", "LZ4", "TILED_RLE"])
 
     parser.add_argument('--align',
                         help="stride alignment in bytes for bin image",
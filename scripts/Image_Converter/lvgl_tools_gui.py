@@ -18,7 +18,7 @@ HELP_TEXT = """LVGL图片转换工具使用说明：
 4. 颜色格式：选择“自动识别”会根据图片是否透明自动选择，或手动指定
    除非你了解这个选项，否则建议使用自动识别，不然可能会出现一些意想不到的问题……
 
-5. 压缩方式：选择NONE或RLE压缩
+5. 压缩方式：选择NONE、RLE或TILED_RLE压缩（TILED_RLE按条带解压，仅用于固件内置图片）
    除非你了解这个选项，否则建议保持默认NONE不压缩
 
 6. 输出目录：设置转换后文件的保存路径
@@ -61,7 +61,7 @@ class ImageConverterApp:
         # 压缩方式
         ttk.Label(settings_frame, text="压缩方式:").grid(row=0, column=4, padx=2)
         ttk.Combobox(settings_frame, textvariable=self.compress_method,
-                    values=["NONE", "RLE"], width=8).grid(row=0, column=5, padx=2)
+                    values=["NONE", "RLE", "TILED_RLE"], width=10).grid(row=0, column=5, padx=2)
 
         # 文件操作框架
         file_frame = ttk.LabelFrame(self.root, text="输入文件")
@@ -187,7 +187,7 @@ class ImageConverterApp:
         
         # 解析转换参数
         width, height = map(int, self.resolution.get().split('x'))
-        compress = CompressMethod.RLE if self.compress_method.get() == "RLE" else CompressMethod.NONE
+        compress = CompressMethod[self.compress_method.get()]
 
         # 执行转换
         self.convert_images(input_files, width, height, compress)
@@ -223,6 +223,10 @@ class ImageConverterApp:
                             img = img.convert('RGB')
                             cf = ColorFormat.RGB565
 
+                    # TILED_RLE不支持分离的Alpha平面，改用ARGB8565
+                    if compress == CompressMethod.TILED_RLE and cf == ColorFormat.RGB565A8:
+                        cf = ColorFormat.ARGB8565
+
                     # 保存调整后的图片
                     base_name = os.path.splitext(os.path.basename(file_path))[0]
                     output_image_path = os.path.join(self.output_dir.get(), f"{base_name}_{width}x{height}.png")
@@ -0,0 +1,176 @@
+// Builds the hello, listen and MCP messages the device sends with JsonWriter and with a
+// cJSON tree, checks that both produce the same text, and reports the time and heap
+// allocations per message.
+#include "json_writer.h"
+
+#include <cJSON.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#define ITERATIONS 200000
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    if (void* p = malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static void* CountingMalloc(size_t size) {
+    allocations++;
+    return malloc(size);
+}
+
+static const char* kSessionId = "a3f1c2d4-5b6e-4f70-8a9b-0c1d2e3f4a5b";
+static const char* kToolResult = "{\"success\": true, \"result\": \"A cup of coffee on a wooden desk\"}";
+
+static std::string PrintAndDelete(cJSON* root) {
+    char* text = cJSON_PrintUnformatted(root);
+    std::string message(text);
+    cJSON_free(text);
+    cJSON_Delete(root);
+    return message;
+}
+
+static std::string HelloCjson() {
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "type", "hello");
+    cJSON_AddNumberToObject(root, "version", 3);
+    cJSON_AddStringToObject(root, "transport", "websocket");
+    cJSON* features = cJSON_CreateObject();
+    cJSON_AddBoolToObject(features, "aec", true);
+    cJSON_AddBoolToObject(features, "mcp", true);
+    cJSON_AddItemToObject(root, "features", features);
+    cJSON* audio_params = cJSON_CreateObject();
+    cJSON_AddStringToObject(audio_params, "format", "opus");
+    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
+    cJSON_AddNumberToObject(audio_params, "channels", 1);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", 60);
+    cJSON_AddItemToObject(root, "audio_params", audio_params);
+    return PrintAndDelete(root);
+}
+
+static void HelloWriter(std::string& message) {
+    message.clear();
+    JsonWriter(message).BeginObject()
+        .Field("type", "hello")
+        .Field("version", 3)
+        .Field("transport", "websocket")
+        .Key("features").BeginObject()
+            .Field("aec", true)
+            .Field("mcp", true)
+        .EndObject()
+        .Key("audio_params").BeginObject()
+            .Field("format", "opus")
+            .Field("sample_rate", 16000)
+            .Field("channels", 1)
+            .Field("frame_duration", 60)
+        .EndObject()
+        .EndObject();
+}
+
+static std::string ListenCjson() {
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "session_id", kSessionId);
+    cJSON_AddStringToObject(root, "type", "listen");
+    cJSON_AddStringToObject(root, "state", "start");
+    cJSON_AddStringToObject(root, "mode", "auto");
+    return PrintAndDelete(root);
+}
+
+static void ListenWriter(std::string& message) {
+    message.clear();
+    JsonWriter(message).BeginObject()
+        .Field("session_id", kSessionId)
+        .Field("type", "listen")
+        .Field("state", "start")
+        .Field("mode", "auto")
+        .EndObject();
+}
+
+// A tools/call reply inside the mcp message
+static std::string McpCjson() {
+    cJSON* content = cJSON_CreateObject();
+    cJSON_AddStringToObject(content, "type", "text");
+    cJSON_AddStringToObject(content, "text", kToolResult);
+    cJSON* contents = cJSON_CreateArray();
+    cJSON_AddItemToArray(contents, content);
+    cJSON* result = cJSON_CreateObject();
+    cJSON_AddItemToObject(result, "content", contents);
+    cJSON_AddBoolToObject(result, "isError", false);
+    cJSON* payload = cJSON_CreateObject();
+    cJSON_AddStringToObject(payload, "jsonrpc", "2.0");
+    cJSON_AddNumberToObject(payload, "id", 7);
+    cJSON_AddItemToObject(payload, "result", result);
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "session_id", kSessionId);
+    cJSON_AddStringToObject(root, "type", "mcp");
+    cJSON_AddItemToObject(root, "payload", payload);
+    return PrintAndDelete(root);
+}
+
+static void McpWriter(std::string& message) {
+    message.clear();
+    JsonWriter(message).BeginObject()
+        .Field("session_id", kSessionId)
+        .Field("type", "mcp")
+        .Key("payload").BeginObject()
+            .Field("jsonrpc", "2.0")
+            .Field("id", 7)
+            .Key("result").BeginObject()
+                .Key("content").BeginArray()
+                    .BeginObject().Field("type", "text").Field("text", kToolResult).EndObject()
+                .EndArray()
+                .Field("isError", false)
+            .EndObject()
+        .EndObject()
+        .EndObject();
+}
+
+template <typename Build>
+static void Measure(const char* name, Build build) {
+    allocations = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        build();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("  %-24s %8.0f ns %6.1f allocations\n", name, ns / ITERATIONS, (double)allocations / ITERATIONS);
+}
+
+template <typename BuildCjson, typename BuildWriter>
+static bool Compare(const char* name, BuildCjson build_cjson, BuildWriter build_writer) {
+    std::string expected = build_cjson();
+    std::string message;
+    build_writer(message);
+    if (message != expected) {
+        printf("%s differs\n  cJSON:      %s\n  JsonWriter: %s\n", name, expected.c_str(), message.c_str());
+        return false;
+    }
+
+    printf("%s (%zu bytes)\n", name, message.size());
+    Measure("cJSON", [&]() { build_cjson(); });
+    Measure("JsonWriter", [&]() { std::string fresh; build_writer(fresh); });
+    Measure("JsonWriter, reused", [&]() { build_writer(message); });
+    return true;
+}
+
+int main() {
+    cJSON_Hooks hooks = { CountingMalloc, free };
+    cJSON_InitHooks(&hooks);
+
+    bool ok = true;
+    ok &= Compare("hello", HelloCjson, HelloWriter);
+    ok &= Compare("listen", ListenCjson, ListenWriter);
+    ok &= Compare("mcp tools/call", McpCjson, McpWriter);
+    return ok ? 0 : 1;
+}
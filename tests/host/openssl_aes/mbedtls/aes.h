@@ -0,0 +1,42 @@
+// The mbedtls AES-CTR API on top of the OpenSSL AES block cipher, for hosts without the
+// mbedtls headers. The counter and offset handling follows mbedtls_aes_crypt_ctr: the
+// whole 16 byte nonce_counter is a big endian counter, updated in place.
+#ifndef MBEDTLS_AES_H
+#define MBEDTLS_AES_H
+
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/aes.h>
+
+#include <cstddef>
+#include <cstring>
+
+struct mbedtls_aes_context {
+    AES_KEY key;
+};
+
+inline void mbedtls_aes_init(mbedtls_aes_context* ctx) { memset(ctx, 0, sizeof(*ctx)); }
+inline void mbedtls_aes_free(mbedtls_aes_context* ctx) { memset(ctx, 0, sizeof(*ctx)); }
+inline int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits) {
+    return AES_set_encrypt_key(key, keybits, &ctx->key) == 0 ? 0 : -0x0020;
+}
+
+inline int mbedtls_aes_crypt_ctr(mbedtls_aes_context* ctx, size_t length, size_t* nc_off,
+    unsigned char nonce_counter[16], unsigned char stream_block[16], const unsigned char* input, unsigned char* output) {
+    size_t n = *nc_off;
+    if (n > 0x0F) {
+        return -0x0021;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (n == 0) {
+            AES_encrypt(nonce_counter, stream_block, &ctx->key);
+            for (int j = 15; j >= 0 && ++nonce_counter[j] == 0; j--) {
+            }
+        }
+        output[i] = input[i] ^ stream_block[n];
+        n = (n + 1) & 0x0F;
+    }
+    *nc_off = n;
+    return 0;
+}
+
+#endif // MBEDTLS_AES_H
@@ -0,0 +1,400 @@
+// Drives the WebSocket binary frame, UDP audio and JSON message parsers on the host.
+//   protocol_fuzz --fuzz          round trips and random mutations, meant for a sanitizer build
+//   protocol_fuzz --benchmark     packets/s and ns per packet of each receive path
+//   protocol_fuzz <file>...       replays each file as one packet through every parser
+// Built with -DPROTOCOL_LIBFUZZER it is a libFuzzer target instead.
+#include "binary_protocol.h"
+#include "json_reader.h"
+
+#include <esp_log.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#define FUZZ_ITERATIONS 200000
+#define BENCHMARK_PACKETS 500000
+// A 60ms OPUS frame at 16kHz is usually 100 to 200 bytes
+#define BENCHMARK_PAYLOAD_SIZE 160
+
+static const uint8_t kKey[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+static const char kNonce[UDP_AUDIO_HEADER_SIZE + 1] = "\x01\x00\x00\x00\x12\x34\x56\x78\x00\x00\x00\x00\x00\x00\x00\x00";
+
+static const char* kJsonSeeds[] = {
+    "{\"type\":\"hello\",\"transport\":\"websocket\",\"session_id\":\"a3f1c2d4\",\"audio_params\":{\"format\":\"opus\",\"sample_rate\":24000,\"channels\":1,\"frame_duration\":60}}",
+    "{\"type\":\"tts\",\"state\":\"sentence_start\",\"text\":\"\\u4f60\\u597d\\ud83d\\ude00 \\\"hi\\\"\",\"session_id\":\"a3f1c2d4\"}",
+    "{ \"type\" : \"mcp\", \"payload\" : {\"jsonrpc\":\"2.0\",\"id\":-7,\"params\":{\"name\":\"self.audio_speaker.set_volume\",\"arguments\":{\"volume\":5.5e1,\"mute\":false,\"list\":[1,[true,null],{\"a\":\"]\"}]}}} }",
+};
+
+// Packets from a server encrypting with a standard AES-128-CTR implementation (Python's
+// cryptography package). Sequence 0xffffffff makes the counter carry into the timestamp.
+static const char kServerHeader[] = "0100002812345678000003e8ffffffff";
+static const char kServerPayload[] = "7a8f392c2fe9eeac7c8cbfb5c0a06c9ed0be4f22083eb73eb4202fa31a36771db95ec8b7b1a461e9";
+
+static bool failed = false;
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failed = true; \
+        } \
+    } while (0)
+
+static std::vector<uint8_t> MakeBinaryProtocol2(const std::vector<uint8_t>& payload, uint32_t timestamp) {
+    std::vector<uint8_t> frame(sizeof(BinaryProtocol2) + payload.size());
+    auto bp2 = (BinaryProtocol2*)frame.data();
+    bp2->version = htons(2);
+    bp2->type = 0;
+    bp2->reserved = 0;
+    bp2->timestamp = htonl(timestamp);
+    bp2->payload_size = htonl(payload.size());
+    memcpy(bp2->payload, payload.data(), payload.size());
+    return frame;
+}
+
+static std::vector<uint8_t> MakeBinaryProtocol3(const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> frame(sizeof(BinaryProtocol3) + payload.size());
+    auto bp3 = (BinaryProtocol3*)frame.data();
+    bp3->type = 0;
+    bp3->reserved = 0;
+    bp3->payload_size = htons(payload.size());
+    memcpy(bp3->payload, payload.data(), payload.size());
+    return frame;
+}
+
+static std::string FromHex(const char* hex) {
+    std::string bytes;
+    for (size_t i = 0; hex[i] != '\0' && hex[i + 1] != '\0'; i += 2) {
+        bytes += (char)std::stoi(std::string(hex + i, 2), nullptr, 16);
+    }
+    return bytes;
+}
+
+static mbedtls_aes_context MakeAes() {
+    mbedtls_aes_context aes;
+    mbedtls_aes_init(&aes);
+    mbedtls_aes_setkey_enc(&aes, kKey, 128);
+    return aes;
+}
+
+// Reads every member of a valid object, and of the objects nested in it
+static void ReadJson(const JsonObject& object) {
+    auto json = object.json();
+    size_t position = 0;
+    std::string_view key;
+    JsonValue value;
+    while (object.Next(position, key, value)) {
+        CHECK(value.type() != kJsonNone);
+        CHECK(value.raw().data() >= json.data() && value.raw().data() + value.raw().size() <= json.data() + json.size());
+        CHECK(object.Find(key).type() != kJsonNone);
+        std::string text;
+        value.GetString(text);
+        value.Equals("hello");
+        value.AsInt();
+        value.AsBool();
+        // Nested members are only checked when the object is read
+        if (value.IsObject()) {
+            auto nested = value.AsObject();
+            if (nested.valid()) {
+                ReadJson(nested);
+            }
+        }
+    }
+    CHECK(position == json.size());
+}
+
+// Every parser must either reject the packet or return a payload that its header
+// describes and that lies inside the packet
+static void ParseAll(const uint8_t* data, size_t size) {
+    JsonObject root(std::string_view((const char*)data, size));
+    if (root.valid()) {
+        ReadJson(root);
+    }
+    AudioStreamPacket packet;
+    if (ParseBinaryProtocol2(data, size, packet)) {
+        auto bp2 = (const BinaryProtocol2*)data;
+        CHECK(packet.payload.size() == ntohl(bp2->payload_size));
+        CHECK(packet.payload.size() <= size - sizeof(BinaryProtocol2));
+        CHECK(packet.payload.empty() || memcmp(packet.payload.data(), bp2->payload, packet.payload.size()) == 0);
+    }
+    if (ParseBinaryProtocol3(data, size, packet)) {
+        auto bp3 = (const BinaryProtocol3*)data;
+        CHECK(packet.payload.size() == ntohs(bp3->payload_size));
+        CHECK(packet.payload.size() <= size - sizeof(BinaryProtocol3));
+    }
+    static mbedtls_aes_context aes = MakeAes();
+    std::string udp((const char*)data, size);
+    uint32_t sequence;
+    if (DecryptUdpAudioPacket(aes, udp, packet, sequence)) {
+        CHECK(packet.payload.size() <= size - UDP_AUDIO_HEADER_SIZE);
+    }
+}
+
+#ifdef PROTOCOL_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    host_log_quiet = true;
+    ParseAll(data, size);
+    if (failed) {
+        __builtin_trap();
+    }
+    return 0;
+}
+
+#else
+
+static void TestRoundTrips() {
+    std::vector<uint8_t> payload(BENCHMARK_PAYLOAD_SIZE);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = i * 7;
+    }
+
+    AudioStreamPacket packet;
+    auto bp2 = MakeBinaryProtocol2(payload, 123456);
+    CHECK(ParseBinaryProtocol2(bp2.data(), bp2.size(), packet));
+    CHECK(packet.timestamp == 123456 && packet.payload == payload);
+    auto bp3 = MakeBinaryProtocol3(payload);
+    CHECK(ParseBinaryProtocol3(bp3.data(), bp3.size(), packet));
+    CHECK(packet.payload == payload);
+
+    // Every truncation is rejected
+    for (size_t size = 0; size < bp2.size(); size++) {
+        CHECK(!ParseBinaryProtocol2(bp2.data(), size, packet));
+    }
+    for (size_t size = 0; size < bp3.size(); size++) {
+        CHECK(!ParseBinaryProtocol3(bp3.data(), size, packet));
+    }
+
+    auto aes = MakeAes();
+    AudioStreamPacket sent;
+    sent.timestamp = 98765;
+    sent.payload = payload;
+    std::string encrypted;
+    CHECK(EncryptUdpAudioPacket(aes, std::string(kNonce, UDP_AUDIO_HEADER_SIZE), sent, 42, encrypted));
+    CHECK(encrypted.size() == UDP_AUDIO_HEADER_SIZE + payload.size());
+    CHECK(memcmp(encrypted.data() + UDP_AUDIO_HEADER_SIZE, payload.data(), payload.size()) != 0);
+    uint32_t sequence = 0;
+    CHECK(DecryptUdpAudioPacket(aes, encrypted, packet, sequence));
+    CHECK(sequence == 42 && packet.timestamp == 98765 && packet.payload == payload);
+    // Trailing bytes after payload_len are ignored
+    CHECK(DecryptUdpAudioPacket(aes, encrypted + "junk", packet, sequence));
+    CHECK(packet.payload == payload);
+    CHECK(!DecryptUdpAudioPacket(aes, encrypted.substr(0, encrypted.size() - 1), packet, sequence));
+    CHECK(!DecryptUdpAudioPacket(aes, encrypted.substr(0, UDP_AUDIO_HEADER_SIZE - 1), packet, sequence));
+}
+
+// Checks the AES-CTR nonce handling against known answers rather than a round trip
+static void TestAesCtr() {
+    // NIST SP 800-38A F.5.1, the key is kKey
+    auto aes = MakeAes();
+    auto counter = FromHex("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff");
+    auto plain = FromHex("6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+        "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710");
+    auto expected = FromHex("874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+        "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee");
+    std::string cipher(plain.size(), '\0');
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    CHECK(mbedtls_aes_crypt_ctr(&aes, plain.size(), &nc_off, (uint8_t*)&counter[0], stream_block,
+        (const uint8_t*)plain.data(), (uint8_t*)&cipher[0]) == 0);
+    CHECK(cipher == expected);
+
+    // Decrypting what the server sent, and sending the same packet back byte for byte
+    auto header = FromHex(kServerHeader);
+    auto server_packet = header + FromHex(kServerPayload);
+    AudioStreamPacket packet;
+    uint32_t sequence = 0;
+    CHECK(DecryptUdpAudioPacket(aes, server_packet, packet, sequence));
+    CHECK(sequence == 0xffffffff && packet.timestamp == 1000 && packet.payload.size() == 40);
+    for (size_t i = 0; i < packet.payload.size(); i++) {
+        CHECK(packet.payload[i] == i);
+    }
+    // The session nonce only provides the type, flags and ssrc, and is not modified
+    std::string nonce = header;
+    nonce.replace(2, 2, 2, '\0');
+    nonce.replace(8, 8, 8, '\0');
+    const std::string nonce_before = nonce;
+    std::string encrypted;
+    CHECK(EncryptUdpAudioPacket(aes, nonce, packet, sequence, encrypted));
+    CHECK(encrypted == server_packet);
+    CHECK(nonce == nonce_before);
+}
+
+static void TestJson() {
+    for (auto seed : kJsonSeeds) {
+        CHECK(JsonObject(seed).valid());
+    }
+    JsonObject hello(kJsonSeeds[0]);
+    CHECK(hello["type"].Equals("hello"));
+    CHECK(hello["audio_params"].AsObject()["sample_rate"].AsInt() == 24000);
+    std::string text;
+    CHECK(JsonObject(kJsonSeeds[1])["text"].GetString(text) && text == "\xe4\xbd\xa0\xe5\xa5\xbd\xf0\x9f\x98\x80 \"hi\"");
+    auto arguments = JsonObject(kJsonSeeds[2])["payload"].AsObject()["params"].AsObject()["arguments"].AsObject();
+    CHECK(arguments.valid() && arguments["volume"].AsInt() == 55 && !arguments["mute"].AsBool(true));
+
+    // Out of range numbers saturate
+    CHECK(JsonObject("{\"a\":1e20}")["a"].AsInt() == INT_MAX);
+    CHECK(JsonObject("{\"a\":-1e400}")["a"].AsInt() == INT_MIN);
+    CHECK(JsonObject("{\"a\":-2147483648}")["a"].AsInt() == INT_MIN);
+    CHECK(JsonObject("{\"a\":-3.9}")["a"].AsInt() == -3);
+
+    const char* malformed[] = {
+        "{\"a\":1abc}", "{\"a\":-}", "{\"a\":01}", "{\"a\":1.}", "{\"a\":.5}", "{\"a\":1e}", "{\"a\":+1}",
+        "{\"a\":truex}", "{\"a\":nul}", "{\"a\":[}", "{\"a\":{]}", "{\"a\":[1,{\"b\":2]}}", "{\"a\":1",
+        "{\"a\" 1}", "{\"a\":1,}", "{a:1}", "[1]", "",
+    };
+    for (auto json : malformed) {
+        if (JsonObject(json).valid()) {
+            fprintf(stderr, "accepted malformed JSON: %s\n", json);
+            failed = true;
+        }
+    }
+    CHECK(JsonObject("{\"a\":0,\"b\":-0.5E+3,\"c\":[],\"d\":{}}").valid());
+}
+
+// Truncates, extends and flips bytes of valid packets, with a bias towards the headers
+static void Fuzz() {
+    std::mt19937 random(20250101);
+    std::vector<uint8_t> payload(BENCHMARK_PAYLOAD_SIZE, 0x5a);
+    auto aes = MakeAes();
+    AudioStreamPacket sent;
+    sent.payload = payload;
+    std::string udp;
+    EncryptUdpAudioPacket(aes, std::string(kNonce, UDP_AUDIO_HEADER_SIZE), sent, 1, udp);
+    std::vector<std::vector<uint8_t>> seeds = {
+        MakeBinaryProtocol2(payload, 1),
+        MakeBinaryProtocol3(payload),
+        std::vector<uint8_t>(udp.begin(), udp.end()),
+    };
+    for (auto json : kJsonSeeds) {
+        seeds.emplace_back(json, json + strlen(json));
+    }
+    // Bytes that change the structure of a JSON text
+    static const char kJsonBytes[] = "{}[]\",:\\-+.0123456789eEtrufalsn \x80";
+
+    for (int i = 0; i < FUZZ_ITERATIONS; i++) {
+        auto data = seeds[i % seeds.size()];
+        int mutations = 1 + random() % 4;
+        for (int m = 0; m < mutations; m++) {
+            switch (random() % 5) {
+                case 0:
+                    data.resize(random() % (data.size() + 1));
+                    break;
+                case 1:
+                    data.resize(data.size() + random() % 64, (uint8_t)random());
+                    break;
+                case 2:
+                    if (!data.empty()) {
+                        data[random() % data.size()] = kJsonBytes[random() % (sizeof(kJsonBytes) - 1)];
+                    }
+                    break;
+                default:
+                    if (!data.empty()) {
+                        size_t limit = random() % 2 ? std::min<size_t>(data.size(), UDP_AUDIO_HEADER_SIZE) : data.size();
+                        data[random() % limit] = (uint8_t)random();
+                    }
+                    break;
+            }
+        }
+        // Copy into an exact size buffer so the sanitizers catch any read past the end
+        std::unique_ptr<uint8_t[]> exact(new uint8_t[data.size()]);
+        memcpy(exact.get(), data.data(), data.size());
+        ParseAll(exact.get(), data.size());
+    }
+    printf("fuzz: %d mutated packets and messages, %d parser errors logged\n", FUZZ_ITERATIONS, host_log_errors);
+}
+
+template <typename Parse>
+static void Measure(const char* name, Parse parse) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCHMARK_PACKETS; i++) {
+        parse(i);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("  %-20s %8.1f ns/packet %10.0f packets/s\n", name, ns / BENCHMARK_PACKETS, BENCHMARK_PACKETS * 1e9 / ns);
+}
+
+// The receive and send paths as the protocols run them
+static void Benchmark() {
+    std::vector<uint8_t> payload(BENCHMARK_PAYLOAD_SIZE, 0x5a);
+    auto bp2 = MakeBinaryProtocol2(payload, 1);
+    auto bp3 = MakeBinaryProtocol3(payload);
+    auto aes = MakeAes();
+    const std::string nonce(kNonce, UDP_AUDIO_HEADER_SIZE);
+    AudioStreamPacket sent;
+    sent.payload = payload;
+    std::string udp;
+    EncryptUdpAudioPacket(aes, nonce, sent, 1, udp);
+
+    printf("%d byte payloads:\n", BENCHMARK_PAYLOAD_SIZE);
+    Measure("websocket v2", [&](int i) {
+        AudioStreamPacket packet;
+        CHECK(ParseBinaryProtocol2(bp2.data(), bp2.size(), packet));
+    });
+    Measure("websocket v3", [&](int i) {
+        AudioStreamPacket packet;
+        CHECK(ParseBinaryProtocol3(bp3.data(), bp3.size(), packet));
+    });
+    Measure("udp decrypt", [&](int i) {
+        AudioStreamPacket packet;
+        uint32_t sequence;
+        CHECK(DecryptUdpAudioPacket(aes, udp, packet, sequence));
+    });
+    Measure("udp encrypt", [&](int i) {
+        std::string encrypted;
+        CHECK(EncryptUdpAudioPacket(aes, nonce, sent, i, encrypted));
+    });
+}
+
+static bool Replay(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buffer[4096];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + size);
+    }
+    fclose(file);
+    std::unique_ptr<uint8_t[]> exact(new uint8_t[data.size()]);
+    memcpy(exact.get(), data.data(), data.size());
+    ParseAll(exact.get(), data.size());
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s --fuzz | --benchmark | <packet file>...\n", argv[0]);
+        return 2;
+    }
+    if (strcmp(argv[1], "--fuzz") == 0) {
+        // Rejected packets are expected here, only failed checks are reported
+        host_log_quiet = true;
+        TestRoundTrips();
+        TestAesCtr();
+        TestJson();
+        Fuzz();
+    } else if (strcmp(argv[1], "--benchmark") == 0) {
+        Benchmark();
+    } else {
+        for (int i = 1; i < argc; i++) {
+            if (!Replay(argv[i])) {
+                return 2;
+            }
+        }
+        printf("replayed %d packet(s)\n", argc - 1);
+    }
+    return failed ? 1 : 0;
+}
+
+#endif // PROTOCOL_LIBFUZZER
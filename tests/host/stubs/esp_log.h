@@ -0,0 +1,18 @@
+// Host stand-in for the ESP-IDF logger, errors and warnings are counted and go to stderr
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <cstdio>
+
+inline int host_log_errors = 0;
+inline bool host_log_quiet = false;
+
+#define HOST_LOG(level, tag, format, ...) do { \
+        if (!host_log_quiet) fprintf(stderr, level " (%s) " format "\n", tag, ##__VA_ARGS__); \
+    } while (0)
+#define ESP_LOGE(tag, format, ...) do { host_log_errors++; HOST_LOG("E", tag, format, ##__VA_ARGS__); } while (0)
+#define ESP_LOGW(tag, format, ...) HOST_LOG("W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG("I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) do {} while (0)
+
+#endif // ESP_LOG_H
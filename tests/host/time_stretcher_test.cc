@@ -0,0 +1,153 @@
+// Feeds WAV fixtures through TimeStretcher in 60ms blocks the way the speaker output
+// does, checks that no audio is lost or repeated, and reports the CPU time per block.
+#include "time_stretcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define FRAME_DURATION_MS 60
+
+struct Wav {
+    int sample_rate = 0;
+    std::vector<int16_t> pcm;
+};
+
+// Mono 16-bit PCM only
+static bool ReadWav(const char* path, Wav& wav) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buffer[4096];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + size);
+    }
+    fclose(file);
+
+    if (data.size() < 12 || memcmp(data.data(), "RIFF", 4) != 0 || memcmp(data.data() + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "%s is not a WAV file\n", path);
+        return false;
+    }
+    bool format_ok = false;
+    for (size_t pos = 12; pos + 8 <= data.size(); ) {
+        uint32_t chunk_size;
+        memcpy(&chunk_size, data.data() + pos + 4, 4);
+        const uint8_t* chunk = data.data() + pos + 8;
+        if (chunk_size > data.size() - pos - 8) {
+            break;
+        }
+        if (memcmp(data.data() + pos, "fmt ", 4) == 0 && chunk_size >= 16) {
+            uint16_t format, channels, bits;
+            uint32_t sample_rate;
+            memcpy(&format, chunk, 2);
+            memcpy(&channels, chunk + 2, 2);
+            memcpy(&sample_rate, chunk + 4, 4);
+            memcpy(&bits, chunk + 14, 2);
+            format_ok = format == 1 && channels == 1 && bits == 16;
+            wav.sample_rate = sample_rate;
+        } else if (memcmp(data.data() + pos, "data", 4) == 0 && format_ok) {
+            wav.pcm.resize(chunk_size / 2);
+            memcpy(wav.pcm.data(), chunk, wav.pcm.size() * 2);
+            return true;
+        }
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+    fprintf(stderr, "%s is not mono 16-bit PCM\n", path);
+    return false;
+}
+
+struct RunResult {
+    size_t output_samples = 0;
+    double expected_samples = 0;
+    int speed_changes = 0;
+    int blocks = 0;
+    double total_us = 0;
+    double max_us = 0;
+};
+
+// speed_of_block returns the playout speed for each block, the stream is drained at the end
+template <typename SpeedOfBlock>
+static RunResult Run(const Wav& wav, SpeedOfBlock speed_of_block) {
+    TimeStretcher stretcher;
+    stretcher.Configure(wav.sample_rate);
+    const size_t block_samples = wav.sample_rate * FRAME_DURATION_MS / 1000;
+
+    RunResult result;
+    int last_speed = 100;
+    for (size_t pos = 0; pos < wav.pcm.size(); pos += block_samples) {
+        size_t end = std::min(pos + block_samples, wav.pcm.size());
+        std::vector<int16_t> pcm(wav.pcm.begin() + pos, wav.pcm.begin() + end);
+        int speed = speed_of_block(result.blocks);
+        // The block that starts a speed change plays as it is
+        result.expected_samples += last_speed == 100 ? pcm.size() : pcm.size() * 100.0 / speed;
+        result.speed_changes += speed != last_speed;
+
+        auto start = std::chrono::steady_clock::now();
+        if (speed != 100 || stretcher.active()) {
+            stretcher.Process(pcm, speed);
+        }
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        result.total_us += us;
+        result.max_us = std::max(result.max_us, us);
+        result.output_samples += pcm.size();
+        result.blocks++;
+        last_speed = speed;
+    }
+    std::vector<int16_t> tail;
+    stretcher.Drain(tail);
+    result.output_samples += tail.size();
+    return result;
+}
+
+static bool Check(const char* fixture, const char* name, const Wav& wav, const RunResult& result) {
+    // Each splice may skip or repeat up to the seek window, nothing else may go missing
+    const double tolerance = (result.speed_changes + 1) * wav.sample_rate * 12 / 1000.0;
+    double error = result.output_samples - result.expected_samples;
+    bool ok = std::abs(error) <= tolerance;
+    printf("%-16s %-10s in=%zu out=%zu expected=%.0f error=%+.0f (max %.0f) cpu avg=%.1fus max=%.1fus per %dms block %s\n",
+        fixture, name, wav.pcm.size(), result.output_samples, result.expected_samples, error, tolerance,
+        result.total_us / result.blocks, result.max_us, FRAME_DURATION_MS, ok ? "OK" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <mono 16-bit wav>...\n", argv[0]);
+        return 2;
+    }
+
+    bool ok = true;
+    for (int i = 1; i < argc; i++) {
+        Wav wav;
+        if (!ReadWav(argv[i], wav)) {
+            return 2;
+        }
+        std::string fixture = argv[i];
+        fixture = fixture.substr(fixture.find_last_of('/') + 1);
+
+        // At 100% nothing may change
+        auto passthrough = Run(wav, [](int block) { return 100; });
+        ok &= Check(fixture.c_str(), "100%", wav, passthrough);
+        ok &= passthrough.output_samples == wav.pcm.size();
+
+        // Fast until the end, the held back audio must come out of Drain
+        ok &= Check(fixture.c_str(), "110%", wav, Run(wav, [](int block) { return 110; }));
+        ok &= Check(fixture.c_str(), "95%", wav, Run(wav, [](int block) { return 95; }));
+
+        // Speed changes like a bursty network causes them
+        ok &= Check(fixture.c_str(), "mixed", wav, Run(wav, [](int block) {
+            static const int speeds[] = {100, 100, 110, 110, 110, 105, 105, 100, 95, 95, 95, 100, 110, 120, 80, 100};
+            return speeds[block % (sizeof(speeds) / sizeof(speeds[0]))];
+        }));
+    }
+    return ok ? 0 : 1;
+}